@@ -15,3 +15,8 @@ mkdir -p shaders/build
 ./thirdparty/build/bin/shaderc \
 -f shaders/f_simple.sc -o shaders/build/f_simple.bin \
 --platform "$PLATFORM" --type fragment "$ARGS" -i ./
+
+# upscale of the scene to the window
+./thirdparty/build/bin/shaderc \
+-f shaders/f_upscale.sc -o shaders/build/f_upscale.bin \
+--platform "$PLATFORM" --type fragment "$ARGS" -i ./
@@ -1,4 +1,4 @@
-// time, num sdfs, 0, 0
+// time, num sdfs, gl_FragCoord y of the first row of the view, step heatmap
 uniform vec4 u_globals;
 
 float rand(vec2 co)
@@ -6,11 +6,19 @@ float rand(vec2 co)
     return fract(sin(dot(co, vec2(12.9898, 78.233))) * 43758.5453);
 }
 
+// Pixel position in the view. Views drawn to part of a render target start at
+// its top, which bottom left origin renderers count from the other end.
+vec2 view_coord()
+{
+    return gl_FragCoord.xy - vec2(u_viewRect.x, u_globals[2]);
+}
+
 vec3 pixel_direction()
 {
+    vec2 coord = view_coord();
     vec4 near = vec4(
-        2.0 * (((gl_FragCoord.x - u_viewRect[0]) / u_viewRect[2]) - 0.5),
-        2.0 * (((gl_FragCoord.y - u_viewRect[1]) / u_viewRect[3]) - 0.5),
+        2.0 * ((coord.x / u_viewRect[2]) - 0.5),
+        2.0 * ((coord.y / u_viewRect[3]) - 0.5),
         0.0,
         1.0
     );
@@ -16,11 +16,19 @@ vec3 palette(float t)
     return a + b*cos(6.28318*(c*t+d));
 }
 
+// Blue for few march steps through green to red for MAX_STEPS
+vec3 heatmap(float t)
+{
+    return clamp(vec3(2.0 * t - 1.0, 1.0 - abs(2.0 * t - 1.0), 1.0 - 2.0 * t), 0.0, 1.0);
+}
+
 void main()
 {
     vec4 eye_pos = mul(u_invView, vec4(1.0, 1.0, 1.0, 1.0));
     vec3 pixel_dir = pixel_direction();
-    float d = ray_march(eye_pos.xyz, pixel_dir.xyz);
+    select_tile();
+    float start = temporal_start(eye_pos.xyz, pixel_dir.xyz);
+    float d = ray_march(eye_pos.xyz, pixel_dir.xyz, start);
 
     float alpha = step(d, MAX_DIST);
 
@@ -31,6 +39,12 @@ void main()
     float rim = pow(dot(-pixel_dir.xyz, n), RIM_GRADIENT);
     vec3 base = palette(u_globals[0] * 0.1 + d * 0.1);
     vec3 col = base * rim * alpha;
-
-    gl_FragColor = vec4(col, 1.0);
+    if (u_globals[3] > 0.5)
+    {
+        col = heatmap(g_steps / float(MAX_STEPS));
+    }
+
+    // Hit distance for the next frame to start from, see temporal_start
+    gl_FragData[0] = vec4(col, 1.0);
+    gl_FragData[1] = vec4(d, 0.0, 0.0, 0.0);
 }
@@ -0,0 +1,17 @@
+#include <bgfx_shader.sh>
+
+// Scene rendered at a lower resolution, see ResolutionScaler
+SAMPLER2D(s_scene, 0);
+// used width / texture width, used height / texture height, origin bottom left, 0
+uniform vec4 u_upscale;
+
+void main()
+{
+    vec2 uv = (gl_FragCoord.xy - u_viewRect.xy) / u_viewRect.zw;
+
+    // The scene is in the top left of the texture, which is its last rows if the origin is bottom left
+    uv.x *= u_upscale.x;
+    uv.y = u_upscale.z > 0.5 ? 1.0 - (1.0 - uv.y) * u_upscale.y : uv.y * u_upscale.y;
+
+    gl_FragColor = vec4(texture2D(s_scene, uv).rgb, 1.0);
+}
@@ -1,5 +1,42 @@
-const int MAX_SDF = 512;
-uniform vec4 u_positions[MAX_SDF];
+// Blob positions and radii, one per texel
+SAMPLER2D(s_blobs, 1);
+// blob texture width, blob texture height, 0, 0
+uniform vec4 u_blobInfo;
+
+// Per screen tile blob index lists, see TileBinner
+SAMPLER2D(s_tiles, 0);
+// tiles x, tile size, tile texture width, tile texture height
+uniform vec4 u_tileInfo;
+
+// Sparse brick map of conservative surface distances, see BrickMap
+SAMPLER3D(s_brickGrid, 2);
+SAMPLER3D(s_brickAtlas, 3);
+// enabled, grid origin x, grid origin z (in bricks), 0
+uniform vec4 u_brickInfo;
+
+// Hit distances of the last frame, see temporal_start
+SAMPLER2D(s_history, 4);
+// enabled, origin bottom left, 0, 0
+uniform vec4 u_temporal;
+// last frame's render width and height, target width and height
+uniform vec4 u_historyInfo;
+// last frame's eye position
+uniform vec4 u_prevEye;
+uniform mat4 u_prevViewProj;
+
+// Blob BVH nodes, see BlobBvh
+SAMPLER2D(s_bvh, 5);
+// enabled, texture width, texture height, 0
+uniform vec4 u_bvhInfo;
+
+// Must match brick-map.h
+const float BRICK_SIZE = 8.0;
+const float BRICK_SAMPLES = 9.0;
+const vec3 BRICK_GRID = vec3(32.0, 16.0, 32.0);
+const float BRICK_ATLAS_SLOTS = 16.0;
+const float BRICK_ATLAS_SIZE = 144.0;
+const float BRICK_BOUND_MARGIN = 0.87 + 1.0 + 1.3;
+const float BRICK_MIN_STEP = 0.5;
 
 const int MAX_STEPS = 100;
 const float MAX_DIST = 100.0;
@@ -7,6 +44,19 @@ const float SURF_DIST = 0.01;
 
 const float SMOOTHNESS = 1.0;
 
+// Must match blob-bvh.h
+const int BVH_MAX_DEPTH = 32;
+// Nodes visited by one get_dist_bvh at most
+const int BVH_MAX_VISITS = 256;
+
+// Marching starts this far in front of last frame's surface, plus a fraction of its distance.
+// Covers the test wave moving blobs between frames.
+const float TEMPORAL_MARGIN = 0.5;
+const float TEMPORAL_MARGIN_SCALE = 0.02;
+// Neighbouring distances further apart than this fraction of the nearest are an edge,
+// surfaces hidden last frame may show up behind it
+const float TEMPORAL_EDGE = 0.1;
+
 // https://iquilezles.org/articles/distfunctions/
 float sdf_sphere(vec3 p, vec3 sp, float r)
 {
@@ -37,25 +87,124 @@ float smooth_intersection(float d1, float d2, float k)
     return mix(d2, d1, h) + k * h * (1.0 - h);
 }
 
-float get_dist(vec3 p)
+vec4 blob_data(float i)
+{
+    vec2 texel = vec2(mod(i, u_blobInfo.x), floor(i / u_blobInfo.x));
+    return texture2DLod(s_blobs, (texel + 0.5) / u_blobInfo.xy, 0.0);
+}
+
+float tile_data(float i)
+{
+    vec2 texel = vec2(mod(i, u_tileInfo.z), floor(i / u_tileInfo.z));
+    return texture2DLod(s_tiles, (texel + 0.5) / u_tileInfo.zw, 0.0).x;
+}
+
+// Blob index list of the current pixel's screen tile, see select_tile
+float g_tileOffset = 0.0;
+float g_tileCount = 0.0;
+
+void select_tile()
+{
+    vec2 tile = floor(view_coord() / u_tileInfo.y);
+    float index = tile.y * u_tileInfo.x + tile.x;
+    g_tileOffset = tile_data(index * 2.0);
+    g_tileCount = tile_data(index * 2.0 + 1.0);
+}
+
+// Distance to a blob, BlobWave and BlobBvh::Distance are the CPU reference
+float blob_dist(vec3 p, vec4 blob)
+{
+    // test wave
+    vec3 pos = blob.xyz;
+    pos.y += sin(mod(pos.x + pos.z, 16) * u_globals[0] * 0.5) * 0.3 +
+        cos(pos.x * u_globals[0] * 0.1);
+
+    return sdf_sphere(
+        p,
+        pos,
+        blob.w
+    );
+}
+
+vec4 bvh_data(float i)
+{
+    vec2 texel = vec2(mod(i, u_bvhInfo.y), floor(i / u_bvhInfo.y));
+    return texture2DLod(s_bvh, (texel + 0.5) / u_bvhInfo.yz, 0.0);
+}
+
+// Signed distance to the bounds of a BVH node
+float bvh_node_dist(vec3 p, vec4 nodeMin, vec4 nodeMax)
+{
+    vec3 q = max(nodeMin.xyz - p, p - nodeMax.xyz);
+    return length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0);
+}
+
+// Field of the blobs near p, see BlobBvh
+float get_dist_bvh(vec3 p)
 {
     float field = MAX_DIST;
+    float stack[BVH_MAX_DEPTH];
+    int size = 0;
+    float node = 0.0;
+    for (int i = 0; i < BVH_MAX_VISITS; i++)
+    {
+        vec4 nodeMin = bvh_data(node * 2.0);
+        vec4 nodeMax = bvh_data(node * 2.0 + 1.0);
+        if (bvh_node_dist(p, nodeMin, nodeMax) < field)
+        {
+            if (nodeMax.w >= 0.0)
+            {
+                for (float j = 0.0; j < nodeMax.w; j += 1.0)
+                {
+                    field = smooth_union(field, blob_dist(p, blob_data(nodeMin.w + j)), SMOOTHNESS);
+                }
+            }
+            else
+            {
+                // Nearer child first, it shrinks the field before the other is tested
+                float axis = -1.0 - nodeMax.w;
+                vec3 center = (nodeMin.xyz + nodeMax.xyz) * 0.5;
+                bool leftFirst = axis == 0.0 ? p.x < center.x : (axis == 1.0 ? p.y < center.y : p.z < center.z);
+                stack[size] = leftFirst ? nodeMin.w : node + 1.0;
+                size++;
+                node = leftFirst ? node + 1.0 : nodeMin.w;
+                continue;
+            }
+        }
+
+        if (size == 0)
+        {
+            return field;
+        }
+        size--;
+        node = stack[size];
+    }
 
-    for (int i = 0; i < int(u_globals[1]); i++)
+    // Out of visits, blobs of the nodes left are no closer than their bounds
+    field = min(field, bvh_node_dist(p, bvh_data(node * 2.0), bvh_data(node * 2.0 + 1.0)));
+    for (int i = 0; i < size; i++)
     {
-        // test wave
-        vec3 pos = u_positions[i].xyz;
-        pos.y += sin(mod(pos.x + pos.z, 16) * u_globals[0] * 0.5) * 0.3 +
-            cos(pos.x * u_globals[0] * 0.1);
+        field = min(field, bvh_node_dist(p, bvh_data(stack[i] * 2.0), bvh_data(stack[i] * 2.0 + 1.0)));
+    }
+    return field;
+}
 
-        float dist = sdf_sphere(
-            p,
-            pos,
-            u_positions[i].w
-        );
+float get_dist(vec3 p)
+{
+    if (u_bvhInfo.x != 0.0)
+    {
+        return get_dist_bvh(p);
+    }
+
+    float field = MAX_DIST;
+
+    // Only blobs whose bounds cover this tile can affect rays through it
+    for (int i = 0; i < int(g_tileCount); i++)
+    {
+        vec4 blob = blob_data(tile_data(g_tileOffset + float(i)));
         field = smooth_union(
             field,
-            dist,
+            blob_dist(p, blob),
             SMOOTHNESS
         );
     }
@@ -75,13 +224,144 @@ vec3 get_normal(vec3 p)
     return normalize(norm);
 }
 
-float ray_march(vec3 origin, vec3 direction)
+// Safe distance to step along direction from p, 0 if the exact distance is needed.
+// BrickMap::BrickStep is the CPU reference.
+float brick_step(vec3 p, vec3 direction)
 {
-    float d = 0.0;
+    if (u_brickInfo.x == 0.0)
+    {
+        return 0.0;
+    }
+
+    vec3 brick = floor(p / BRICK_SIZE);
+    vec3 cell = brick - vec3(u_brickInfo.y, 0.0, u_brickInfo.z);
+    if (min(cell.x, min(cell.y, cell.z)) < 0.0 ||
+        cell.x >= BRICK_GRID.x || cell.y >= BRICK_GRID.y || cell.z >= BRICK_GRID.z)
+    {
+        return 0.0;
+    }
+
+    // The grid is toroidal around the camera
+    vec3 gridCoord = vec3(mod(brick.x, BRICK_GRID.x), brick.y, mod(brick.z, BRICK_GRID.z));
+    float value = texture3DLod(s_brickGrid, (gridCoord + 0.5) / BRICK_GRID, 0.0).x;
+    if (value < 0.0)
+    {
+        // Unknown
+        return 0.0;
+    }
+
+    vec3 local = p - brick * BRICK_SIZE;
+    if (value == 0.0)
+    {
+        // Empty, step to where the ray leaves the brick
+        vec3 toEdge = mix(local, BRICK_SIZE - local, step(0.0, direction));
+        vec3 exits = toEdge / max(abs(direction), vec3_splat(1e-6));
+        return min(exits.x, min(exits.y, exits.z)) + 0.01;
+    }
+
+    float slot = value - 1.0;
+    vec3 slotCoord = vec3(
+        mod(slot, BRICK_ATLAS_SLOTS),
+        mod(floor(slot / BRICK_ATLAS_SLOTS), BRICK_ATLAS_SLOTS),
+        floor(slot / (BRICK_ATLAS_SLOTS * BRICK_ATLAS_SLOTS))
+    );
+    vec3 uvw = (slotCoord * BRICK_SAMPLES + clamp(local, 0.0, BRICK_SIZE) + 0.5) / BRICK_ATLAS_SIZE;
+    float bound = texture3DLod(s_brickAtlas, uvw, 0.0).x - BRICK_BOUND_MARGIN;
+    return bound < BRICK_MIN_STEP ? 0.0 : bound;
+}
+
+// Last frame's hit distance at a pixel of its view, more than MAX_DIST where it missed
+float history_distance(vec2 texel)
+{
+    texel = clamp(texel, vec2_splat(0.0), u_historyInfo.xy - 1.0);
+    // The view was the top rows of the target, the last ones with a bottom left origin
+    if (u_temporal.y > 0.5)
+    {
+        texel.y += u_historyInfo.w - u_historyInfo.y;
+    }
+    return texture2DLod(s_history, (texel + 0.5) / u_historyInfo.zw, 0.0).x;
+}
+
+// Distance along the ray to start marching at, in front of the surface last frame saw there.
+// 0 where last frame can't tell: misses, edges, and surfaces that were off screen or hidden.
+float temporal_start(vec3 origin, vec3 direction)
+{
+    if (u_temporal.x == 0.0)
+    {
+        return 0.0;
+    }
+
+    // Guess the hit from the same pixel last frame, and find where that point was on screen
+    vec2 uv = view_coord() / u_viewRect.zw;
+    float guess = history_distance(floor(uv * u_historyInfo.xy));
+    if (guess > MAX_DIST)
+    {
+        return 0.0;
+    }
+
+    vec3 p = origin + direction * guess;
+    vec4 clip = mul(u_prevViewProj, vec4(p, 1.0));
+    if (clip.w <= 0.0)
+    {
+        return 0.0;
+    }
+    vec2 prevUv = clip.xy / clip.w * 0.5 + 0.5;
+    if (any(lessThan(prevUv, vec2_splat(0.0))) || any(greaterThan(prevUv, vec2_splat(1.0))))
+    {
+        return 0.0;
+    }
+
+    // Nearest of the four pixels around it, their rays are close enough to this one's to share a direction
+    vec2 texel = floor(prevUv * u_historyInfo.xy - 0.5);
+    float d00 = history_distance(texel);
+    float d10 = history_distance(texel + vec2(1.0, 0.0));
+    float d01 = history_distance(texel + vec2(0.0, 1.0));
+    float d11 = history_distance(texel + vec2(1.0, 1.0));
+    float nearest = min(min(d00, d10), min(d01, d11));
+    float farthest = max(max(d00, d10), max(d01, d11));
+    if (farthest > MAX_DIST || farthest - nearest > nearest * TEMPORAL_EDGE)
+    {
+        return 0.0;
+    }
+
+    // Last frame's surface must lie on this ray, or it was seen from too far away to tell
+    vec3 hit = u_prevEye.xyz + normalize(p - u_prevEye.xyz) * nearest;
+    float t = dot(hit - origin, direction);
+    float margin = TEMPORAL_MARGIN + t * TEMPORAL_MARGIN_SCALE;
+    if (length(hit - (origin + direction * t)) > margin)
+    {
+        return 0.0;
+    }
+    return max(t - margin, 0.0);
+}
+
+// Steps taken by ray_march, for the heatmap
+float g_steps = 0.0;
+
+float ray_march(vec3 origin, vec3 direction, float start)
+{
+    // A start inside a surface went past where the ray enters it, march from the eye instead
+    float d = start;
+    if (d > 0.0)
+    {
+        g_steps += 1.0;
+        if (get_dist(origin + direction * d) < 0.0)
+        {
+            d = 0.0;
+        }
+    }
+
     for (int i = 0; i < MAX_STEPS; i++)
     {
         vec3 p = origin + direction * d;
-        float sd = get_dist(p);
+        g_steps += 1.0;
+
+        // Skip space the brick map bounds, evaluate blobs near the surface
+        float sd = brick_step(p, direction);
+        if (sd <= 0.0)
+        {
+            sd = get_dist(p);
+        }
         d += sd;
         if (d > MAX_DIST || sd < SURF_DIST)
         {
@@ -0,0 +1,55 @@
+#include <cstdlib>
+#include <new>
+
+#include "alloc-counter.h"
+
+#ifdef BLOBBY_COUNT_ALLOCATIONS
+static thread_local uint64_t t_allocationCount = 0;
+static thread_local int t_uncounted = 0;
+
+// Replacing these also covers the array and nothrow forms, which call them by default
+void* operator new(std::size_t size)
+{
+    if (t_uncounted == 0)
+        t_allocationCount++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+namespace blobby
+{
+    uint64_t GetThreadAllocationCount()
+    {
+#ifdef BLOBBY_COUNT_ALLOCATIONS
+        return t_allocationCount;
+#else
+        return 0;
+#endif
+    }
+
+    UncountedAllocations::UncountedAllocations()
+    {
+#ifdef BLOBBY_COUNT_ALLOCATIONS
+        t_uncounted++;
+#endif
+    }
+
+    UncountedAllocations::~UncountedAllocations()
+    {
+#ifdef BLOBBY_COUNT_ALLOCATIONS
+        t_uncounted--;
+#endif
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations through operator new are counted per thread when
+// BLOBBY_COUNT_ALLOCATIONS is defined, debug builds by default. Only operator new
+// is tracked: malloc and the allocators of bgfx, SDL and ImGui aren't counted.
+
+namespace blobby
+{
+    // Allocations made by the calling thread so far, always 0 when not counting
+    uint64_t GetThreadAllocationCount();
+
+    // Allocations on the calling thread aren't counted while one is alive,
+    // for one-off work a frame does on request, like exporting a trace
+    class UncountedAllocations
+    {
+      public:
+        UncountedAllocations();
+        ~UncountedAllocations();
+
+        UncountedAllocations(const UncountedAllocations&) = delete;
+        UncountedAllocations& operator=(const UncountedAllocations&) = delete;
+    };
+}
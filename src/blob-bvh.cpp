@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "blob-bvh.h"
+#include "constants.h"
+
+namespace blobby
+{
+    // Spreads the low 10 bits of v to every third bit
+    static uint32_t ExpandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    static float Axis(Vec3 v, int axis)
+    {
+        return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+    }
+
+    // Signed, negative inside the box
+    static float BoxDistance(Vec3 p, Vec3 min, Vec3 max)
+    {
+        float dx = std::max(min.x - p.x, p.x - max.x);
+        float dy = std::max(min.y - p.y, p.y - max.y);
+        float dz = std::max(min.z - p.z, p.z - max.z);
+        float outside = length({std::max(dx, 0.0f), std::max(dy, 0.0f), std::max(dz, 0.0f)});
+        return outside + std::min(std::max(dx, std::max(dy, dz)), 0.0f);
+    }
+
+    float BlobWave(Vec3 position, float time)
+    {
+        // GLSL mod, the result has the sign of the divisor
+        float offset = position.x + position.z;
+        offset -= 16.0f * floorf(offset / 16.0f);
+        return sinf(offset * time * 0.5f) * 0.3f + cosf(position.x * time * 0.1f);
+    }
+
+    float SmoothUnion(float d1, float d2, float k)
+    {
+        float h = clamp(0.5f + 0.5f * (d2 - d1) / k, 0.0f, 1.0f);
+        return d2 + (d1 - d2) * h - k * h * (1.0f - h);
+    }
+
+    static float BlobDistance(const Blob& blob, Vec3 p, float time)
+    {
+        Vec3 position = blob.Position;
+        position.y += BlobWave(blob.Position, time);
+        return distance(p, position) - blob.Radius;
+    }
+
+    void BlobBvh::Build(const Blob* blobs, int blobCount)
+    {
+        m_blobs.resize(blobCount);
+        m_nodes.clear();
+        m_data.clear();
+        m_depth = 0;
+        if (blobCount == 0)
+            return;
+
+        // Morton codes of the centers quantized to 10 bits per axis over their bounds
+        Vec3 min = blobs[0].Position;
+        Vec3 max = blobs[0].Position;
+        for (int i = 1; i < blobCount; i++)
+        {
+            const Vec3& p = blobs[i].Position;
+            min = {std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z)};
+            max = {std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z)};
+        }
+        Vec3 scale = {1023.0f / std::max(max.x - min.x, 1e-6f), 1023.0f / std::max(max.y - min.y, 1e-6f),
+                      1023.0f / std::max(max.z - min.z, 1e-6f)};
+
+        m_keys.resize(blobCount);
+        m_sortBuffer.resize(blobCount);
+        for (int i = 0; i < blobCount; i++)
+        {
+            const Vec3& p = blobs[i].Position;
+            uint32_t x = uint32_t((p.x - min.x) * scale.x);
+            uint32_t y = uint32_t((p.y - min.y) * scale.y);
+            uint32_t z = uint32_t((p.z - min.z) * scale.z);
+            uint32_t code = (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+            m_keys[i] = (uint64_t(code) << 32) | uint32_t(i);
+        }
+
+        // Radix sort of the 30 bit codes, 10 bits per pass. Stable, so equal codes keep the input order.
+        for (int shift = 32; shift < 62; shift += 10)
+        {
+            uint32_t counts[1024] = {};
+            for (uint64_t key : m_keys)
+                counts[(key >> shift) & 1023]++;
+
+            uint32_t offset = 0;
+            for (uint32_t& count : counts)
+            {
+                uint32_t next = offset + count;
+                count = offset;
+                offset = next;
+            }
+
+            for (uint64_t key : m_keys)
+                m_sortBuffer[counts[(key >> shift) & 1023]++] = key;
+            m_keys.swap(m_sortBuffer);
+        }
+
+        for (int i = 0; i < blobCount; i++)
+        {
+            m_blobs[i] = blobs[uint32_t(m_keys[i])];
+        }
+
+        // At most one leaf per blob, so fewer than 2 * blobCount nodes
+        m_nodes.reserve(blobCount * 2);
+        BuildNode(0, blobCount, 1);
+
+        m_data.resize(m_nodes.size() * 8);
+        for (size_t i = 0; i < m_nodes.size(); i++)
+        {
+            const Node& node = m_nodes[i];
+            float* data = &m_data[i * 8];
+            data[0] = node.min.x;
+            data[1] = node.min.y;
+            data[2] = node.min.z;
+            data[3] = float(node.index);
+            data[4] = node.max.x;
+            data[5] = node.max.y;
+            data[6] = node.max.z;
+            data[7] = float(node.info);
+        }
+    }
+
+    int BlobBvh::BuildNode(int first, int last, int depth)
+    {
+        m_depth = std::max(m_depth, depth);
+        int index = (int)m_nodes.size();
+        m_nodes.push_back({});
+
+        if (last - first <= BVH_LEAF_SIZE || depth == BVH_MAX_DEPTH)
+        {
+            // Spheres moved by the test wave, inflated by the smooth union radius
+            Vec3 min = {INFINITY, INFINITY, INFINITY};
+            Vec3 max = {-INFINITY, -INFINITY, -INFINITY};
+            for (int i = first; i < last; i++)
+            {
+                const Blob& blob = m_blobs[i];
+                float extent = blob.Radius + SMOOTHNESS;
+                Vec3 p = blob.Position;
+                min = {std::min(min.x, p.x - extent), std::min(min.y, p.y - extent - WAVE_AMPLITUDE),
+                       std::min(min.z, p.z - extent)};
+                max = {std::max(max.x, p.x + extent), std::max(max.y, p.y + extent + WAVE_AMPLITUDE),
+                       std::max(max.z, p.z + extent)};
+            }
+            m_nodes[index] = {min, max, first, last - first};
+            return index;
+        }
+
+        // Split where the highest bit that differs in the range changes, in the middle if all codes are equal
+        uint32_t firstCode = uint32_t(m_keys[first] >> 32);
+        uint32_t lastCode = uint32_t(m_keys[last - 1] >> 32);
+        int split = (first + last) / 2;
+        int axis = 0;
+        if (firstCode != lastCode)
+        {
+            int bit = 31 - std::countl_zero(firstCode ^ lastCode);
+            uint64_t prefix = uint64_t((lastCode >> bit) << bit) << 32;
+            split = int(std::lower_bound(m_keys.begin() + first, m_keys.begin() + last, prefix) - m_keys.begin());
+            // x, y and z bits are interleaved from the top
+            axis = 2 - bit % 3;
+        }
+
+        int left = BuildNode(first, split, depth + 1);
+        int right = BuildNode(split, last, depth + 1);
+        const Node& a = m_nodes[left];
+        const Node& b = m_nodes[right];
+        m_nodes[index] = {{std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z)},
+                          {std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z)},
+                          right,
+                          -1 - axis};
+        return index;
+    }
+
+    float BlobBvh::Distance(Vec3 p, float time, int* evaluatedBlobs) const
+    {
+        float field = FAR_PLANE;
+        int evaluated = 0;
+        if (!m_nodes.empty())
+        {
+            int stack[BVH_MAX_DEPTH];
+            int size = 0;
+            int index = 0;
+            bool finished = false;
+            for (int visit = 0; visit < BVH_MAX_VISITS; visit++)
+            {
+                const Node& node = m_nodes[index];
+                if (BoxDistance(p, node.min, node.max) < field)
+                {
+                    if (node.info >= 0)
+                    {
+                        for (int i = node.index; i < node.index + node.info; i++)
+                        {
+                            field = SmoothUnion(field, BlobDistance(m_blobs[i], p, time), SMOOTHNESS);
+                        }
+                        evaluated += node.info;
+                    }
+                    else
+                    {
+                        // Nearer child first, it shrinks the field before the other is tested
+                        int axis = -1 - node.info;
+                        bool leftFirst = Axis(p, axis) < (Axis(node.min, axis) + Axis(node.max, axis)) * 0.5f;
+                        stack[size++] = leftFirst ? node.index : index + 1;
+                        index = leftFirst ? index + 1 : node.index;
+                        continue;
+                    }
+                }
+
+                if (size == 0)
+                {
+                    finished = true;
+                    break;
+                }
+                index = stack[--size];
+            }
+
+            // Out of visits, blobs of the nodes left are no closer than their bounds
+            if (!finished)
+            {
+                field = std::min(field, BoxDistance(p, m_nodes[index].min, m_nodes[index].max));
+                for (int i = 0; i < size; i++)
+                    field = std::min(field, BoxDistance(p, m_nodes[stack[i]].min, m_nodes[stack[i]].max));
+            }
+        }
+
+        if (evaluatedBlobs)
+            *evaluatedBlobs = evaluated;
+        return field;
+    }
+
+    float BlobBvh::DistanceBruteForce(const Blob* blobs, int blobCount, Vec3 p, float time)
+    {
+        float field = FAR_PLANE;
+        for (int i = 0; i < blobCount; i++)
+        {
+            field = SmoothUnion(field, BlobDistance(blobs[i], p, time), SMOOTHNESS);
+        }
+        return field;
+    }
+}
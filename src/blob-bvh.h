@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "blob.h"
+
+// Most blobs in a leaf, nodes at the depth limit can hold more
+#define BVH_LEAF_SIZE 4
+// Nodes this deep become leaves, bounds the traversal stack. Must match the sdf shader.
+#define BVH_MAX_DEPTH 32
+// Width of the BVH node texture in texels, two per node
+#define BVH_TEXTURE_WIDTH 1024
+// Nodes visited by one traversal at most. Must match the sdf shader.
+#define BVH_MAX_VISITS 256
+
+namespace blobby
+{
+    // Offset of a blob by the test wave in the sdf shader
+    float BlobWave(Vec3 position, float time);
+    // smooth_union in the sdf shader
+    float SmoothUnion(float d1, float d2, float k);
+
+    // Linear BVH over blob spheres, rebuilt every frame so the shader evaluates only blobs near a point.
+    //
+    // Blobs are sorted along a Morton curve of their centers and split top down where the highest
+    // bit of their codes changes, leaves hold ranges of the sorted blobs. Bounds cover the test
+    // wave and are inflated by the smooth union radius: a blob can only change the field at p if
+    // the signed distance from p to the bounds is less than the field so far. The field only
+    // ever shrinks, so bounds farther than it can be skipped for good.
+    //
+    // Nodes are flattened depth first for a RGBA32F texture, two texels each:
+    //   [node * 8 + 0..3] min x, y, z, index of the right child or of the leaf's first blob
+    //   [node * 8 + 4..7] max x, y, z, -1 - split axis for internal nodes or the leaf's blob count
+    // The left child of an internal node follows it, and is on the low side of the split axis.
+    class BlobBvh
+    {
+      public:
+        void Build(const Blob* blobs, int blobCount);
+
+        // Blobs in leaf order, these are rendered instead of the blobs given to Build
+        const std::vector<Blob>& GetBlobs() const
+        {
+            return m_blobs;
+        }
+
+        const std::vector<float>& GetData() const
+        {
+            return m_data;
+        }
+
+        int GetNodeCount() const
+        {
+            return (int)m_nodes.size();
+        }
+
+        int GetDepth() const
+        {
+            return m_depth;
+        }
+
+        // CPU reference of get_dist_bvh in the sdf shader. Like it, traversal stops after BVH_MAX_VISITS
+        // nodes and the nodes left only bound the field by their boxes, which can lower it far from blobs.
+        // Nearer children are visited first, so blobs are blended in a different order than by
+        // DistanceBruteForce. Smooth unions aren't associative and each blend can lower the field
+        // below its nearest blob, so the results differ by up to SMOOTHNESS / 4 per blob blended
+        // in near the surface. Blobs skipped for their bounds leave the field as it is.
+        float Distance(Vec3 p, float time, int* evaluatedBlobs = nullptr) const;
+
+        // Field of all blobs in order, like get_dist with every blob in one tile
+        static float DistanceBruteForce(const Blob* blobs, int blobCount, Vec3 p, float time);
+
+      private:
+        struct Node
+        {
+            Vec3 min;
+            Vec3 max;
+            // Right child of internal nodes, first blob of leaves
+            int index;
+            // -1 - split axis of internal nodes, blob count of leaves
+            int info;
+        };
+
+        // Builds the node for sorted blobs [first, last), returns its index
+        int BuildNode(int first, int last, int depth);
+
+        std::vector<Blob> m_blobs;
+        // Morton code << 32 | blob index, and a buffer for sorting them
+        std::vector<uint64_t> m_keys;
+        std::vector<uint64_t> m_sortBuffer;
+        std::vector<Node> m_nodes;
+        std::vector<float> m_data;
+        int m_depth = 0;
+    };
+}
@@ -0,0 +1,309 @@
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "blob-cull.h"
+#include "simd.h"
+#include "terrain.h"
+
+namespace blobby
+{
+    // Cell layout of a chunk LOD level, see Chunk::GetBlob
+    struct CullLayout
+    {
+        int shift;
+        int mask;
+        float baseX;
+        float baseZ;
+        float size;
+        float offset;
+        float radius;
+        // Frustum planes relative to the camera, moved out by the radius and margin
+        Vec4 planes[6];
+    };
+
+    // Built once per call and shared by the kernels, so they all test against the same floats
+    static CullLayout GetCullLayout(int lodLevel, int chunkX, int chunkZ, const BlobCullParams& params)
+    {
+        CullLayout layout;
+        int width = LodWidth(lodLevel);
+        layout.shift = 0;
+        while ((1 << layout.shift) < width)
+            layout.shift++;
+        layout.mask = width - 1;
+
+        layout.size = float(1 << lodLevel);
+        layout.offset = (layout.size - 1.0f) * 0.5f;
+        layout.baseX = chunkX * CHUNK_SIZE + layout.offset;
+        layout.baseZ = chunkZ * CHUNK_SIZE + layout.offset;
+        layout.radius = layout.size * 0.5f;
+
+        // Positions are relative to the camera, move the planes and add the radius to them
+        if (params.frustum)
+        {
+            for (int p = 0; p < 6; p++)
+            {
+                Vec4 plane = params.frustum->planes[p];
+                plane.w += plane.x * params.camera.x + plane.y * params.camera.y + plane.z * params.camera.z +
+                           layout.radius + params.frustumMargin;
+                layout.planes[p] = plane;
+            }
+        }
+        return layout;
+    }
+
+    // Tests the surface cells of one level, returns the number of visible cells written
+    static int CullRange(const uint64_t* surface, int count, const CullLayout& layout, const BlobCullParams& params,
+                         uint32_t* visible, int* frustumCulled)
+    {
+        const float maxDistance = params.maxDistance + layout.radius;
+        const float maxDistanceSquared = maxDistance * maxDistance;
+        const Vec4* planes = layout.planes;
+
+        int visibleCount = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (((surface[i >> 6] >> (i & 63)) & 1) == 0)
+                continue;
+
+            float x = layout.baseX - params.camera.x + (i & layout.mask) * layout.size;
+            float z = layout.baseZ - params.camera.z + ((i >> layout.shift) & layout.mask) * layout.size;
+            float y = layout.offset - params.camera.y + (i >> (2 * layout.shift)) * layout.size;
+            if (x * x + y * y + z * z > maxDistanceSquared)
+                continue;
+
+            bool inside = true;
+            for (int p = 0; p < 6 && params.frustum; p++)
+            {
+                inside &= x * planes[p].x + y * planes[p].y + (z * planes[p].z + planes[p].w) >= 0.0f;
+            }
+            if (!inside)
+            {
+                (*frustumCulled)++;
+                continue;
+            }
+
+            visible[visibleCount++] = (uint32_t)i;
+        }
+        return visibleCount;
+    }
+
+    static BlobCullResult CullChunkBlobsScalar(const uint64_t* surface, int lodLevel, const CullLayout& layout,
+                                               const BlobCullParams& params, uint32_t* visible)
+    {
+        BlobCullResult result = {};
+        result.visible = CullRange(surface, LodBlobCount(lodLevel), layout, params, visible, &result.frustumCulled);
+        return result;
+    }
+
+    BlobCullResult CullChunkBlobsScalar(const uint64_t* surface, int lodLevel, int chunkX, int chunkZ,
+                                        const BlobCullParams& params, uint32_t* visible)
+    {
+        CullLayout layout = GetCullLayout(lodLevel, chunkX, chunkZ, params);
+        return CullChunkBlobsScalar(surface, lodLevel, layout, params, visible);
+    }
+
+#if BLOBBY_SSE
+    // Appends the lane indices set in mask
+    static inline int Compact(uint32_t mask, uint32_t first, uint32_t* visible)
+    {
+        int count = 0;
+        while (mask)
+        {
+            int lane = CountTrailingZeros(mask);
+            visible[count++] = first + lane;
+            mask &= mask - 1;
+        }
+        return count;
+    }
+
+    static BlobCullResult CullChunkBlobsSSE(const uint64_t* surface, int lodLevel, const CullLayout& layout,
+                                            const BlobCullParams& params, uint32_t* visible)
+    {
+        BlobCullResult result = {};
+        int count = LodBlobCount(lodLevel);
+
+        const __m128i mask = _mm_set1_epi32(layout.mask);
+        const __m128i shift = _mm_cvtsi32_si128(layout.shift);
+        const __m128i shift2 = _mm_cvtsi32_si128(2 * layout.shift);
+        const __m128 size = _mm_set1_ps(layout.size);
+        const __m128 baseX = _mm_set1_ps(layout.baseX - params.camera.x);
+        const __m128 baseY = _mm_set1_ps(layout.offset - params.camera.y);
+        const __m128 baseZ = _mm_set1_ps(layout.baseZ - params.camera.z);
+        const float maxDistance = params.maxDistance + layout.radius;
+        const __m128 maxDistanceSquared = _mm_set1_ps(maxDistance * maxDistance);
+
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+        if (params.frustum)
+        {
+            for (int p = 0; p < 6; p++)
+            {
+                const Vec4& plane = layout.planes[p];
+                planeX[p] = _mm_set1_ps(plane.x);
+                planeY[p] = _mm_set1_ps(plane.y);
+                planeZ[p] = _mm_set1_ps(plane.z);
+                planeW[p] = _mm_set1_ps(plane.w);
+            }
+        }
+
+        // Only groups of 4 cells with surface bits are tested, most words of a chunk are empty
+        int words = (count + 63) / 64;
+        int wordIndex = 0;
+        uint64_t word = surface[0];
+        while (true)
+        {
+            while (word == 0 && ++wordIndex < words)
+                word = surface[wordIndex];
+            if (word == 0)
+                break;
+
+            int bit = CountTrailingZeros64(word) & ~3;
+            int solid = int(word >> bit) & 0xf;
+            word &= ~(uint64_t(0xf) << bit);
+            int i = wordIndex * 64 + bit;
+
+            // Expand the 4 surface bits to lane masks
+            __m128i solidLanes = _mm_setr_epi32(solid & 1, solid & 2, solid & 4, solid & 8);
+            solidLanes = _mm_cmpgt_epi32(solidLanes, _mm_setzero_si128());
+
+            __m128i index = _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+            __m128 x = _mm_add_ps(baseX, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(index, mask)), size));
+            __m128 z = _mm_add_ps(baseZ, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(index, shift), mask)), size));
+            __m128 y = _mm_add_ps(baseY, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srl_epi32(index, shift2)), size));
+
+            __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+            __m128 inRange = _mm_and_ps(_mm_castsi128_ps(solidLanes), _mm_cmple_ps(distanceSquared, maxDistanceSquared));
+            int inRangeMask = _mm_movemask_ps(inRange);
+            if (inRangeMask == 0)
+                continue;
+
+            int visibleMask = inRangeMask;
+            if (params.frustum)
+            {
+                __m128 inside = inRange;
+                for (int p = 0; p < 6; p++)
+                {
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])),
+                                          _mm_add_ps(_mm_mul_ps(z, planeZ[p]), planeW[p]));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+                }
+                visibleMask = _mm_movemask_ps(inside);
+                result.frustumCulled += PopCount(inRangeMask & ~visibleMask);
+            }
+
+            result.visible += Compact(visibleMask, i, visible + result.visible);
+        }
+
+        return result;
+    }
+
+    BLOBBY_TARGET_AVX2 static BlobCullResult CullChunkBlobsAVX2(const uint64_t* surface, int lodLevel,
+                                                                const CullLayout& layout,
+                                                                const BlobCullParams& params, uint32_t* visible)
+    {
+        BlobCullResult result = {};
+        int count = LodBlobCount(lodLevel);
+
+        const __m256i mask = _mm256_set1_epi32(layout.mask);
+        const __m128i shift = _mm_cvtsi32_si128(layout.shift);
+        const __m128i shift2 = _mm_cvtsi32_si128(2 * layout.shift);
+        const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const __m256 size = _mm256_set1_ps(layout.size);
+        const __m256 baseX = _mm256_set1_ps(layout.baseX - params.camera.x);
+        const __m256 baseY = _mm256_set1_ps(layout.offset - params.camera.y);
+        const __m256 baseZ = _mm256_set1_ps(layout.baseZ - params.camera.z);
+        const float maxDistance = params.maxDistance + layout.radius;
+        const __m256 maxDistanceSquared = _mm256_set1_ps(maxDistance * maxDistance);
+
+        __m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+        if (params.frustum)
+        {
+            for (int p = 0; p < 6; p++)
+            {
+                const Vec4& plane = layout.planes[p];
+                planeX[p] = _mm256_set1_ps(plane.x);
+                planeY[p] = _mm256_set1_ps(plane.y);
+                planeZ[p] = _mm256_set1_ps(plane.z);
+                planeW[p] = _mm256_set1_ps(plane.w);
+            }
+        }
+
+        // Same as the SSE kernel with groups of 8, every level has a multiple of 8 cells
+        int words = (count + 63) / 64;
+        int wordIndex = 0;
+        uint64_t word = surface[0];
+        while (true)
+        {
+            while (word == 0 && ++wordIndex < words)
+                word = surface[wordIndex];
+            if (word == 0)
+                break;
+
+            int bit = CountTrailingZeros64(word) & ~7;
+            int solid = int(word >> bit) & 0xff;
+            word &= ~(uint64_t(0xff) << bit);
+            int i = wordIndex * 64 + bit;
+
+            // Expand the 8 surface bits to lane masks
+            __m256i solidBits = _mm256_and_si256(_mm256_set1_epi32(solid), laneBits);
+            __m256i solidLanes = _mm256_cmpeq_epi32(solidBits, laneBits);
+
+            __m256i index = _mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            __m256 x = _mm256_add_ps(baseX, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(index, mask)), size));
+            __m256 z = _mm256_add_ps(
+                baseZ, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(index, shift), mask)), size));
+            __m256 y = _mm256_add_ps(baseY, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srl_epi32(index, shift2)), size));
+
+            __m256 distanceSquared =
+                _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+            __m256 inRange = _mm256_and_ps(_mm256_castsi256_ps(solidLanes),
+                                           _mm256_cmp_ps(distanceSquared, maxDistanceSquared, _CMP_LE_OQ));
+            int inRangeMask = _mm256_movemask_ps(inRange);
+            if (inRangeMask == 0)
+                continue;
+
+            int visibleMask = inRangeMask;
+            if (params.frustum)
+            {
+                __m256 inside = inRange;
+                for (int p = 0; p < 6; p++)
+                {
+                    __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, planeX[p]), _mm256_mul_ps(y, planeY[p])),
+                                             _mm256_add_ps(_mm256_mul_ps(z, planeZ[p]), planeW[p]));
+                    inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+                }
+                visibleMask = _mm256_movemask_ps(inside);
+                result.frustumCulled += PopCount(inRangeMask & ~visibleMask);
+            }
+
+            result.visible += Compact(visibleMask, i, visible + result.visible);
+        }
+
+        return result;
+    }
+#endif
+
+    BlobCullResult CullChunkBlobs(const uint64_t* surface, int lodLevel, int chunkX, int chunkZ,
+                                  const BlobCullParams& params, uint32_t* visible)
+    {
+        CullLayout layout = GetCullLayout(lodLevel, chunkX, chunkZ, params);
+#if BLOBBY_SSE
+        BlobCullResult result;
+        if (HasAVX2())
+            result = CullChunkBlobsAVX2(surface, lodLevel, layout, params, visible);
+        else
+            result = CullChunkBlobsSSE(surface, lodLevel, layout, params, visible);
+
+#ifndef NDEBUG
+        // Sized once per thread, the main thread helps with culling in frames that must not allocate
+        static thread_local std::vector<uint32_t> reference(BLOBS_IN_CHUNK);
+        BlobCullResult referenceResult = CullChunkBlobsScalar(surface, lodLevel, layout, params, reference.data());
+        assert(referenceResult.visible == result.visible && referenceResult.frustumCulled == result.frustumCulled);
+        assert(memcmp(reference.data(), visible, result.visible * sizeof(uint32_t)) == 0);
+#endif
+        return result;
+#else
+        return CullChunkBlobsScalar(surface, lodLevel, layout, params, visible);
+#endif
+    }
+}
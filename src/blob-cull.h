@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include "blob.h"
+#include "frustum.h"
+#include "math.h"
+
+namespace blobby
+{
+    struct BlobCullParams
+    {
+        Vec3 camera;
+        // Blobs further than this from the camera, plus their radius, are culled
+        float maxDistance;
+        // Spheres tested against the frustum, null to skip the test
+        const Frustum* frustum;
+        // Added to blob radii for the frustum test
+        float frustumMargin;
+    };
+
+    struct BlobCullResult
+    {
+        // Indices written to the output
+        int visible;
+        // Surface blobs in range but outside the frustum
+        int frustumCulled;
+    };
+
+    // Culls the surface cells of one LOD level of a chunk in batches, see Chunk::surface.
+    // Positions are generated from cell indices, only cells in range and inside the frustum are kept.
+    // Writes their indices to visible, which must hold LodBlobCount(lodLevel) indices.
+    BlobCullResult CullChunkBlobs(const uint64_t* surface, int lodLevel, int chunkX, int chunkZ,
+                                  const BlobCullParams& params, uint32_t* visible);
+
+    // Scalar reference
+    BlobCullResult CullChunkBlobsScalar(const uint64_t* surface, int lodLevel, int chunkX, int chunkZ,
+                                        const BlobCullParams& params, uint32_t* visible);
+}
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <cstdint>
+
 #include "math.h"
 
 namespace blobby
 {
-    enum BlobType
+    // Stored as a single byte per cell in chunks
+    enum BlobType : uint8_t
     {
         GROUND,
         AIR,
@@ -18,9 +21,8 @@ namespace blobby
         {
         }
 
-        Blob(float x, float y, float z, float radius, BlobType type)
+        Blob(float x, float y, float z, float radius, BlobType type) : Blob({x, y, z}, radius, type)
         {
-            Blob({x, y, z}, radius, type);
         }
 
         Blob(Vec3 position, float radius, BlobType type)
@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <cfloat>
+
+#include <bx/timer.h>
+
+#include "brick-map.h"
+#include "profiler.h"
+#include "terrain.h"
+
+// Cells per side of the region a brick's distances are computed from
+#define BRICK_REGION (BRICK_SAMPLES + 2 * BRICK_APRON)
+// Squared distance for air, finite so the distance transform doesn't produce NaNs
+#define BRICK_FAR 1e6f
+
+namespace blobby
+{
+    static int PositiveMod(int a, int b)
+    {
+        int m = a % b;
+        return m < 0 ? m + b : m;
+    }
+
+    static int FloorDiv(int a, int b)
+    {
+        return (a >= 0 ? a : a - (b - 1)) / b;
+    }
+
+    static int64_t ColumnKey(int brickX, int brickZ)
+    {
+        return (int64_t(brickX) << 32) | uint32_t(brickZ);
+    }
+
+    // Squared euclidean distance transform of a sampled function along one line.
+    // Felzenszwalb & Huttenlocher, "Distance Transforms of Sampled Functions".
+    static void DistanceTransform1D(const float* f, float* d, int n, int* v, float* z)
+    {
+        int k = 0;
+        v[0] = 0;
+        z[0] = -FLT_MAX;
+        z[1] = FLT_MAX;
+        for (int q = 1; q < n; q++)
+        {
+            float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / float(2 * q - 2 * v[k]);
+            while (s <= z[k])
+            {
+                k--;
+                s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / float(2 * q - 2 * v[k]);
+            }
+            k++;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = FLT_MAX;
+        }
+
+        k = 0;
+        for (int q = 0; q < n; q++)
+        {
+            while (z[k + 1] < q)
+                k++;
+            float dq = float(q - v[k]);
+            d[q] = dq * dq + f[v[k]];
+        }
+    }
+
+    BrickMap::BrickMap()
+    {
+        const int gridCells = BRICK_GRID_XZ * BRICK_GRID_Y * BRICK_GRID_XZ;
+        const int slots = BRICK_ATLAS_SLOTS * BRICK_ATLAS_SLOTS * BRICK_ATLAS_SLOTS;
+
+        m_grid.assign(gridCells, BRICK_UNKNOWN);
+        m_gridSlots.assign(gridCells, -1);
+        m_dirtyFlags.assign(gridCells, 0);
+        m_gridColumns.assign(BRICK_GRID_XZ * BRICK_GRID_XZ, INT64_MIN);
+
+        m_atlas.assign(slots * BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES, 0.0f);
+        for (int slot = slots - 1; slot >= 0; slot--)
+        {
+            m_freeSlots.push_back(slot);
+        }
+
+        m_distances.resize(BRICK_REGION * BRICK_REGION * BRICK_REGION);
+        m_line.resize(BRICK_REGION);
+        m_lineOut.resize(BRICK_REGION);
+        m_parabolas.resize(BRICK_REGION);
+        m_boundaries.resize(BRICK_REGION + 1);
+    }
+
+    int BrickMap::GridIndex(int brickX, int brickY, int brickZ) const
+    {
+        // Toroidal, so moving the window keeps the bricks that stay inside it
+        int x = PositiveMod(brickX, BRICK_GRID_XZ);
+        int z = PositiveMod(brickZ, BRICK_GRID_XZ);
+        return (z * BRICK_GRID_Y + brickY) * BRICK_GRID_XZ + x;
+    }
+
+    bool BrickMap::InWindow(int brickX, int brickY, int brickZ) const
+    {
+        return brickX >= m_originX && brickX < m_originX + BRICK_GRID_XZ && brickZ >= m_originZ &&
+               brickZ < m_originZ + BRICK_GRID_XZ && brickY >= 0 && brickY < BRICK_GRID_Y;
+    }
+
+    void BrickMap::MarkChunkDirty(int chunkX, int chunkZ)
+    {
+        MarkDirty(chunkX * CHUNK_SIZE, 0, chunkZ * CHUNK_SIZE, (chunkX + 1) * CHUNK_SIZE - 1, MAX_HEIGHT - 1,
+                  (chunkZ + 1) * CHUNK_SIZE - 1);
+    }
+
+    void BrickMap::MarkDirty(int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+    {
+        // Bricks see cells within their apron, and sample one cell past their end
+        int brickMinX = FloorDiv(minX - BRICK_APRON - 1, BRICK_SIZE);
+        int brickMinY = std::max(0, FloorDiv(minY - BRICK_APRON - 1, BRICK_SIZE));
+        int brickMinZ = FloorDiv(minZ - BRICK_APRON - 1, BRICK_SIZE);
+        int brickMaxX = FloorDiv(maxX + BRICK_APRON, BRICK_SIZE);
+        int brickMaxY = std::min(BRICK_GRID_Y - 1, FloorDiv(maxY + BRICK_APRON, BRICK_SIZE));
+        int brickMaxZ = FloorDiv(maxZ + BRICK_APRON, BRICK_SIZE);
+
+        for (int z = brickMinZ; z <= brickMaxZ; z++)
+        {
+            for (int y = brickMinY; y <= brickMaxY; y++)
+            {
+                for (int x = brickMinX; x <= brickMaxX; x++)
+                {
+                    MarkBrickDirty(x, y, z);
+                }
+            }
+        }
+    }
+
+    void BrickMap::MarkBrickDirty(int brickX, int brickY, int brickZ)
+    {
+        if (!InWindow(brickX, brickY, brickZ))
+            return;
+
+        // Stale distances are unsafe, evaluate exactly until rebuilt
+        int index = GridIndex(brickX, brickY, brickZ);
+        if (m_grid[index] != BRICK_UNKNOWN)
+        {
+            m_grid[index] = BRICK_UNKNOWN;
+            m_gridChanged = true;
+        }
+
+        if (!m_dirtyFlags[index])
+        {
+            m_dirtyFlags[index] = 1;
+            m_dirtyBricks.push_back({brickX, brickY, brickZ});
+        }
+    }
+
+    void BrickMap::ReleaseSlot(int gridIndex)
+    {
+        if (m_gridSlots[gridIndex] >= 0)
+        {
+            m_freeSlots.push_back(m_gridSlots[gridIndex]);
+            m_gridSlots[gridIndex] = -1;
+        }
+    }
+
+    int BrickMap::Update(Terrain* terrain, Vec3 center, float budgetMs)
+    {
+        PROFILE_SCOPE("BrickMap::Update");
+
+        int64_t start = bx::getHPCounter();
+        const int64_t budget = int64_t(budgetMs * 0.001 * double(bx::getHPFrequency()));
+
+        // Recenter, grid columns now holding a different brick column are reset
+        m_originX = FloorDiv((int)floorf(center.x), BRICK_SIZE) - BRICK_GRID_XZ / 2;
+        m_originZ = FloorDiv((int)floorf(center.z), BRICK_SIZE) - BRICK_GRID_XZ / 2;
+        for (int z = m_originZ; z < m_originZ + BRICK_GRID_XZ; z++)
+        {
+            for (int x = m_originX; x < m_originX + BRICK_GRID_XZ; x++)
+            {
+                int column = PositiveMod(z, BRICK_GRID_XZ) * BRICK_GRID_XZ + PositiveMod(x, BRICK_GRID_XZ);
+                if (m_gridColumns[column] == ColumnKey(x, z))
+                    continue;
+
+                m_gridColumns[column] = ColumnKey(x, z);
+                for (int y = 0; y < BRICK_GRID_Y; y++)
+                {
+                    int index = GridIndex(x, y, z);
+                    ReleaseSlot(index);
+                    // Bricks queued for the old column are skipped when they come up
+                    m_dirtyFlags[index] = 0;
+                    MarkBrickDirty(x, y, z);
+                }
+            }
+        }
+
+        // Rebuild nearest bricks first
+        int centerX = m_originX + BRICK_GRID_XZ / 2;
+        int centerY = (int)floorf(center.y) / BRICK_SIZE;
+        int centerZ = m_originZ + BRICK_GRID_XZ / 2;
+        auto distanceSquared = [=](const BrickCoord& b) {
+            return (b.x - centerX) * (b.x - centerX) + (b.y - centerY) * (b.y - centerY) +
+                   (b.z - centerZ) * (b.z - centerZ);
+        };
+        std::sort(m_dirtyBricks.begin(), m_dirtyBricks.end(),
+                  [&](const BrickCoord& a, const BrickCoord& b) { return distanceSquared(a) > distanceSquared(b); });
+
+        int rebuilt = 0;
+        while (!m_dirtyBricks.empty() && bx::getHPCounter() - start < budget)
+        {
+            BrickCoord brick = m_dirtyBricks.back();
+            m_dirtyBricks.pop_back();
+
+            if (!InWindow(brick.x, brick.y, brick.z))
+                continue;
+
+            int index = GridIndex(brick.x, brick.y, brick.z);
+            if (!m_dirtyFlags[index])
+                continue;
+
+            m_dirtyFlags[index] = 0;
+            RebuildBrick(terrain, brick);
+            rebuilt++;
+        }
+        return rebuilt;
+    }
+
+    void BrickMap::RebuildBrick(Terrain* terrain, BrickCoord brick)
+    {
+        int index = GridIndex(brick.x, brick.y, brick.z);
+        int baseX = brick.x * BRICK_SIZE - BRICK_APRON;
+        int baseY = brick.y * BRICK_SIZE - BRICK_APRON;
+        int baseZ = brick.z * BRICK_SIZE - BRICK_APRON;
+
+        // Cells that are ground at any LOD level, 0 distance for solid and far for air
+        bool anySolid = false;
+        for (int z = 0; z < BRICK_REGION; z++)
+        {
+            for (int x = 0; x < BRICK_REGION; x++)
+            {
+                int cellX = baseX + x;
+                int cellZ = baseZ + z;
+                int chunkX = ChunkCoord(cellX);
+                int chunkZ = ChunkCoord(cellZ);
+                Chunk* chunk = terrain->GetChunk(chunkX, chunkZ);
+                if (!chunk)
+                {
+                    // Can't bound distances next to missing chunks
+                    ReleaseSlot(index);
+                    m_grid[index] = BRICK_UNKNOWN;
+                    m_gridChanged = true;
+                    return;
+                }
+
+                int localX = cellX - chunkX * CHUNK_SIZE;
+                int localZ = cellZ - chunkZ * CHUNK_SIZE;
+                for (int y = 0; y < BRICK_REGION; y++)
+                {
+                    int cellY = baseY + y;
+                    bool solid = false;
+                    for (int level = 0; level < LOD_LEVELS && !solid && cellY >= 0 && cellY < MAX_HEIGHT; level++)
+                    {
+                        int width = LodWidth(level);
+                        int lodIndex = ((cellY >> level) * width + (localZ >> level)) * width + (localX >> level);
+                        solid = chunk->Lod(level)[lodIndex] != BlobType::AIR;
+                    }
+
+                    m_distances[(z * BRICK_REGION + y) * BRICK_REGION + x] = solid ? 0.0f : BRICK_FAR;
+                    anySolid |= solid;
+                }
+            }
+        }
+
+        if (!anySolid)
+        {
+            ReleaseSlot(index);
+            m_grid[index] = BRICK_EMPTY;
+            m_gridChanged = true;
+            return;
+        }
+
+        if (m_gridSlots[index] < 0)
+        {
+            if (m_freeSlots.empty())
+            {
+                // Atlas full, fall back to exact evaluation
+                m_grid[index] = BRICK_UNKNOWN;
+                m_gridChanged = true;
+                return;
+            }
+            m_gridSlots[index] = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+
+        // Separable distance transform along x, y and z
+        const int strides[3] = {1, BRICK_REGION, BRICK_REGION * BRICK_REGION};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int stride = strides[axis];
+            int outerStride = strides[(axis + 1) % 3];
+            int innerStride = strides[(axis + 2) % 3];
+            for (int a = 0; a < BRICK_REGION; a++)
+            {
+                for (int b = 0; b < BRICK_REGION; b++)
+                {
+                    float* line = &m_distances[a * outerStride + b * innerStride];
+                    for (int i = 0; i < BRICK_REGION; i++)
+                        m_line[i] = line[i * stride];
+
+                    DistanceTransform1D(m_line.data(), m_lineOut.data(), BRICK_REGION, m_parabolas.data(),
+                                        m_boundaries.data());
+
+                    for (int i = 0; i < BRICK_REGION; i++)
+                        line[i * stride] = m_lineOut[i];
+                }
+            }
+        }
+
+        // Solids beyond the apron are at least BRICK_APRON away from every sample
+        int slot = m_gridSlots[index];
+        float* samples = &m_atlas[slot * BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES];
+        for (int z = 0; z < BRICK_SAMPLES; z++)
+        {
+            for (int y = 0; y < BRICK_SAMPLES; y++)
+            {
+                for (int x = 0; x < BRICK_SAMPLES; x++)
+                {
+                    float squared = m_distances[((z + BRICK_APRON) * BRICK_REGION + (y + BRICK_APRON)) * BRICK_REGION +
+                                                (x + BRICK_APRON)];
+                    float distance = std::min(sqrtf(squared), float(BRICK_APRON));
+                    samples[(z * BRICK_SAMPLES + y) * BRICK_SAMPLES + x] = distance - CELL_HALF_DIAGONAL;
+                }
+            }
+        }
+
+        m_grid[index] = float(slot + 1);
+        m_gridChanged = true;
+        m_changedSlots.push_back(slot);
+    }
+
+    void BrickMap::ClearChanges()
+    {
+        m_gridChanged = false;
+        m_changedSlots.clear();
+    }
+
+    float BrickMap::SampleBrick(int slot, Vec3 local) const
+    {
+        // Trilinear, like the linear sampler on the GPU
+        const float* samples = &m_atlas[slot * BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES];
+        float fx = clamp(local.x, 0.0f, float(BRICK_SIZE));
+        float fy = clamp(local.y, 0.0f, float(BRICK_SIZE));
+        float fz = clamp(local.z, 0.0f, float(BRICK_SIZE));
+        int x0 = std::min((int)fx, BRICK_SIZE - 1);
+        int y0 = std::min((int)fy, BRICK_SIZE - 1);
+        int z0 = std::min((int)fz, BRICK_SIZE - 1);
+        float tx = fx - x0;
+        float ty = fy - y0;
+        float tz = fz - z0;
+
+        auto at = [samples](int x, int y, int z) { return samples[(z * BRICK_SAMPLES + y) * BRICK_SAMPLES + x]; };
+        auto lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+
+        float c00 = lerp(at(x0, y0, z0), at(x0 + 1, y0, z0), tx);
+        float c10 = lerp(at(x0, y0 + 1, z0), at(x0 + 1, y0 + 1, z0), tx);
+        float c01 = lerp(at(x0, y0, z0 + 1), at(x0 + 1, y0, z0 + 1), tx);
+        float c11 = lerp(at(x0, y0 + 1, z0 + 1), at(x0 + 1, y0 + 1, z0 + 1), tx);
+        return lerp(lerp(c00, c10, ty), lerp(c01, c11, ty), tz);
+    }
+
+    float BrickMap::BrickStep(Vec3 p, Vec3 direction) const
+    {
+        int brickX = (int)floorf(p.x / BRICK_SIZE);
+        int brickY = (int)floorf(p.y / BRICK_SIZE);
+        int brickZ = (int)floorf(p.z / BRICK_SIZE);
+        if (!InWindow(brickX, brickY, brickZ))
+            return 0.0f;
+
+        float cell = m_grid[GridIndex(brickX, brickY, brickZ)];
+        if (cell == BRICK_UNKNOWN)
+            return 0.0f;
+
+        Vec3 local = {p.x - brickX * BRICK_SIZE, p.y - brickY * BRICK_SIZE, p.z - brickZ * BRICK_SIZE};
+        if (cell == BRICK_EMPTY)
+        {
+            // Nothing near this brick, step to where the ray leaves it
+            auto exit = [](float local, float direction) {
+                if (direction > 1e-6f)
+                    return (BRICK_SIZE - local) / direction;
+                if (direction < -1e-6f)
+                    return -local / direction;
+                return FLT_MAX;
+            };
+            return std::min(exit(local.x, direction.x), std::min(exit(local.y, direction.y), exit(local.z, direction.z))) +
+                   0.01f;
+        }
+
+        float bound = SampleBrick(int(cell) - 1, local) - BRICK_BOUND_MARGIN;
+        return bound < BRICK_MIN_STEP ? 0.0f : bound;
+    }
+
+    float BrickMap::RayMarch(Vec3 origin, Vec3 direction, float (*exactDistance)(Vec3 p, void* user), void* user,
+                             int* steps) const
+    {
+        // Must match ray_march in the sdf shader
+        const int maxSteps = 100;
+        const float maxDist = FAR_PLANE;
+        const float surfDist = 0.01f;
+
+        float d = 0.0f;
+        int i = 0;
+        for (; i < maxSteps; i++)
+        {
+            Vec3 p = {origin.x + direction.x * d, origin.y + direction.y * d, origin.z + direction.z * d};
+            float sd = BrickStep(p, direction);
+            if (sd <= 0.0f)
+            {
+                sd = exactDistance(p, user);
+                if (sd < surfDist)
+                {
+                    d += sd;
+                    break;
+                }
+            }
+            d += sd;
+            if (d > maxDist)
+                break;
+        }
+
+        if (steps)
+            *steps = i + 1;
+        return d;
+    }
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "constants.h"
+#include "math.h"
+
+// Cells per side of a brick
+#define BRICK_SIZE 8
+// Distance samples per side of a brick, one more than cells so bricks can be interpolated seamlessly
+#define BRICK_SAMPLES (BRICK_SIZE + 1)
+// Cells around a brick considered when computing its distances
+#define BRICK_APRON 4
+// Bricks per side of the coarse grid window around the camera
+#define BRICK_GRID_XZ 32
+#define BRICK_GRID_Y (MAX_HEIGHT / BRICK_SIZE)
+// Atlas slots per side of the distance atlas
+#define BRICK_ATLAS_SLOTS 16
+#define BRICK_ATLAS_SIZE (BRICK_ATLAS_SLOTS * BRICK_SAMPLES)
+
+// Coarse grid cell states, values above 0 are an atlas slot + 1
+#define BRICK_UNKNOWN -1.0f
+#define BRICK_EMPTY 0.0f
+
+// Distance from a cell center to its corners, blobs of any LOD are inside their cells
+#define CELL_HALF_DIAGONAL 0.87f
+// Subtracted from interpolated brick distances: interpolation error,
+// smoothing between blobs and the test wave in the sdf shader
+#define BRICK_BOUND_MARGIN (CELL_HALF_DIAGONAL + SMOOTHNESS + WAVE_AMPLITUDE)
+// Bounds below this are not worth stepping by, the exact distance is used instead
+#define BRICK_MIN_STEP 0.5f
+
+namespace blobby
+{
+    class Terrain;
+
+    // Sparse two-level acceleration structure for ray marching, built from chunk data.
+    //
+    // The coarse level is a grid of bricks around the camera, addressed toroidally
+    // so moving the window only touches the bricks that enter it. Each brick is
+    // unknown (chunk not loaded, evaluate exactly), empty (nothing within
+    // BRICK_APRON, rays can skip the whole brick) or points to an atlas slot.
+    //
+    // The fine level holds conservative distance samples per brick in a 3D atlas.
+    // They are distances to the blobs of every LOD level, so the bound holds
+    // whichever LOD is rendered. Rays step by the interpolated distance minus
+    // BRICK_BOUND_MARGIN and only evaluate blobs near the surface.
+    class BrickMap
+    {
+      public:
+        BrickMap();
+
+        // Rebuild the bricks of a chunk, and the bricks around it that see it through their apron
+        void MarkChunkDirty(int chunkX, int chunkZ);
+        // Rebuild bricks that see any cell in the given bounds
+        void MarkDirty(int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+
+        // Recenter the window and rebuild dirty bricks for up to budgetMs, returns the number rebuilt
+        int Update(Terrain* terrain, Vec3 center, float budgetMs);
+
+        // Safe distance to step along direction from p, 0 if the exact distance is needed.
+        // CPU reference of brick_step in the sdf shader.
+        float BrickStep(Vec3 p, Vec3 direction) const;
+
+        // CPU reference of ray_march in the sdf shader, the brick-map test checks it finds the hits of
+        // plain sphere tracing. exactDistance is called where the brick map can't bound the distance.
+        float RayMarch(Vec3 origin, Vec3 direction, float (*exactDistance)(Vec3 p, void* user), void* user,
+                       int* steps) const;
+
+        // GPU upload helpers
+        const float* GetGridData() const
+        {
+            return m_grid.data();
+        }
+
+        const float* GetBrickData(int slot) const
+        {
+            return &m_atlas[slot * BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES];
+        }
+
+        bool IsGridChanged() const
+        {
+            return m_gridChanged;
+        }
+
+        const std::vector<int>& GetChangedSlots() const
+        {
+            return m_changedSlots;
+        }
+
+        void ClearChanges();
+
+        int GetOriginX() const
+        {
+            return m_originX;
+        }
+
+        int GetOriginZ() const
+        {
+            return m_originZ;
+        }
+
+        int GetUsedSlots() const
+        {
+            return BRICK_ATLAS_SLOTS * BRICK_ATLAS_SLOTS * BRICK_ATLAS_SLOTS - (int)m_freeSlots.size();
+        }
+
+        int GetDirtyBricks() const
+        {
+            return (int)m_dirtyBricks.size();
+        }
+
+      private:
+        struct BrickCoord
+        {
+            int x;
+            int y;
+            int z;
+        };
+
+        int GridIndex(int brickX, int brickY, int brickZ) const;
+        bool InWindow(int brickX, int brickY, int brickZ) const;
+        void MarkBrickDirty(int brickX, int brickY, int brickZ);
+        void RebuildBrick(Terrain* terrain, BrickCoord brick);
+        void ReleaseSlot(int gridIndex);
+        float SampleBrick(int slot, Vec3 local) const;
+
+        int m_originX = 0;
+        int m_originZ = 0;
+
+        // Coarse grid, the atlas slot of each grid cell,
+        // and which brick column each grid column currently holds
+        std::vector<float> m_grid;
+        std::vector<int> m_gridSlots;
+        std::vector<int64_t> m_gridColumns;
+        bool m_gridChanged = true;
+
+        std::vector<float> m_atlas;
+        std::vector<int> m_freeSlots;
+        std::vector<int> m_changedSlots;
+
+        std::vector<BrickCoord> m_dirtyBricks;
+        std::vector<uint8_t> m_dirtyFlags;
+
+        // Scratch for distance transforms
+        std::vector<float> m_distances;
+        std::vector<float> m_line;
+        std::vector<float> m_lineOut;
+        std::vector<int> m_parabolas;
+        std::vector<float> m_boundaries;
+    };
+}
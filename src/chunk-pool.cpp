@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "chunk-pool.h"
+
+namespace blobby
+{
+    // Maps size bytes, a power of two. Aligned to size on Linux, to pages on Windows.
+    static void* MapSlab(size_t size, bool hugePages)
+    {
+#if defined(_WIN32)
+        // Large pages need a privilege most users don't have, VirtualAlloc is page aligned
+        (void)hugePages;
+        return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        // Map twice the size and unmap what lies outside the aligned part
+        uint8_t* mapped = (uint8_t*)mmap(nullptr, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+            return nullptr;
+
+        uint8_t* slab = (uint8_t*)(((uintptr_t)mapped + size - 1) & ~(uintptr_t)(size - 1));
+        if (slab > mapped)
+            munmap(mapped, slab - mapped);
+        munmap(slab + size, mapped + size - slab);
+
+#ifdef MADV_HUGEPAGE
+        // Only a hint, ignored when transparent huge pages are disabled
+        if (hugePages)
+            madvise(slab, size, MADV_HUGEPAGE);
+#else
+        (void)hugePages;
+#endif
+        return slab;
+#endif
+    }
+
+    static void UnmapSlab(void* slab, size_t size)
+    {
+#if defined(_WIN32)
+        (void)size;
+        VirtualFree(slab, 0, MEM_RELEASE);
+#else
+        munmap(slab, size);
+#endif
+    }
+
+    ChunkPool::ChunkPool(size_t slotSize, bool hugePages)
+    {
+        m_slotSize = (slotSize + CHUNK_POOL_SLOT_ALIGNMENT - 1) & ~(size_t)(CHUNK_POOL_SLOT_ALIGNMENT - 1);
+        m_slotsPerSlab = int(CHUNK_POOL_SLAB_SIZE / m_slotSize);
+        m_hugePages = hugePages;
+        assert(m_slotsPerSlab > 0);
+    }
+
+    ChunkPool::~ChunkPool()
+    {
+        assert(m_used == 0);
+        for (void* slab : m_slabs)
+            UnmapSlab(slab, CHUNK_POOL_SLAB_SIZE);
+    }
+
+    void ChunkPool::Reserve(int count)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while ((int)m_slabs.size() * m_slotsPerSlab < count)
+            AddSlab();
+    }
+
+    void* ChunkPool::Allocate()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_free)
+            AddSlab();
+
+        void* slot = m_free;
+        m_free = *(void**)slot;
+        m_used++;
+        m_highWater = std::max(m_highWater, m_used);
+        return slot;
+    }
+
+    void ChunkPool::Free(void* slot)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        *(void**)slot = m_free;
+        m_free = slot;
+        m_used--;
+    }
+
+    ChunkPoolStats ChunkPool::GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ChunkPoolStats stats;
+        stats.slabs = (int)m_slabs.size();
+        stats.capacity = stats.slabs * m_slotsPerSlab;
+        stats.used = m_used;
+        stats.highWater = m_highWater;
+        stats.bytes = m_slabs.size() * CHUNK_POOL_SLAB_SIZE;
+        return stats;
+    }
+
+    void ChunkPool::AddSlab()
+    {
+        uint8_t* slab = (uint8_t*)MapSlab(CHUNK_POOL_SLAB_SIZE, m_hugePages);
+        if (!slab)
+        {
+            printf("Could not map a %d byte chunk slab\n", CHUNK_POOL_SLAB_SIZE);
+            throw std::bad_alloc();
+        }
+        m_slabs.push_back(slab);
+
+        // Fault every page in now rather than while streaming
+        for (size_t offset = 0; offset < CHUNK_POOL_SLAB_SIZE; offset += 4096)
+            slab[offset] = 0;
+
+        // Push in reverse, so slots are handed out in address order
+        for (int i = m_slotsPerSlab - 1; i >= 0; i--)
+        {
+            void* slot = slab + i * m_slotSize;
+            *(void**)slot = m_free;
+            m_free = slot;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Size and alignment of the slabs slots are carved from, one 2 MB huge page
+#define CHUNK_POOL_SLAB_SIZE (2 * 1024 * 1024)
+// Slots are rounded up to whole cache lines
+#define CHUNK_POOL_SLOT_ALIGNMENT 64
+
+namespace blobby
+{
+    struct ChunkPoolStats
+    {
+        int slabs = 0;
+        // Slots in all slabs, handed out now and the most ever handed out at once
+        int capacity = 0;
+        int used = 0;
+        int highWater = 0;
+        size_t bytes = 0;
+    };
+
+    // Fixed size slots for chunks, carved from slabs that are mapped straight from the OS.
+    //
+    // On Linux slabs are aligned to their size, so with hugePages each can be backed by a single
+    // transparent huge page. Their pages are touched when a slab is added and slabs are only
+    // returned to the OS with the pool, so once the pool has grown to the streaming high-water
+    // mark, chunks coming and going cause no page faults and no fragmentation. Freed slots are
+    // kept in a list threaded through the slots themselves and reused most recent first.
+    class ChunkPool
+    {
+      public:
+        ChunkPool(size_t slotSize, bool hugePages);
+        ~ChunkPool();
+
+        ChunkPool(const ChunkPool&) = delete;
+        ChunkPool& operator=(const ChunkPool&) = delete;
+
+        // Adds slabs until there are at least count slots
+        void Reserve(int count);
+
+        // Uninitialized memory for one chunk, adds a slab if every slot is taken.
+        // Safe to call from any thread, like Free.
+        void* Allocate();
+        void Free(void* slot);
+
+        ChunkPoolStats GetStats() const;
+
+      private:
+        // Caller holds m_mutex
+        void AddSlab();
+
+        size_t m_slotSize;
+        int m_slotsPerSlab;
+        bool m_hugePages;
+
+        mutable std::mutex m_mutex;
+        std::vector<void*> m_slabs;
+        // Each free slot starts with a pointer to the next
+        void* m_free = nullptr;
+        int m_used = 0;
+        int m_highWater = 0;
+    };
+}
@@ -1,6 +1,12 @@
 #pragma once
 
 // If changing these, change the values in sdf shader
-#define MAX_SDF 512
 #define FAR_PLANE 100.0f
 #define NEAR_PLANE 0.1f
+// Vertical field of view in degrees
+#define FIELD_OF_VIEW 75.0f
+#define SMOOTHNESS 1.0f
+// Max offset of blobs by the test wave in the sdf shader
+#define WAVE_AMPLITUDE 1.3f
+// Width of the blob data texture
+#define BLOB_TEXTURE_WIDTH 1024
@@ -6,6 +6,7 @@
 
 namespace blobby
 {
+    class JobSystem;
     class Renderer;
     class Terrain;
 
@@ -24,16 +25,55 @@ namespace blobby
         SDL_Window* window = nullptr;
         Renderer* renderer = nullptr;
         Terrain* terrain = nullptr;
+        JobSystem* jobs = nullptr;
 
         float camPitch = 0.0f;
         float camYaw = 0.0f;
         float sensitivity = 1.4f;
-        Vec3 camPosition = {0.0f, 0.0f, -8.0f};
+        // Above the highest terrain, see TERRAIN_BASE_HEIGHT
+        Vec3 camPosition = {0.0f, 90.0f, 0.0f};
         float camSpeed = 5.0f;
         int keyFlags;
+        // SDL_BUTTON masks of held mouse buttons
+        int mouseButtons = 0;
+
+        // Held left mouse adds ground, right removes it, in a sphere in front of the camera
+        float sculptRadius = 2.0f;
+        float sculptDistance = 8.0f;
 
         float camTransform[16];
 
+        // Chunks within this radius of the camera are kept loaded
+        int loadRadius = 6;
+        // Memory for chunks, beyond it chunks are evicted even inside the load radius.
+        // The largest load radius needs about 45 MB.
+        int chunkBudgetMb = 64;
+        // Main thread time per frame for integrating streamed chunks
+        float streamingBudgetMs = 1.0f;
+        // Test blobs of chunks crossing the frustum edges individually
+        bool frustumCullBlobs = true;
+        // Skip chunks and sections hidden behind terrain, see OcclusionBuffer
+        bool occlusionCulling = true;
+        // Skip empty space with the brick map when ray marching
+        bool useBrickMap = true;
+        // Find the blobs near a point with a BVH instead of the screen tile's list, see BlobBvh
+        bool useBlobBvh = true;
+        // Main thread time per frame for rebuilding brick map distances
+        float brickBudgetMs = 1.0f;
+        // Scale the SDF pass resolution to keep GPU frame time at the target, see ResolutionScaler.
+        // The target leaves some of a 60 Hz vsync interval spare.
+        bool dynamicResolution = true;
+        float targetFrameMs = 14.0f;
+        // Fraction of the window size the SDF pass is drawn at, set by hand without dynamic resolution
+        float renderScale = 1.0f;
+        // Start ray marching in front of the surface the last frame hit, see temporal_start in sdf.sh
+        bool temporalReprojection = true;
+        // Color pixels by the number of ray march steps instead
+        bool stepHeatmap = false;
+
+        // No window or input, see EngineOptions
+        bool headless = false;
+
         int width = 0;
         int height = 0;
 
@@ -42,5 +82,8 @@ namespace blobby
         float time = 0.0f;
         float timeScale = 1.0f;
         float deltaTime = 0.0f;
+
+        // Heap allocations on the main thread during the last frame, see alloc-counter.h
+        uint64_t frameAllocations = 0;
     };
 }
\ No newline at end of file
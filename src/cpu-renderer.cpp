@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <bx/math.h>
+#include <cmath>
+
+#include "constants.h"
+#include "cpu-renderer.h"
+#include "job-system.h"
+#include "profiler.h"
+#include "simd.h"
+
+namespace blobby
+{
+    void CpuRenderer::Render(std::span<const Blob> blobs, const float camTransform[16], const float proj[16],
+                             float time, int width, int height, JobSystem* jobs, uint8_t* pixels)
+    {
+        PROFILE_SCOPE("CpuRenderer::Render");
+
+        // The test wave only depends on time, move the blobs once instead of every evaluation
+        m_bvh.Build(blobs.data(), (int)blobs.size());
+        const std::vector<Blob>& sorted = m_bvh.GetBlobs();
+        m_blobs.resize(sorted.size());
+        for (size_t i = 0; i < sorted.size(); i++)
+        {
+            Vec3 p = sorted[i].Position;
+            m_blobs[i] = {p.x, p.y + BlobWave(p, time), p.z, sorted[i].Radius};
+        }
+
+        float view[16];
+        float viewProj[16];
+        bx::mtxInverse(view, camTransform);
+        bx::mtxMul(viewProj, view, proj);
+        bx::mtxInverse(m_invViewProj, viewProj);
+
+        // The shader measures distances from the camera space point (1, 1, 1)
+        bx::Vec3 eye = bx::mul({1.0f, 1.0f, 1.0f}, camTransform);
+        m_eye = {eye.x, eye.y, eye.z};
+        m_time = time;
+        m_width = width;
+        m_height = height;
+        m_pixels = pixels;
+
+        int tilesX = (width + CPU_RENDER_TILE_SIZE - 1) / CPU_RENDER_TILE_SIZE;
+        int tilesY = (height + CPU_RENDER_TILE_SIZE - 1) / CPU_RENDER_TILE_SIZE;
+        JobHandle render = jobs->CreateGroup();
+        for (int tileY = 0; tileY < tilesY; tileY++)
+        {
+            for (int tileX = 0; tileX < tilesX; tileX++)
+            {
+                jobs->Run(jobs->Create([this, tileX, tileY]() { RenderTile(tileX, tileY); }, render));
+            }
+        }
+        jobs->Run(render);
+        jobs->Wait(render);
+    }
+
+    void CpuRenderer::RenderTile(int tileX, int tileY)
+    {
+        int minX = tileX * CPU_RENDER_TILE_SIZE;
+        int minY = tileY * CPU_RENDER_TILE_SIZE;
+        int maxX = std::min(minX + CPU_RENDER_TILE_SIZE, m_width);
+        int maxY = std::min(minY + CPU_RENDER_TILE_SIZE, m_height);
+
+        for (int y = minY; y < maxY; y += 2)
+        {
+            for (int x = minX; x < maxX; x += 2)
+            {
+                // 2x2 pixels, lanes past the edge of the image are masked off
+                float dirX[4], dirY[4], dirZ[4];
+                int valid = 0;
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    int px = x + (lane & 1);
+                    int py = y + (lane >> 1);
+                    if (px >= maxX || py >= maxY)
+                    {
+                        dirX[lane] = dirY[lane] = dirZ[lane] = 0.0f;
+                        continue;
+                    }
+                    valid |= 1 << lane;
+
+                    // pixel_direction, gl_FragCoord counts rows from the bottom
+                    float ndcX = 2.0f * ((px + 0.5f) / m_width - 0.5f);
+                    float ndcY = 2.0f * ((m_height - py - 0.5f) / m_height - 0.5f);
+                    bx::Vec3 near = bx::mulH({ndcX, ndcY, 0.0f}, m_invViewProj);
+                    bx::Vec3 far = bx::mulH({ndcX, ndcY, 1.0f}, m_invViewProj);
+                    Vec3 dir = {far.x - near.x, far.y - near.y, far.z - near.z};
+                    float invLength = 1.0f / length(dir);
+                    dirX[lane] = dir.x * invLength;
+                    dirY[lane] = dir.y * invLength;
+                    dirZ[lane] = dir.z * invLength;
+                }
+
+                // ray_march
+                float d[4] = {};
+                float pX[4], pY[4], pZ[4], field[4];
+                auto advance = [&]() {
+                    for (int lane = 0; lane < 4; lane++)
+                    {
+                        pX[lane] = m_eye.x + dirX[lane] * d[lane];
+                        pY[lane] = m_eye.y + dirY[lane] * d[lane];
+                        pZ[lane] = m_eye.z + dirZ[lane] * d[lane];
+                    }
+                };
+                int active = valid;
+                for (int step = 0; step < CPU_RENDER_MAX_STEPS && active != 0; step++)
+                {
+                    advance();
+                    Distance4(pX, pY, pZ, active, field);
+                    for (int lane = 0; lane < 4; lane++)
+                    {
+                        if ((active & (1 << lane)) == 0)
+                            continue;
+
+                        d[lane] += field[lane];
+                        if (d[lane] > FAR_PLANE || field[lane] < CPU_RENDER_SURFACE_DISTANCE)
+                            active &= ~(1 << lane);
+                    }
+                }
+
+                // get_normal at the hits, misses stay black
+                int hits = 0;
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if ((valid & (1 << lane)) != 0 && d[lane] <= FAR_PLANE)
+                        hits |= 1 << lane;
+                }
+                float normal[3][4] = {};
+                if (hits != 0)
+                {
+                    advance();
+                    float center[4];
+                    Distance4(pX, pY, pZ, hits, center);
+                    float* coords[3] = {pX, pY, pZ};
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        for (int lane = 0; lane < 4; lane++)
+                            coords[axis][lane] -= 0.01f;
+                        Distance4(pX, pY, pZ, hits, normal[axis]);
+                        for (int lane = 0; lane < 4; lane++)
+                        {
+                            coords[axis][lane] += 0.01f;
+                            normal[axis][lane] = center[lane] - normal[axis][lane];
+                        }
+                    }
+                }
+
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if ((valid & (1 << lane)) == 0)
+                        continue;
+
+                    float color[3] = {};
+                    if ((hits & (1 << lane)) != 0)
+                    {
+                        Vec3 n = {normal[0][lane], normal[1][lane], normal[2][lane]};
+                        float invLength = 1.0f / std::max(length(n), 1e-20f);
+                        float facing = -(dirX[lane] * n.x + dirY[lane] * n.y + dirZ[lane] * n.z) * invLength;
+
+                        // pow of a negative number is undefined in GLSL, facing away is dark here
+                        float rim = sqrtf(std::max(facing, 0.0f));
+                        float t = m_time * 0.1f + d[lane] * 0.1f;
+                        const float phase[3] = {0.0f, 0.333f, 0.666f};
+                        for (int c = 0; c < 3; c++)
+                            color[c] = (0.5f + 0.5f * cosf(6.28318f * (t + phase[c]))) * rim;
+                    }
+
+                    uint8_t* pixel = m_pixels + ((y + (lane >> 1)) * m_width + x + (lane & 1)) * 4;
+                    for (int c = 0; c < 3; c++)
+                        pixel[c] = uint8_t(std::clamp(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+                    pixel[3] = 255;
+                }
+            }
+        }
+    }
+
+    void CpuRenderer::Distance4(const float* x, const float* y, const float* z, int mask, float* field) const
+    {
+        const std::vector<float>& nodes = m_bvh.GetData();
+        if (nodes.empty())
+        {
+            std::fill(field, field + 4, FAR_PLANE);
+            return;
+        }
+
+#if BLOBBY_SSE
+        // get_dist_bvh for four points at once. Nodes are visited if any lane reaches them,
+        // only the lanes that do blend in the blobs of a leaf.
+        __m128 px = _mm_loadu_ps(x);
+        __m128 py = _mm_loadu_ps(y);
+        __m128 pz = _mm_loadu_ps(z);
+        __m128 result = _mm_set1_ps(FAR_PLANE);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 k = _mm_set1_ps(SMOOTHNESS);
+        const __m128 invK = _mm_set1_ps(1.0f / SMOOTHNESS);
+
+        // Signed distance to the bounds of a node
+        auto nodeDistance = [&](int node) {
+            const float* n = &nodes[node * 8];
+            __m128 qx = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(n[0]), px), _mm_sub_ps(px, _mm_set1_ps(n[4])));
+            __m128 qy = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(n[1]), py), _mm_sub_ps(py, _mm_set1_ps(n[5])));
+            __m128 qz = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(n[2]), pz), _mm_sub_ps(pz, _mm_set1_ps(n[6])));
+            __m128 ox = _mm_max_ps(qx, zero);
+            __m128 oy = _mm_max_ps(qy, zero);
+            __m128 oz = _mm_max_ps(qz, zero);
+            __m128 outside =
+                _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz)));
+            __m128 inside = _mm_min_ps(_mm_max_ps(qx, _mm_max_ps(qy, qz)), zero);
+            return _mm_add_ps(outside, inside);
+        };
+
+        int stack[BVH_MAX_DEPTH];
+        int size = 0;
+        int node = 0;
+        bool finished = false;
+        for (int visit = 0; visit < BVH_MAX_VISITS; visit++)
+        {
+            const float* n = &nodes[node * 8];
+            __m128 closer = _mm_cmplt_ps(nodeDistance(node), result);
+            int lanes = _mm_movemask_ps(closer) & mask;
+            if (lanes != 0)
+            {
+                if (n[7] >= 0.0f)
+                {
+                    __m128 blended = result;
+                    for (int i = int(n[3]), last = int(n[3]) + int(n[7]); i < last; i++)
+                    {
+                        const Vec4& blob = m_blobs[i];
+                        __m128 dx = _mm_sub_ps(px, _mm_set1_ps(blob.x));
+                        __m128 dy = _mm_sub_ps(py, _mm_set1_ps(blob.y));
+                        __m128 dz = _mm_sub_ps(pz, _mm_set1_ps(blob.z));
+                        __m128 squared =
+                            _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                        __m128 dist = _mm_sub_ps(_mm_sqrt_ps(squared), _mm_set1_ps(blob.w));
+
+                        // smooth_union(blended, dist, SMOOTHNESS)
+                        __m128 h = _mm_add_ps(half, _mm_mul_ps(_mm_mul_ps(half, _mm_sub_ps(dist, blended)), invK));
+                        h = _mm_min_ps(_mm_max_ps(h, zero), one);
+                        blended = _mm_sub_ps(_mm_add_ps(dist, _mm_mul_ps(_mm_sub_ps(blended, dist), h)),
+                                             _mm_mul_ps(_mm_mul_ps(k, h), _mm_sub_ps(one, h)));
+                    }
+                    result = _mm_or_ps(_mm_and_ps(closer, blended), _mm_andnot_ps(closer, result));
+                }
+                else
+                {
+                    // Nearer child first, for the first lane that reaches the node
+                    int lane = CountTrailingZeros(lanes);
+                    int axis = -1 - int(n[7]);
+                    float p = axis == 0 ? x[lane] : axis == 1 ? y[lane] : z[lane];
+                    bool leftFirst = p < (n[axis] + n[4 + axis]) * 0.5f;
+                    stack[size++] = leftFirst ? int(n[3]) : node + 1;
+                    node = leftFirst ? node + 1 : int(n[3]);
+                    continue;
+                }
+            }
+
+            if (size == 0)
+            {
+                finished = true;
+                break;
+            }
+            node = stack[--size];
+        }
+
+        // Out of visits, blobs of the nodes left are no closer than their bounds
+        if (!finished)
+        {
+            result = _mm_min_ps(result, nodeDistance(node));
+            for (int i = 0; i < size; i++)
+                result = _mm_min_ps(result, nodeDistance(stack[i]));
+        }
+
+        _mm_storeu_ps(field, result);
+#else
+        // Stops after BVH_MAX_VISITS nodes too, like the SSE version and the shader
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if ((mask & (1 << lane)) != 0)
+                field[lane] = m_bvh.Distance({x[lane], y[lane], z[lane]}, m_time);
+        }
+#endif
+    }
+}
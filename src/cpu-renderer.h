@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "blob-bvh.h"
+#include "blob.h"
+
+// Pixels per side of the image tiles rendered by one job
+#define CPU_RENDER_TILE_SIZE 32
+// Must match MAX_STEPS and SURF_DIST in the sdf shader, MAX_DIST is FAR_PLANE
+#define CPU_RENDER_MAX_STEPS 100
+#define CPU_RENDER_SURFACE_DISTANCE 0.01f
+
+namespace blobby
+{
+    class JobSystem;
+
+    // Renders blobs on the CPU the way f_simple.sc does with the blob BVH, as a reference for the
+    // shader and for machines without a GPU. Rays are marched in packets of 2x2 pixels with SSE,
+    // tiles of the image in parallel jobs.
+    //
+    // The brick map and temporal reprojection only skip work and are left out. Pixels differ from
+    // the shader's by rounding and by the order blobs are blended in, see BlobBvh::Distance.
+    class CpuRenderer
+    {
+      public:
+        // Renders width x height RGBA pixels, top row first, as Renderer::Loop would
+        // with the camera transform and bx projection matrix
+        void Render(std::span<const Blob> blobs, const float camTransform[16], const float proj[16], float time,
+                    int width, int height, JobSystem* jobs, uint8_t* pixels);
+
+      private:
+        void RenderTile(int tileX, int tileY);
+        // Field at four points, lanes not set in mask are undefined
+        void Distance4(const float* x, const float* y, const float* z, int mask, float* field) const;
+
+        BlobBvh m_bvh;
+        // Blob positions moved by the test wave and radii, in leaf order
+        std::vector<Vec4> m_blobs;
+
+        float m_invViewProj[16] = {};
+        Vec3 m_eye = {};
+        float m_time = 0.0f;
+        int m_width = 0;
+        int m_height = 0;
+        uint8_t* m_pixels = nullptr;
+    };
+}
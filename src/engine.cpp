@@ -11,92 +11,133 @@
 #include <SDL_syswm.h>
 #include <SDL_video.h>
 
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <imgui.h>
+#include <sstream>
+#include <thread>
 
+#include "alloc-counter.h"
 #include "bgfx-imgui/imgui_impl_bgfx.h"
+#include "constants.h"
+#include "cpu-renderer.h"
 #include "engine.h"
 #include "file-ops.h"
+#include "job-system.h"
 #include "math.h"
+#include "png-writer.h"
+#include "profiler.h"
 #include "renderer.h"
 #include "sdl-imgui/imgui_impl_sdl2.h"
 #include "terrain.h"
 
 namespace blobby
 {
-    Engine::Engine()
+    Engine::Engine(const EngineOptions& options)
     {
         const int width = 1280;
         const int height = 720;
 
-        if (SDL_Init(SDL_INIT_VIDEO) < 0)
+        m_options = options;
+        Profiler::SetThreadName("Main");
+        if (!m_options.cameraPath.empty() && !LoadCameraPath(m_options.cameraPath))
         {
-            printf("SDL could not initialize. SDL_Error: %s\n", SDL_GetError());
+            printf("Could not load camera path %s\n", m_options.cameraPath.c_str());
             throw("Failed to create Engine");
         }
 
-        SDL_Window* window = SDL_CreateWindow("blobby", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width,
-                                              height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+        SDL_Window* window = nullptr;
+        bgfx::PlatformData pd{};
 
-        if (window == nullptr)
+        if (!m_options.headless)
         {
-            printf("Window could not be created. SDL_Error: %s\n", SDL_GetError());
-            throw("Failed to create Engine");
-        }
+            if (SDL_Init(SDL_INIT_VIDEO) < 0)
+            {
+                printf("SDL could not initialize. SDL_Error: %s\n", SDL_GetError());
+                throw("Failed to create Engine");
+            }
 
-        SDL_SetRelativeMouseMode(SDL_TRUE);
+            window = SDL_CreateWindow("blobby", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height,
+                                      SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
 
-        SDL_SysWMinfo wmi;
-        SDL_VERSION(&wmi.version);
-        if (!SDL_GetWindowWMInfo(window, &wmi))
-        {
-            printf("SDL_SysWMinfo could not be retrieved. SDL_Error: %s\n", SDL_GetError());
-            throw("Failed to create Engine");
-        }
-        bgfx::renderFrame(); // single threaded mode
+            if (window == nullptr)
+            {
+                printf("Window could not be created. SDL_Error: %s\n", SDL_GetError());
+                throw("Failed to create Engine");
+            }
+
+            SDL_SetRelativeMouseMode(SDL_TRUE);
+
+            SDL_SysWMinfo wmi;
+            SDL_VERSION(&wmi.version);
+            if (!SDL_GetWindowWMInfo(window, &wmi))
+            {
+                printf("SDL_SysWMinfo could not be retrieved. SDL_Error: %s\n", SDL_GetError());
+                throw("Failed to create Engine");
+            }
 
-        bgfx::PlatformData pd{};
 #if BX_PLATFORM_WINDOWS
-        pd.nwh = wmi.info.win.window;
+            pd.nwh = wmi.info.win.window;
 #elif BX_PLATFORM_OSX
-        pd.nwh = wmi.info.cocoa.window;
+            pd.nwh = wmi.info.cocoa.window;
 #elif BX_PLATFORM_LINUX
-        pd.ndt = wmi.info.x11.display;
-        pd.nwh = (void*)(uintptr_t)wmi.info.x11.window;
+            pd.ndt = wmi.info.x11.display;
+            pd.nwh = (void*)(uintptr_t)wmi.info.x11.window;
 #endif
+        }
+
+        // Calling renderFrame before init keeps bgfx on this thread,
+        // otherwise bgfx creates a render thread. Memory given to bgfx
+        // must then stay valid until the next bgfx::frame returns, see Renderer::Stage.
+        if (!m_options.multithreadedRender)
+            bgfx::renderFrame(); // single threaded mode
 
         bgfx::Init bgfx_init;
         // bgfx_init.type = bgfx::RendererType::Count; // auto choose renderer
-        bgfx_init.type = bgfx::RendererType::OpenGL;
+        bgfx_init.type = m_options.headless ? bgfx::RendererType::Noop : bgfx::RendererType::OpenGL;
         bgfx_init.resolution.width = width;
         bgfx_init.resolution.height = height;
-        bgfx_init.resolution.reset = BGFX_RESET_VSYNC;
+        bgfx_init.resolution.reset = m_options.headless ? BGFX_RESET_NONE : BGFX_RESET_VSYNC;
         bgfx_init.platformData = pd;
         bgfx::init(bgfx_init);
 
-        bgfx::setViewClear(0, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0x6495EDFF, 1.0f, 0);
-        bgfx::setViewRect(0, 0, 0, width, height);
+        // View rects follow the window and render scale, see Renderer::UpdateRenderScale
+        bgfx::setViewClear(SCENE_VIEW, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0x6495EDFF, 1.0f, 0);
 
-        ImGui::CreateContext();
+        if (!m_options.headless)
+        {
+            ImGui::CreateContext();
 
-        ImGui_Implbgfx_Init(255);
+            ImGui_Implbgfx_Init(255);
 
-        // TODO: use type from bgfx::RenderType?
+            // TODO: use type from bgfx::RenderType?
 #if BX_PLATFORM_WINDOWS
-        ImGui_ImplSDL2_InitForD3D(window);
+            ImGui_ImplSDL2_InitForD3D(window);
 #elif BX_PLATFORM_OSX
-        ImGui_ImplSDL2_InitForMetal(window);
+            ImGui_ImplSDL2_InitForMetal(window);
 #elif BX_PLATFORM_LINUX
-        // ImGui_ImplSDL2_InitForOpenGL(window, nullptr);
-        ImGui_ImplSDL2_InitForVulkan(window);
+            // ImGui_ImplSDL2_InitForOpenGL(window, nullptr);
+            ImGui_ImplSDL2_InitForVulkan(window);
 #endif
+        }
 
         m_context = Context();
         m_context.width = width;
         m_context.height = height;
         m_context.window = window;
-        m_context.renderer = new Renderer();
-        m_context.terrain = new Terrain(0);
+        m_context.headless = m_options.headless;
+        m_context.renderer = new Renderer(m_options.headless);
+        // Leave one core for the main thread, it helps out while waiting on jobs
+        int workerCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+        m_context.jobs = new JobSystem(workerCount);
+        // The main thread and the workers record profiler events
+        m_context.renderer->ReserveProfilerThreads(workerCount + 1);
+        m_context.terrain = new Terrain(m_options.seed, m_context.jobs, m_options.hugePages);
+        if (!m_options.cpuRenderPrefix.empty())
+            m_cpuRenderer = new CpuRenderer();
 
         if (m_context.renderer->IsValid())
         {
@@ -104,34 +145,212 @@ namespace blobby
             {
                 Loop();
             }
+
+            printf("Ran %d frames\n", m_frame);
+            m_context.renderer->GetTimings().Print();
+
+            const TerrainStats& stats = m_context.terrain->GetStats();
+            printf("Chunk generation: %.3f ms, %.0f chunks/s per core (target %d)\n", stats.chunkGenerateMs,
+                   stats.generatedChunksPerCore, GENERATE_TARGET_CHUNKS_PER_CORE);
+            printf("Occlusion culling: %.1f%% of surface blobs in the frustum\n",
+                   stats.averageOcclusionCullRate * 100.0f);
+            printf("Chunk pool: %d of %d chunks at most, %.0f MB\n", stats.pooledChunksHighWater, stats.pooledChunks,
+                   stats.chunkPoolMb);
+            printf("Chunk memory: %.1f of %d MB, %d chunks evicted\n", stats.chunkMemoryMb, m_context.chunkBudgetMb,
+                   stats.evictedChunks);
+
+            if (!m_options.tracePath.empty())
+                Profiler::ExportChromeTrace(m_options.tracePath.c_str());
         }
     }
 
     Engine::~Engine()
     {
+        delete m_cpuRenderer;
         delete m_context.terrain;
+        delete m_context.jobs;
         delete m_context.renderer;
 
-        ImGui_ImplSDL2_Shutdown();
-        ImGui_Implbgfx_Shutdown();
+        if (!m_options.headless)
+        {
+            ImGui_ImplSDL2_Shutdown();
+            ImGui_Implbgfx_Shutdown();
 
-        ImGui::DestroyContext();
+            ImGui::DestroyContext();
+        }
         bgfx::shutdown();
 
-        SDL_DestroyWindow(m_context.window);
-        SDL_Quit();
+        if (m_context.window)
+        {
+            SDL_DestroyWindow(m_context.window);
+            SDL_Quit();
+        }
+    }
+
+    bool Engine::LoadCameraPath(const std::string& path)
+    {
+        std::string contents;
+        if (!fileops::read_file(path, contents))
+            return false;
+
+        // One key per line: time x y z pitch yaw, lines starting with # are comments
+        std::istringstream lines(contents);
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(lines, line))
+        {
+            lineNumber++;
+            if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+
+            CameraKey key;
+            if (sscanf(line.c_str(), "%f %f %f %f %f %f", &key.time, &key.position.x, &key.position.y,
+                       &key.position.z, &key.pitch, &key.yaw) != 6)
+            {
+                printf("%s:%d: expected \"time x y z pitch yaw\"\n", path.c_str(), lineNumber);
+                return false;
+            }
+
+            if (!m_cameraPath.empty() && key.time < m_cameraPath.back().time)
+            {
+                printf("%s:%d: key times must be increasing\n", path.c_str(), lineNumber);
+                return false;
+            }
+
+            m_cameraPath.push_back(key);
+        }
+
+        return !m_cameraPath.empty();
+    }
+
+    void Engine::FollowCameraPath(float time)
+    {
+        // Hold the last key once the path ends
+        size_t next = 0;
+        while (next < m_cameraPath.size() && m_cameraPath[next].time <= time)
+            next++;
+
+        const CameraKey& a = m_cameraPath[next > 0 ? next - 1 : 0];
+        const CameraKey& b = m_cameraPath[next < m_cameraPath.size() ? next : m_cameraPath.size() - 1];
+        float t = b.time > a.time ? clamp((time - a.time) / (b.time - a.time), 0.0f, 1.0f) : 0.0f;
+
+        m_context.camPosition.x = a.position.x + (b.position.x - a.position.x) * t;
+        m_context.camPosition.y = a.position.y + (b.position.y - a.position.y) * t;
+        m_context.camPosition.z = a.position.z + (b.position.z - a.position.z) * t;
+        m_context.camPitch = a.pitch + (b.pitch - a.pitch) * t;
+        m_context.camYaw = a.yaw + (b.yaw - a.yaw) * t;
     }
 
     void Engine::Loop()
     {
+        Profiler::BeginFrame();
+        PROFILE_SCOPE("Engine::Loop");
+        uint64_t allocations = GetThreadAllocationCount();
+
         int64_t now = bx::getHPCounter();
         static int64_t last = now;
         const int64_t frameTime = now - last;
         last = now;
         const double freq = double(bx::getHPFrequency());
-        m_context.deltaTime = float(frameTime / freq);
+        m_context.deltaTime = m_options.headless ? HEADLESS_DELTA_TIME : float(frameTime / freq);
         m_context.time += m_context.timeScale * m_context.deltaTime;
 
+        if (!m_options.headless)
+            PollEvents();
+
+        bx::Vec3 wishMove = {0, 0, 0};
+        if ((m_context.keyFlags & Keys::FORWARD) != 0)
+            wishMove.z += m_context.deltaTime * m_context.camSpeed;
+        if ((m_context.keyFlags & Keys::BACK) != 0)
+            wishMove.z -= m_context.deltaTime * m_context.camSpeed;
+        if ((m_context.keyFlags & Keys::RIGHT) != 0)
+            wishMove.x += m_context.deltaTime * m_context.camSpeed;
+        if ((m_context.keyFlags & Keys::LEFT) != 0)
+            wishMove.x -= m_context.deltaTime * m_context.camSpeed;
+        if ((m_context.keyFlags & Keys::UP) != 0)
+            wishMove.y += m_context.deltaTime * m_context.camSpeed;
+        if ((m_context.keyFlags & Keys::DOWN) != 0)
+            wishMove.y -= m_context.deltaTime * m_context.camSpeed;
+
+        float camRotation[16];
+        float camTranslation[16];
+        bx::mtxRotateXYZ(camRotation, bx::toRad(m_context.camPitch), bx::toRad(m_context.camYaw), 0.0f);
+        wishMove = bx::mul(wishMove, camRotation);
+        m_context.camPosition.x += wishMove.x;
+        m_context.camPosition.y += wishMove.y;
+        m_context.camPosition.z += wishMove.z;
+
+        if (!m_cameraPath.empty())
+        {
+            FollowCameraPath(m_cameraPathTime);
+            m_cameraPathTime += m_context.deltaTime;
+            bx::mtxRotateXYZ(camRotation, bx::toRad(m_context.camPitch), bx::toRad(m_context.camYaw), 0.0f);
+        }
+
+        bx::mtxTranslate(camTranslation, m_context.camPosition.x, m_context.camPosition.y, m_context.camPosition.z);
+        bx::mtxMul(m_context.camTransform, camRotation, camTranslation);
+
+        // Sculpt
+        int sculptButtons = m_context.mouseButtons & (SDL_BUTTON_LMASK | SDL_BUTTON_RMASK);
+        if (sculptButtons != 0)
+        {
+            bx::Vec3 forward = {0.0f, 0.0f, 1.0f};
+            forward = bx::mul(forward, camRotation);
+            TerrainEdit edit;
+            edit.center = {m_context.camPosition.x + forward.x * m_context.sculptDistance,
+                           m_context.camPosition.y + forward.y * m_context.sculptDistance,
+                           m_context.camPosition.z + forward.z * m_context.sculptDistance};
+            edit.radius = m_context.sculptRadius;
+            edit.type = (sculptButtons & SDL_BUTTON_LMASK) != 0 ? BlobType::GROUND : BlobType::AIR;
+            m_context.terrain->ApplyEdit(edit);
+        }
+
+        float camTransform[16];
+        memcpy(camTransform, m_context.camTransform, sizeof(camTransform));
+        m_context.renderer->Loop(&m_context);
+
+        // Once the camera and terrain have settled, frames must not allocate through operator new,
+        // see alloc-counter.h. One settled frame is allowed for buffers to reach the size of the view.
+        m_context.frameAllocations = GetThreadAllocationCount() - allocations;
+        bool settled = m_context.terrain->GetStats().idle &&
+                       memcmp(camTransform, m_lastCamTransform, sizeof(camTransform)) == 0;
+        m_settledFrames = settled ? m_settledFrames + 1 : 0;
+        memcpy(m_lastCamTransform, camTransform, sizeof(camTransform));
+        assert(m_settledFrames < 2 || m_context.frameAllocations == 0);
+
+        // After the check, the reference render allocates its image and BVH
+        if (m_cpuRenderer && m_frame % std::max(m_options.cpuRenderInterval, 1) == 0)
+            CpuRender();
+
+        m_frame++;
+        if (m_options.frames > 0 && m_frame >= m_options.frames)
+            m_context.quit = true;
+    }
+
+    void Engine::CpuRender()
+    {
+        int width = m_context.width;
+        int height = m_context.height;
+        float proj[16];
+        bx::mtxProj(proj, FIELD_OF_VIEW, float(width) / float(height), NEAR_PLANE, FAR_PLANE,
+                    bgfx::getCaps()->homogeneousDepth);
+
+        // The blobs and camera the renderer just drew
+        m_cpuPixels.resize(size_t(width) * height * 4);
+        int64_t start = bx::getHPCounter();
+        m_cpuRenderer->Render(m_context.terrain->GetBlobsToRender(), m_context.camTransform, proj, m_context.time,
+                              width, height, m_context.jobs, m_cpuPixels.data());
+        double ms = double(bx::getHPCounter() - start) * 1000.0 / double(bx::getHPFrequency());
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s-%06d.png", m_options.cpuRenderPrefix.c_str(), m_frame);
+        if (WritePng(path, m_cpuPixels.data(), width, height))
+            printf("CPU render of %zu blobs in %.1f ms: %s\n", m_context.terrain->GetBlobsToRender().size(), ms,
+                   path);
+    }
+
+    void Engine::PollEvents()
+    {
         for (SDL_Event event; SDL_PollEvent(&event) != 0;)
         {
             ImGui_ImplSDL2_ProcessEvent(&event);
@@ -229,6 +448,12 @@ namespace blobby
                 }
             }
 
+            if (event.type == SDL_MOUSEBUTTONDOWN)
+                m_context.mouseButtons |= SDL_BUTTON(event.button.button);
+
+            if (event.type == SDL_MOUSEBUTTONUP)
+                m_context.mouseButtons &= ~SDL_BUTTON(event.button.button);
+
             if (event.type == SDL_MOUSEMOTION)
             {
                 m_context.camYaw -= float(event.motion.xrel) * m_context.sensitivity * 0.022f;
@@ -238,32 +463,6 @@ namespace blobby
                 m_context.camPitch = clamp(m_context.camPitch, -89.0f, 89.0f);
             }
         }
-
-        bx::Vec3 wishMove = {0, 0, 0};
-        if ((m_context.keyFlags & Keys::FORWARD) != 0)
-            wishMove.z += m_context.deltaTime * m_context.camSpeed;
-        if ((m_context.keyFlags & Keys::BACK) != 0)
-            wishMove.z -= m_context.deltaTime * m_context.camSpeed;
-        if ((m_context.keyFlags & Keys::RIGHT) != 0)
-            wishMove.x += m_context.deltaTime * m_context.camSpeed;
-        if ((m_context.keyFlags & Keys::LEFT) != 0)
-            wishMove.x -= m_context.deltaTime * m_context.camSpeed;
-        if ((m_context.keyFlags & Keys::UP) != 0)
-            wishMove.y += m_context.deltaTime * m_context.camSpeed;
-        if ((m_context.keyFlags & Keys::DOWN) != 0)
-            wishMove.y -= m_context.deltaTime * m_context.camSpeed;
-
-        float camRotation[16];
-        float camTranslation[16];
-        bx::mtxRotateXYZ(camRotation, bx::toRad(m_context.camPitch), bx::toRad(m_context.camYaw), 0.0f);
-        wishMove = bx::mul(wishMove, camRotation);
-        m_context.camPosition.x += wishMove.x;
-        m_context.camPosition.y += wishMove.y;
-        m_context.camPosition.z += wishMove.z;
-        bx::mtxTranslate(camTranslation, m_context.camPosition.x, m_context.camPosition.y, m_context.camPosition.z);
-        bx::mtxMul(m_context.camTransform, camRotation, camTranslation);
-
-        m_context.renderer->Loop(&m_context);
     }
 
     void Engine::Resize(int width, int height)
@@ -272,6 +471,5 @@ namespace blobby
         m_context.width = width;
         m_context.height = height;
         bgfx::reset(width, height, BGFX_RESET_VSYNC);
-        bgfx::setViewRect(0, 0, 0, width, height);
     }
 }
\ No newline at end of file
@@ -1,20 +1,78 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 #include "context.h"
 
+// Frames run in headless mode when no count is given
+#define HEADLESS_DEFAULT_FRAMES 600
+// Fixed frame time in headless mode, so runs are reproducible
+#define HEADLESS_DELTA_TIME (1.0f / 60.0f)
+// Frames between CPU reference renders when no interval is given
+#define CPU_RENDER_DEFAULT_INTERVAL 60
+
 namespace blobby
 {
+    class CpuRenderer;
+
+    struct EngineOptions
+    {
+        // No window, bgfx Noop renderer
+        bool headless = false;
+        // Let bgfx submit to the driver on its own render thread,
+        // so the next frame is simulated while the last one is submitted.
+        bool multithreadedRender = false;
+        // Quit after this many frames, 0 to run until closed
+        int frames = 0;
+        int seed = 0;
+        // Back chunks with transparent huge pages, see ChunkPool
+        bool hugePages = false;
+        // Scripted camera path, see LoadCameraPath
+        std::string cameraPath;
+        // Write a Chrome trace of the last profiled frames here at exit
+        std::string tracePath;
+        // Also render frames on the CPU and write them to <prefix>-<frame>.png
+        std::string cpuRenderPrefix;
+        int cpuRenderInterval = CPU_RENDER_DEFAULT_INTERVAL;
+    };
+
+    struct CameraKey
+    {
+        float time;
+        Vec3 position;
+        float pitch;
+        float yaw;
+    };
+
     class Engine
     {
       public:
-        Engine();
+        Engine(const EngineOptions& options);
         ~Engine();
 
         void Loop();
 
       private:
         void Resize(int width, int height);
+        void PollEvents();
+        bool LoadCameraPath(const std::string& path);
+        void FollowCameraPath(float time);
+        void CpuRender();
 
+        EngineOptions m_options;
         Context m_context;
+        int m_frame = 0;
+
+        // Frames in a row where the camera didn't move and the terrain was idle
+        int m_settledFrames = 0;
+        float m_lastCamTransform[16] = {};
+
+        std::vector<CameraKey> m_cameraPath;
+        float m_cameraPathTime = 0.0f;
+
+        CpuRenderer* m_cpuRenderer = nullptr;
+        std::vector<uint8_t> m_cpuPixels;
     };
-}
\ No newline at end of file
+}
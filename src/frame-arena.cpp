@@ -0,0 +1,48 @@
+#include <algorithm>
+
+#include "frame-arena.h"
+
+namespace blobby
+{
+    void* FrameArena::Allocate(size_t size, size_t alignment)
+    {
+        // Find a block with room, starting at the current one
+        while (m_block < m_blocks.size())
+        {
+            Block& block = m_blocks[m_block];
+            uintptr_t base = (uintptr_t)block.data.get();
+            size_t offset = ((base + m_offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+            if (offset + size <= block.size)
+            {
+                m_offset = offset + size;
+                m_used += size;
+                return block.data.get() + offset;
+            }
+
+            m_block++;
+            m_offset = 0;
+        }
+
+        // Out of blocks, only happens until the arena reaches its high-water mark
+        Block block;
+        block.size = std::max((size_t)FRAME_ARENA_BLOCK_SIZE, size + alignment);
+        block.data.reset(new uint8_t[block.size]);
+        m_blocks.push_back(std::move(block));
+        return Allocate(size, alignment);
+    }
+
+    void FrameArena::Reset()
+    {
+        m_block = 0;
+        m_offset = 0;
+        m_used = 0;
+    }
+
+    size_t FrameArena::GetCapacity() const
+    {
+        size_t capacity = 0;
+        for (const Block& block : m_blocks)
+            capacity += block.size;
+        return capacity;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Minimum size of an arena block, larger allocations get a block of their own
+#define FRAME_ARENA_BLOCK_SIZE (1024 * 1024)
+
+namespace blobby
+{
+    // Linear allocator for memory that lives until the next Reset, usually one frame.
+    // Blocks are kept across resets, so once the arena has grown to a frame's
+    // high-water mark allocating from it never touches the heap.
+    class FrameArena
+    {
+      public:
+        void* Allocate(size_t size, size_t alignment = 16);
+
+        template <typename T> T* Allocate(size_t count)
+        {
+            return (T*)Allocate(count * sizeof(T), alignof(T));
+        }
+
+        // Everything allocated since the last reset becomes invalid
+        void Reset();
+
+        size_t GetUsed() const
+        {
+            return m_used;
+        }
+
+        size_t GetCapacity() const;
+
+      private:
+        struct Block
+        {
+            std::unique_ptr<uint8_t[]> data;
+            size_t size;
+        };
+
+        std::vector<Block> m_blocks;
+        size_t m_block = 0;
+        size_t m_offset = 0;
+        size_t m_used = 0;
+    };
+}
@@ -0,0 +1,42 @@
+#include <algorithm>
+#include <cstdio>
+
+#include <bx/timer.h>
+
+#include "frame-timings.h"
+
+namespace blobby
+{
+    static const char* s_phaseNames[FRAME_PHASE_COUNT] = {
+        "Terrain::Update", "Blob packing", "Tile binning", "BVH build", "bgfx::frame", "Frame total", "GPU frame",
+    };
+
+    FrameTimings::FrameTimings()
+    {
+        for (std::vector<float>& samples : m_samples)
+            samples.resize(FRAME_TIMINGS_CAPACITY);
+    }
+
+    void FrameTimings::AddSince(FramePhase phase, int64_t start)
+    {
+        Add(phase, float((bx::getHPCounter() - start) / double(bx::getHPFrequency()) * 1000.0));
+    }
+
+    void FrameTimings::Print() const
+    {
+        printf("%-16s %8s %8s %8s %8s\n", "Phase (ms)", "frames", "p50", "p99", "max");
+        for (int i = 0; i < FRAME_PHASE_COUNT; i++)
+        {
+            if (m_counts[i] == 0)
+                continue;
+
+            size_t count = (size_t)std::min<uint64_t>(m_counts[i], FRAME_TIMINGS_CAPACITY);
+            std::vector<float> sorted(m_samples[i].begin(), m_samples[i].begin() + count);
+
+            std::sort(sorted.begin(), sorted.end());
+            size_t last = sorted.size() - 1;
+            printf("%-16s %8zu %8.3f %8.3f %8.3f\n", s_phaseNames[i], sorted.size(), sorted[last / 2],
+                   sorted[size_t(last * 0.99)], sorted[last]);
+        }
+    }
+}
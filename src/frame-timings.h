@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Samples kept per phase, older samples are overwritten
+#define FRAME_TIMINGS_CAPACITY 65536
+
+namespace blobby
+{
+    // Phases of a frame timed for performance runs, see FrameTimings
+    enum FramePhase
+    {
+        TERRAIN_UPDATE,
+        BLOB_PACKING,
+        TILE_BINNING,
+        BVH_BUILD,
+        BGFX_FRAME,
+        FRAME_TOTAL,
+        // Measured by bgfx, only for renderers with GPU timers
+        GPU_FRAME,
+        FRAME_PHASE_COUNT,
+    };
+
+    // Collects per frame phase durations and summarizes them at exit
+    class FrameTimings
+    {
+      public:
+        FrameTimings();
+
+        void Add(FramePhase phase, float ms)
+        {
+            m_samples[phase][m_counts[phase] % FRAME_TIMINGS_CAPACITY] = ms;
+            m_counts[phase]++;
+        }
+
+        // Adds the time since start, a bx::getHPCounter() value
+        void AddSince(FramePhase phase, int64_t start);
+
+        // Prints p50, p99 and max of every phase over the last FRAME_TIMINGS_CAPACITY frames
+        void Print() const;
+
+      private:
+        // Preallocated, adding samples never allocates
+        std::vector<float> m_samples[FRAME_PHASE_COUNT];
+        uint64_t m_counts[FRAME_PHASE_COUNT] = {};
+    };
+}
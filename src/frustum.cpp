@@ -0,0 +1,57 @@
+#include "frustum.h"
+
+namespace blobby
+{
+    void Frustum::Extract(const float viewProj[16])
+    {
+        // Gribb/Hartmann, for row vectors the clip space axes are the matrix columns
+        auto column = [viewProj](int c) {
+            return Vec4{viewProj[c], viewProj[4 + c], viewProj[8 + c], viewProj[12 + c]};
+        };
+        auto add = [](Vec4 a, Vec4 b) { return Vec4{a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w}; };
+        auto sub = [](Vec4 a, Vec4 b) { return Vec4{a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w}; };
+
+        Vec4 x = column(0);
+        Vec4 y = column(1);
+        Vec4 z = column(2);
+        Vec4 w = column(3);
+
+        planes[0] = add(w, x); // left
+        planes[1] = sub(w, x); // right
+        planes[2] = add(w, y); // bottom
+        planes[3] = sub(w, y); // top
+        // -w <= z is the near plane for OpenGL style depth,
+        // and slightly behind it for 0..1 depth which is still conservative.
+        planes[4] = add(w, z); // near
+        planes[5] = sub(w, z); // far
+
+        for (Vec4& plane : planes)
+        {
+            float invLength = 1.0f / sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+            plane.x *= invLength;
+            plane.y *= invLength;
+            plane.z *= invLength;
+            plane.w *= invLength;
+        }
+    }
+
+    FrustumResult Frustum::TestAABB(Vec3 min, Vec3 max) const
+    {
+        FrustumResult result = INSIDE;
+        for (const Vec4& plane : planes)
+        {
+            // Corners furthest along and against the plane normal
+            Vec3 positive = {plane.x >= 0 ? max.x : min.x, plane.y >= 0 ? max.y : min.y,
+                             plane.z >= 0 ? max.z : min.z};
+            Vec3 negative = {plane.x >= 0 ? min.x : max.x, plane.y >= 0 ? min.y : max.y,
+                             plane.z >= 0 ? min.z : max.z};
+
+            if (plane.x * positive.x + plane.y * positive.y + plane.z * positive.z + plane.w < 0)
+                return OUTSIDE;
+
+            if (plane.x * negative.x + plane.y * negative.y + plane.z * negative.z + plane.w < 0)
+                result = INTERSECTS;
+        }
+        return result;
+    }
+}
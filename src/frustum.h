@@ -0,0 +1,26 @@
+#pragma once
+
+#include "math.h"
+
+namespace blobby
+{
+    enum FrustumResult
+    {
+        OUTSIDE,
+        INTERSECTS,
+        INSIDE
+    };
+
+    class Frustum
+    {
+      public:
+        // Extract planes from a bx (row vector) view-projection matrix
+        void Extract(const float viewProj[16]);
+
+        // Spheres of blobs are tested in batches by CullChunkBlobs
+        FrustumResult TestAABB(Vec3 min, Vec3 max) const;
+
+        // Normals point inwards, p is inside a plane if dot(n, p) + w >= 0
+        Vec4 planes[6];
+    };
+}
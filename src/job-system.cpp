@@ -0,0 +1,234 @@
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "job-system.h"
+#include "profiler.h"
+
+namespace blobby
+{
+    // Queue of the calling thread, threads not created by the job system share queue 0
+    static thread_local int t_queueIndex = 0;
+
+    JobSystem::JobSystem(int workerCount)
+    {
+        m_jobs = std::make_unique<Job[]>(JOB_POOL_SIZE);
+        m_freeJobs = std::make_unique<uint32_t[]>(JOB_POOL_SIZE);
+        for (int i = 0; i < JOB_POOL_SIZE; i++)
+        {
+            // Generation 0 is reserved for the default handle
+            m_jobs[i].generation = 1;
+            m_freeJobs[i] = JOB_POOL_SIZE - 1 - i;
+        }
+        m_freeCount = JOB_POOL_SIZE;
+
+        for (int i = 0; i < workerCount + 1; i++)
+        {
+            m_queues.push_back(std::make_unique<JobQueue>());
+        }
+        m_backgroundQueue = std::make_unique<JobQueue>();
+
+        t_queueIndex = 0;
+        for (int i = 0; i < workerCount; i++)
+        {
+            m_threads.emplace_back(&JobSystem::WorkerLoop, this, i);
+        }
+    }
+
+    JobSystem::~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_quit = true;
+        }
+        m_condition.notify_all();
+
+        for (std::thread& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    JobHandle JobSystem::CreateJob(void (*function)(const void*), const void* data, size_t size, JobHandle parent)
+    {
+        uint32_t index;
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_freeMutex);
+                if (m_freeCount > 0)
+                {
+                    index = m_freeJobs[--m_freeCount];
+                    break;
+                }
+            }
+
+            // Out of jobs, help finishing others until one is free
+            if (!TryRunJob(false))
+                std::this_thread::yield();
+        }
+
+        Job& job = m_jobs[index];
+        job.function = function;
+        memcpy(job.data, data, size);
+        job.unfinished.store(1, std::memory_order_relaxed);
+        job.parent = -1;
+
+        if (parent.generation != 0)
+        {
+            assert(!IsDone(parent) && "Parent finished before its child was created");
+            job.parent = (int)parent.index;
+            m_jobs[parent.index].unfinished.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        m_activeJobs++;
+        return {index, job.generation.load(std::memory_order_relaxed)};
+    }
+
+    JobHandle JobSystem::CreateGroup(JobHandle parent)
+    {
+        return Create([] {}, parent);
+    }
+
+    void JobSystem::Run(JobHandle job)
+    {
+        Push(*m_queues[t_queueIndex], job.index);
+    }
+
+    void JobSystem::RunBackground(JobHandle job)
+    {
+        Push(*m_backgroundQueue, job.index);
+    }
+
+    void JobSystem::Push(JobQueue& queue, uint32_t index)
+    {
+        bool queued = false;
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.back - queue.front < JOB_QUEUE_SIZE)
+            {
+                queue.jobs[queue.back % JOB_QUEUE_SIZE] = index;
+                queue.back++;
+                queued = true;
+            }
+        }
+
+        if (!queued)
+        {
+            Execute(index);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_queuedJobs++;
+        }
+        m_condition.notify_one();
+    }
+
+    bool JobSystem::IsDone(JobHandle job) const
+    {
+        return m_jobs[job.index].generation.load(std::memory_order_acquire) != job.generation;
+    }
+
+    void JobSystem::Wait(JobHandle job)
+    {
+        PROFILE_SCOPE("JobSystem::Wait");
+
+        while (!IsDone(job))
+        {
+            if (!TryRunJob(false))
+                std::this_thread::yield();
+        }
+    }
+
+    void JobSystem::WaitIdle()
+    {
+        while (m_activeJobs > 0)
+        {
+            if (!TryRunJob(true))
+                std::this_thread::yield();
+        }
+    }
+
+    bool JobSystem::TryRunJob(bool background)
+    {
+        // Newest job of our own queue first, it's most likely still in cache,
+        // then the oldest of the other queues and the background queue.
+        int count = (int)m_queues.size();
+        for (int i = 0; i < count + (background ? 1 : 0); i++)
+        {
+            JobQueue& queue = i < count ? *m_queues[(t_queueIndex + i) % count] : *m_backgroundQueue;
+            uint32_t index = 0;
+            bool found = false;
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.back > queue.front)
+                {
+                    if (i == 0)
+                    {
+                        queue.back--;
+                        index = queue.jobs[queue.back % JOB_QUEUE_SIZE];
+                    }
+                    else
+                    {
+                        index = queue.jobs[queue.front % JOB_QUEUE_SIZE];
+                        queue.front++;
+                    }
+                    found = true;
+                }
+            }
+
+            if (found)
+            {
+                m_queuedJobs--;
+                Execute(index);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void JobSystem::Execute(uint32_t index)
+    {
+        Job& job = m_jobs[index];
+        job.function(job.data);
+        Finish(index);
+    }
+
+    void JobSystem::Finish(uint32_t index)
+    {
+        Job& job = m_jobs[index];
+        if (job.unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        // Read the parent before the job can be reused
+        int parent = job.parent;
+        job.generation.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(m_freeMutex);
+            m_freeJobs[m_freeCount++] = index;
+        }
+        m_activeJobs--;
+
+        if (parent >= 0)
+            Finish((uint32_t)parent);
+    }
+
+    void JobSystem::WorkerLoop(int index)
+    {
+        t_queueIndex = index + 1;
+        Profiler::SetThreadName(("Worker " + std::to_string(index)).c_str());
+
+        while (true)
+        {
+            if (TryRunJob(true))
+                continue;
+
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_condition.wait(lock, [this] { return m_quit || m_queuedJobs > 0; });
+            if (m_quit && m_queuedJobs == 0)
+                return;
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Jobs that can exist at once, creating more waits for running ones to finish
+#define JOB_POOL_SIZE 4096
+// Jobs queued per thread, running a job on a full queue runs it right away
+#define JOB_QUEUE_SIZE 1024
+// Bytes available for the captures of a job function
+#define JOB_DATA_SIZE 48
+
+namespace blobby
+{
+    // Refers to a job until it has finished. The default handle is always finished.
+    struct JobHandle
+    {
+        uint32_t index = 0;
+        uint32_t generation = 0;
+    };
+
+    // Work-stealing job scheduler. Every worker and the main thread have a queue of their own,
+    // a thread runs its newest job first and steals the oldest from others when it runs out.
+    // Jobs and queues are preallocated, so scheduling never touches the heap.
+    //
+    // A job can have a parent, which only finishes once all of its children have.
+    // Children must be created before the parent finishes, so either before
+    // running it or from inside its function.
+    class JobSystem
+    {
+      public:
+        // The thread creating the job system gets the first queue, usually the main thread
+        JobSystem(int workerCount);
+        // All queued jobs are finished before the workers exit
+        ~JobSystem();
+
+        // Function captures are copied into the job, they must be small and trivially copyable
+        template <typename F> JobHandle Create(const F& function, JobHandle parent = {})
+        {
+            static_assert(sizeof(F) <= JOB_DATA_SIZE, "Job captures are too large");
+            static_assert(alignof(F) <= alignof(std::max_align_t), "Job captures are overaligned");
+            static_assert(std::is_trivially_copyable_v<F>, "Job captures must be trivially copyable");
+            return CreateJob([](const void* data) { (*(const F*)data)(); }, &function, sizeof(F), parent);
+        }
+
+        // A job without work, it finishes once all of its children have
+        JobHandle CreateGroup(JobHandle parent = {});
+
+        void Run(JobHandle job);
+        // For long jobs like streaming, only workers run them once they are out of other work.
+        // They never stall a thread waiting on a short job.
+        void RunBackground(JobHandle job);
+        bool IsDone(JobHandle job) const;
+
+        // Runs queued jobs on the calling thread until job has finished
+        void Wait(JobHandle job);
+        // Runs queued and background jobs on the calling thread until no jobs are left
+        void WaitIdle();
+
+        int GetWorkerCount() const
+        {
+            return (int)m_threads.size();
+        }
+
+      private:
+        struct Job
+        {
+            void (*function)(const void* data);
+            alignas(std::max_align_t) uint8_t data[JOB_DATA_SIZE];
+            // The job itself and its unfinished children
+            std::atomic<int> unfinished;
+            std::atomic<uint32_t> generation;
+            int parent;
+        };
+
+        // Fixed size ring, the owning thread pushes and pops at the back,
+        // other threads steal from the front.
+        struct JobQueue
+        {
+            std::mutex mutex;
+            uint32_t jobs[JOB_QUEUE_SIZE];
+            uint64_t front = 0;
+            uint64_t back = 0;
+        };
+
+        JobHandle CreateJob(void (*function)(const void*), const void* data, size_t size, JobHandle parent);
+        void Push(JobQueue& queue, uint32_t index);
+        bool TryRunJob(bool background);
+        void Execute(uint32_t index);
+        void Finish(uint32_t index);
+        void WorkerLoop(int index);
+
+        std::unique_ptr<Job[]> m_jobs;
+        // Indices of jobs not in use
+        std::unique_ptr<uint32_t[]> m_freeJobs;
+        int m_freeCount = 0;
+        std::mutex m_freeMutex;
+        std::atomic<int> m_activeJobs = 0;
+
+        // Queue 0 belongs to the thread that created the job system, 1.. to the workers
+        std::vector<std::unique_ptr<JobQueue>> m_queues;
+        std::unique_ptr<JobQueue> m_backgroundQueue;
+        std::vector<std::thread> m_threads;
+
+        // Idle workers sleep until jobs are queued
+        std::atomic<int> m_queuedJobs = 0;
+        std::mutex m_sleepMutex;
+        std::condition_variable m_condition;
+        bool m_quit = false;
+    };
+}
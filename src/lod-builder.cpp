@@ -0,0 +1,168 @@
+#include "lod-builder.h"
+#include "simd.h"
+
+namespace blobby
+{
+    BlobType DownsampleCell(const BlobType* source, int width, int x, int y, int z)
+    {
+        int sourceIndex = (width * width * y) + (width * z) + x;
+        int sourceTypeCount[BlobType::MAX] = {};
+
+        for (int yD = 0; yD < 2; yD++)
+        {
+            for (int zD = 0; zD < 2; zD++)
+            {
+                for (int xD = 0; xD < 2; xD++)
+                {
+                    int index = sourceIndex + (width * width * yD) + (width * zD) + xD;
+                    sourceTypeCount[source[index]]++;
+                }
+            }
+        }
+
+        BlobType mostCommonType = (BlobType)0;
+        for (int t = 1; t < BlobType::MAX; t++)
+        {
+            if (sourceTypeCount[t] > sourceTypeCount[mostCommonType])
+            {
+                mostCommonType = (BlobType)t;
+            }
+        }
+        return mostCommonType;
+    }
+
+    void BuildLodLevelScalar(const BlobType* source, BlobType* target, int width, int height)
+    {
+        int targetWidth = width / 2;
+        for (int y = 0; y < height; y += 2)
+        {
+            for (int z = 0; z < width; z += 2)
+            {
+                for (int x = 0; x < width; x += 2)
+                {
+                    int targetIndex = ((y / 2) * targetWidth + z / 2) * targetWidth + x / 2;
+                    target[targetIndex] = DownsampleCell(source, width, x, y, z);
+                }
+            }
+        }
+    }
+
+#if BLOBBY_SSE
+    // Votes of 16 source columns from the 4 rows of a 2x2x2 block row: rows a and b
+    // at z and z + 1 of layer y, c and d of layer y + 1. Writes 8 parents.
+    static void VoteSSE(const BlobType* a, const BlobType* b, const BlobType* c, const BlobType* d, BlobType* target)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+        __m128i rowA = _mm_loadu_si128((const __m128i*)a);
+        __m128i rowB = _mm_loadu_si128((const __m128i*)b);
+        __m128i rowC = _mm_loadu_si128((const __m128i*)c);
+        __m128i rowD = _mm_loadu_si128((const __m128i*)d);
+
+        __m128i bestCount = _mm_set1_epi16(-1);
+        __m128i bestType = zero;
+        for (int t = 0; t < BlobType::MAX; t++)
+        {
+            // Matches are -1, subtracting them counts per column
+            __m128i type = _mm_set1_epi8((char)t);
+            __m128i count = _mm_sub_epi8(zero, _mm_cmpeq_epi8(rowA, type));
+            count = _mm_sub_epi8(count, _mm_cmpeq_epi8(rowB, type));
+            count = _mm_sub_epi8(count, _mm_cmpeq_epi8(rowC, type));
+            count = _mm_sub_epi8(count, _mm_cmpeq_epi8(rowD, type));
+
+            // Add neighbouring columns, one 16 bit count per parent
+            count = _mm_add_epi16(_mm_and_si128(count, lowBytes), _mm_srli_epi16(count, 8));
+
+            // Strictly greater, so ties keep the lower type
+            __m128i greater = _mm_cmpgt_epi16(count, bestCount);
+            bestCount = _mm_max_epi16(bestCount, count);
+            bestType = _mm_or_si128(_mm_andnot_si128(greater, bestType), _mm_and_si128(greater, _mm_set1_epi16(t)));
+        }
+
+        _mm_storel_epi64((__m128i*)target, _mm_packus_epi16(bestType, bestType));
+    }
+
+    static void BuildLodLevelSSE(const BlobType* source, BlobType* target, int width, int height)
+    {
+        int targetWidth = width / 2;
+        for (int y = 0; y < height; y += 2)
+        {
+            for (int z = 0; z < width; z += 2)
+            {
+                const BlobType* row = source + (y * width + z) * width;
+                BlobType* targetRow = target + ((y / 2) * targetWidth + z / 2) * targetWidth;
+                for (int x = 0; x < width; x += 16)
+                {
+                    const BlobType* a = row + x;
+                    VoteSSE(a, a + width, a + width * width, a + width * width + width, targetRow + x / 2);
+                }
+            }
+        }
+    }
+
+    // Same as VoteSSE with the z and z + 1 rows of both layers in one register
+    BLOBBY_TARGET_AVX2 static void BuildLodLevelAVX2(const BlobType* source, BlobType* target, int width,
+                                                     int height)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i lowBytes = _mm256_set1_epi16(0x00ff);
+        int targetWidth = width / 2;
+
+        for (int y = 0; y < height; y += 2)
+        {
+            for (int z = 0; z < width; z += 2)
+            {
+                const BlobType* row = source + (y * width + z) * width;
+                BlobType* targetRow = target + ((y / 2) * targetWidth + z / 2) * targetWidth;
+                for (int x = 0; x < width; x += 16)
+                {
+                    const BlobType* a = row + x;
+                    __m256i layer0 = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)a)),
+                        _mm_loadu_si128((const __m128i*)(a + width)), 1);
+                    __m256i layer1 = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(a + width * width))),
+                        _mm_loadu_si128((const __m128i*)(a + width * width + width)), 1);
+
+                    __m128i bestCount = _mm_set1_epi16(-1);
+                    __m128i bestType = _mm_setzero_si128();
+                    for (int t = 0; t < BlobType::MAX; t++)
+                    {
+                        __m256i type = _mm256_set1_epi8((char)t);
+                        __m256i count = _mm256_sub_epi8(zero, _mm256_cmpeq_epi8(layer0, type));
+                        count = _mm256_sub_epi8(count, _mm256_cmpeq_epi8(layer1, type));
+                        count = _mm256_add_epi16(_mm256_and_si256(count, lowBytes), _mm256_srli_epi16(count, 8));
+
+                        // Add the z and z + 1 halves
+                        __m128i parentCount =
+                            _mm_add_epi16(_mm256_castsi256_si128(count), _mm256_extracti128_si256(count, 1));
+
+                        __m128i greater = _mm_cmpgt_epi16(parentCount, bestCount);
+                        bestCount = _mm_max_epi16(bestCount, parentCount);
+                        bestType = _mm_or_si128(_mm_andnot_si128(greater, bestType),
+                                                _mm_and_si128(greater, _mm_set1_epi16(t)));
+                    }
+
+                    _mm_storel_epi64((__m128i*)(targetRow + x / 2), _mm_packus_epi16(bestType, bestType));
+                }
+            }
+        }
+    }
+#endif
+
+    void BuildLodLevel(const BlobType* source, BlobType* target, int width, int height)
+    {
+#if BLOBBY_SSE
+        // Vectors cover 16 cells of a row, narrower levels are small enough for the scalar path
+        if (width % 16 == 0)
+        {
+            if (HasAVX2())
+                BuildLodLevelAVX2(source, target, width, height);
+            else
+                BuildLodLevelSSE(source, target, width, height);
+            return;
+        }
+#endif
+        BuildLodLevelScalar(source, target, width, height);
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "blob.h"
+
+namespace blobby
+{
+    // Most common type of the 2x2x2 cells starting at x, y, z of an LOD level, ties go to the lowest type.
+    // Scalar reference for BuildLodLevel.
+    BlobType DownsampleCell(const BlobType* source, int width, int x, int y, int z);
+
+    // Builds the next LOD level from source, a level of width x height x width cells,
+    // with the most common type of every 2x2x2 block. Uses the widest SIMD the CPU
+    // supports, results are identical to BuildLodLevelScalar.
+    void BuildLodLevel(const BlobType* source, BlobType* target, int width, int height);
+    void BuildLodLevelScalar(const BlobType* source, BlobType* target, int width, int height);
+}
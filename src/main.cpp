@@ -1,6 +1,81 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
 #include "engine.h"
 
+static void PrintUsage(const char* program)
+{
+    printf("Usage: %s [options]\n"
+           "  --headless           Run without a window using the bgfx Noop renderer\n"
+           "  --mt-render          Submit to the driver on a separate bgfx render thread\n"
+           "  --frames <count>     Quit after this many frames (headless default %d)\n"
+           "  --seed <seed>        Terrain seed\n"
+           "  --huge-pages         Back chunks with transparent huge pages where supported\n"
+           "  --camera-path <file> Move the camera along the keys in file,\n"
+           "                       one \"time x y z pitch yaw\" per line\n"
+           "  --trace <file>       Write a Chrome trace of the last profiled frames at exit\n"
+           "  --cpu-render <prefix>\n"
+           "                       Also render frames on the CPU to <prefix>-<frame>.png\n"
+           "  --cpu-render-every <frames>\n"
+           "                       Frames between CPU renders (default %d)\n",
+           program, HEADLESS_DEFAULT_FRAMES, CPU_RENDER_DEFAULT_INTERVAL);
+}
+
 int main(int argc, char** argv)
 {
-    blobby::Engine Engine;
+    blobby::EngineOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(arg, "--headless") == 0)
+        {
+            options.headless = true;
+        }
+        else if (strcmp(arg, "--mt-render") == 0)
+        {
+            options.multithreadedRender = true;
+        }
+        else if (strcmp(arg, "--frames") == 0 && hasValue)
+        {
+            options.frames = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--seed") == 0 && hasValue)
+        {
+            options.seed = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--huge-pages") == 0)
+        {
+            options.hugePages = true;
+        }
+        else if (strcmp(arg, "--camera-path") == 0 && hasValue)
+        {
+            options.cameraPath = argv[++i];
+        }
+        else if (strcmp(arg, "--trace") == 0 && hasValue)
+        {
+            options.tracePath = argv[++i];
+        }
+        else if (strcmp(arg, "--cpu-render") == 0 && hasValue)
+        {
+            options.cpuRenderPrefix = argv[++i];
+        }
+        else if (strcmp(arg, "--cpu-render-every") == 0 && hasValue)
+        {
+            options.cpuRenderInterval = atoi(argv[++i]);
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return strcmp(arg, "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (options.headless && options.frames <= 0)
+        options.frames = HEADLESS_DEFAULT_FRAMES;
+
+    blobby::Engine Engine(options);
 }
@@ -48,7 +48,7 @@ namespace blobby
 
     static float lengthSquared(Vec3 a)
     {
-        return powf(a.x, 2) + powf(a.y, 2) + powf(a.z, 2);
+        return a.x * a.x + a.y * a.y + a.z * a.z;
     }
 
     static float length(Vec3 a)
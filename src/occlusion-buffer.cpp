@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <cstring>
+
+#include "constants.h"
+#include "occlusion-buffer.h"
+#include "profiler.h"
+#include "simd.h"
+
+namespace blobby
+{
+    OcclusionBuffer::OcclusionBuffer()
+    {
+        int size = 0;
+        for (int level = 0; level < OCCLUSION_LEVELS; level++)
+        {
+            m_levelOffsets[level] = size;
+            size += (OCCLUSION_WIDTH >> level) * (OCCLUSION_HEIGHT >> level);
+        }
+        m_depth = std::make_unique<float[]>(size);
+        m_occluders.reserve(OCCLUSION_MAX_OCCLUDERS);
+    }
+
+    void OcclusionBuffer::Begin(const float viewProj[16], Vec3 camera)
+    {
+        memcpy(m_viewProj, viewProj, sizeof(m_viewProj));
+        m_camera = camera;
+        m_occluders.clear();
+    }
+
+    void OcclusionBuffer::TransformBox(Vec3 min, Vec3 max, float* clipX, float* clipY, float* clipW) const
+    {
+        const float* m = m_viewProj;
+
+#if BLOBBY_SSE
+        // Four corners at a time, the min z face then the max z face
+        __m128 cornerX = _mm_setr_ps(min.x, max.x, min.x, max.x);
+        __m128 cornerY = _mm_setr_ps(min.y, min.y, max.y, max.y);
+        for (int face = 0; face < 2; face++)
+        {
+            __m128 cornerZ = _mm_set1_ps(face == 0 ? min.z : max.z);
+            auto transform = [&](int column) {
+                return _mm_add_ps(_mm_add_ps(_mm_mul_ps(cornerX, _mm_set1_ps(m[column])),
+                                             _mm_mul_ps(cornerY, _mm_set1_ps(m[4 + column]))),
+                                  _mm_add_ps(_mm_mul_ps(cornerZ, _mm_set1_ps(m[8 + column])),
+                                             _mm_set1_ps(m[12 + column])));
+            };
+            _mm_storeu_ps(clipX + face * 4, transform(0));
+            _mm_storeu_ps(clipY + face * 4, transform(1));
+            _mm_storeu_ps(clipW + face * 4, transform(3));
+        }
+#else
+        for (int i = 0; i < 8; i++)
+        {
+            float x = (i & 1) ? max.x : min.x;
+            float y = (i & 2) ? max.y : min.y;
+            float z = (i & 4) ? max.z : min.z;
+            clipX[i] = x * m[0] + y * m[4] + z * m[8] + m[12];
+            clipY[i] = x * m[1] + y * m[5] + z * m[9] + m[13];
+            clipW[i] = x * m[3] + y * m[7] + z * m[11] + m[15];
+        }
+#endif
+    }
+
+    void OcclusionBuffer::ToScreen(const float* clipX, const float* clipY, const float* clipW, int count, float* x,
+                                   float* y, float* depth) const
+    {
+        const float halfWidth = OCCLUSION_WIDTH * 0.5f;
+        const float halfHeight = OCCLUSION_HEIGHT * 0.5f;
+
+        int i = 0;
+#if BLOBBY_SSE
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), _mm_loadu_ps(clipW + i));
+            __m128 ndcX = _mm_mul_ps(_mm_loadu_ps(clipX + i), invW);
+            __m128 ndcY = _mm_mul_ps(_mm_loadu_ps(clipY + i), invW);
+            _mm_storeu_ps(x + i, _mm_add_ps(_mm_mul_ps(ndcX, _mm_set1_ps(halfWidth)), _mm_set1_ps(halfWidth)));
+            _mm_storeu_ps(y + i, _mm_sub_ps(_mm_set1_ps(halfHeight), _mm_mul_ps(ndcY, _mm_set1_ps(halfHeight))));
+            _mm_storeu_ps(depth + i, invW);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            float invW = 1.0f / clipW[i];
+            x[i] = clipX[i] * invW * halfWidth + halfWidth;
+            y[i] = halfHeight - clipY[i] * invW * halfHeight;
+            depth[i] = invW;
+        }
+    }
+
+    void OcclusionBuffer::AddOccluder(Vec3 min, Vec3 max)
+    {
+        if ((int)m_occluders.size() >= OCCLUSION_MAX_OCCLUDERS)
+            return;
+
+        float clipX[8], clipY[8], clipW[8];
+        TransformBox(min, max, clipX, clipY, clipW);
+
+        // Boxes next to the camera often reach behind it, only the part in front of the near plane is drawn.
+        // Its outline is the hull of the corners in front and the points where edges cross the plane.
+        static const int edges[12][2] = {{0, 1}, {2, 3}, {4, 5}, {6, 7}, {0, 2}, {1, 3},
+                                         {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7}};
+        float pointX[20], pointY[20], pointW[20];
+        int pointCount = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            if (clipW[i] >= NEAR_PLANE)
+            {
+                pointX[pointCount] = clipX[i];
+                pointY[pointCount] = clipY[i];
+                pointW[pointCount++] = clipW[i];
+            }
+        }
+        if (pointCount == 0)
+            return;
+        for (const auto& [a, b] : edges)
+        {
+            if ((clipW[a] >= NEAR_PLANE) != (clipW[b] >= NEAR_PLANE))
+            {
+                float t = (NEAR_PLANE - clipW[a]) / (clipW[b] - clipW[a]);
+                pointX[pointCount] = clipX[a] + (clipX[b] - clipX[a]) * t;
+                pointY[pointCount] = clipY[a] + (clipY[b] - clipY[a]) * t;
+                pointW[pointCount++] = NEAR_PLANE;
+            }
+        }
+
+        float x[20], y[20], depth[20];
+        ToScreen(pointX, pointY, pointW, pointCount, x, y, depth);
+
+        // Convex hull with Andrew's monotone chain, points sorted by x then y
+        int order[20];
+        for (int i = 0; i < pointCount; i++)
+        {
+            order[i] = i;
+        }
+        std::sort(order, order + pointCount,
+                  [&](int a, int b) { return x[a] < x[b] || (x[a] == x[b] && y[a] < y[b]); });
+        auto cross = [&](int o, int a, int b) {
+            return (x[a] - x[o]) * (y[b] - y[o]) - (y[a] - y[o]) * (x[b] - x[o]);
+        };
+
+        int hull[40];
+        int count = 0;
+        for (int i = 0; i < pointCount; i++)
+        {
+            while (count >= 2 && cross(hull[count - 2], hull[count - 1], order[i]) <= 0)
+                count--;
+            hull[count++] = order[i];
+        }
+        for (int i = pointCount - 2, lower = count + 1; i >= 0; i--)
+        {
+            while (count >= lower && cross(hull[count - 2], hull[count - 1], order[i]) <= 0)
+                count--;
+            hull[count++] = order[i];
+        }
+        // The first point closes the hull and is listed twice
+        count--;
+        if (count < 3 || count > OCCLUDER_MAX_VERTICES)
+            return;
+
+        Occluder occluder;
+        occluder.count = count;
+        occluder.minY = OCCLUSION_HEIGHT;
+        occluder.maxY = 0.0f;
+        occluder.depth = 1.0f / NEAR_PLANE;
+        float minX = OCCLUSION_WIDTH;
+        float maxX = 0.0f;
+        for (int i = 0; i < count; i++)
+        {
+            occluder.x[i] = x[hull[i]];
+            occluder.y[i] = y[hull[i]];
+            minX = std::min(minX, occluder.x[i]);
+            maxX = std::max(maxX, occluder.x[i]);
+            occluder.minY = std::min(occluder.minY, occluder.y[i]);
+            occluder.maxY = std::max(occluder.maxY, occluder.y[i]);
+        }
+        for (int i = 0; i < pointCount; i++)
+        {
+            occluder.depth = std::min(occluder.depth, depth[i]);
+        }
+
+        // Too small to cover a whole pixel, or off screen
+        if (maxX - minX < 1.0f || occluder.maxY - occluder.minY < 1.0f || maxX <= 0.0f || minX >= OCCLUSION_WIDTH ||
+            occluder.maxY <= 0.0f || occluder.minY >= OCCLUSION_HEIGHT)
+            return;
+
+        // Back faces are those the camera is behind, inside the box's range on an axis both faces are.
+        // Corners of the -x, +x, -y, +y, -z and +z faces in order around them.
+        static const int faceCorners[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4},
+                                              {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}};
+        bool back[6] = {m_camera.x > min.x, m_camera.x < max.x, m_camera.y > min.y,
+                        m_camera.y < max.y, m_camera.z > min.z, m_camera.z < max.z};
+        occluder.planeCount = 0;
+        for (int face = 0; face < 6; face++)
+        {
+            if (!back[face])
+                continue;
+
+            // Part of the face in front of the near plane
+            float faceX[8], faceY[8], faceW[8];
+            int faceCount = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                int a = faceCorners[face][i];
+                int b = faceCorners[face][(i + 1) % 4];
+                if (clipW[a] >= NEAR_PLANE)
+                {
+                    faceX[faceCount] = clipX[a];
+                    faceY[faceCount] = clipY[a];
+                    faceW[faceCount++] = clipW[a];
+                }
+                if ((clipW[a] >= NEAR_PLANE) != (clipW[b] >= NEAR_PLANE))
+                {
+                    float t = (NEAR_PLANE - clipW[a]) / (clipW[b] - clipW[a]);
+                    faceX[faceCount] = clipX[a] + (clipX[b] - clipX[a]) * t;
+                    faceY[faceCount] = clipY[a] + (clipY[b] - clipY[a]) * t;
+                    faceW[faceCount++] = NEAR_PLANE;
+                }
+            }
+            if (faceCount < 3)
+                continue;
+
+            float fx[8], fy[8], fd[8];
+            ToScreen(faceX, faceY, faceW, faceCount, fx, fy, fd);
+
+            // 1 / w is affine in screen space across a plane, solve it from the
+            // two points spanning the largest triangle with the first one
+            float det = 0.0f;
+            int i1 = 0, i2 = 0;
+            for (int i = 1; i < faceCount; i++)
+            {
+                for (int j = i + 1; j < faceCount; j++)
+                {
+                    float area = (fx[i] - fx[0]) * (fy[j] - fy[0]) - (fx[j] - fx[0]) * (fy[i] - fy[0]);
+                    if (fabsf(area) > fabsf(det))
+                    {
+                        det = area;
+                        i1 = i;
+                        i2 = j;
+                    }
+                }
+            }
+            // Seen edge on, leaving the face out only makes depths farther
+            if (fabsf(det) < 0.01f)
+                continue;
+
+            float dx1 = fx[i1] - fx[0], dy1 = fy[i1] - fy[0], dd1 = fd[i1] - fd[0];
+            float dx2 = fx[i2] - fx[0], dy2 = fy[i2] - fy[0], dd2 = fd[i2] - fd[0];
+            float a = (dd1 * dy2 - dd2 * dy1) / det;
+            float b = (dx1 * dd2 - dx2 * dd1) / det;
+            float c = fd[0] - a * fx[0] - b * fy[0];
+            float* plane = occluder.planes[occluder.planeCount++];
+            plane[0] = a;
+            plane[1] = b;
+            plane[2] = c + std::min(a, 0.0f) + std::min(b, 0.0f);
+        }
+
+        m_occluders.push_back(occluder);
+    }
+
+    void OcclusionBuffer::RasterizeBand(int band)
+    {
+        PROFILE_SCOPE("OcclusionBuffer::RasterizeBand");
+
+        const int firstRow = band * OCCLUSION_BAND_HEIGHT;
+        const int lastRow = firstRow + OCCLUSION_BAND_HEIGHT;
+        float* depth = Level(0);
+        memset(&depth[firstRow * OCCLUSION_WIDTH], 0, OCCLUSION_BAND_HEIGHT * OCCLUSION_WIDTH * sizeof(float));
+
+        for (const Occluder& occluder : m_occluders)
+        {
+            int rowStart = std::max(firstRow, (int)floorf(occluder.minY));
+            int rowEnd = std::min(lastRow, (int)ceilf(occluder.maxY));
+
+            for (int py = rowStart; py < rowEnd; py++)
+            {
+                // Pixels [px, px + 1] x [py, py + 1] fully inside every edge. Inside an edge from a to b
+                // means A * (x - ax) + B * (y - ay) >= 0, which is lowest at one corner of the pixel.
+                float left = 0.0f;
+                float right = OCCLUSION_WIDTH - 1.0f;
+                for (int i = 0; i < occluder.count; i++)
+                {
+                    int next = i + 1 < occluder.count ? i + 1 : 0;
+                    float ax = occluder.x[i];
+                    float ay = occluder.y[i];
+                    float a = ay - occluder.y[next];
+                    float b = occluder.x[next] - ax;
+
+                    float bound = a * ax - b * (py - ay) - std::min(a, 0.0f) - std::min(b, 0.0f);
+                    if (a > 0.0f)
+                        left = std::max(left, ceilf(bound / a));
+                    else if (a < 0.0f)
+                        right = std::min(right, floorf(bound / a));
+                    else if (bound > 0.0f)
+                        right = -1.0f;
+                }
+                if (left > right)
+                    continue;
+
+                // Plane values at the start of the row
+                float rowPlanes[6];
+                for (int i = 0; i < occluder.planeCount; i++)
+                {
+                    rowPlanes[i] = occluder.planes[i][1] * py + occluder.planes[i][2];
+                }
+
+                float* row = &depth[py * OCCLUSION_WIDTH];
+                int px = (int)left;
+                int end = (int)right + 1;
+#if BLOBBY_SSE
+                __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+                for (; px + 4 <= end; px += 4)
+                {
+                    __m128 x = _mm_add_ps(_mm_set1_ps(float(px)), offsets);
+                    __m128 value = _mm_set1_ps(occluder.depth);
+                    for (int i = 0; i < occluder.planeCount; i++)
+                    {
+                        __m128 plane = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(occluder.planes[i][0]), x),
+                                                  _mm_set1_ps(rowPlanes[i]));
+                        value = _mm_max_ps(value, plane);
+                    }
+                    _mm_storeu_ps(&row[px], _mm_max_ps(_mm_loadu_ps(&row[px]), value));
+                }
+#endif
+                for (; px < end; px++)
+                {
+                    float value = occluder.depth;
+                    for (int i = 0; i < occluder.planeCount; i++)
+                    {
+                        value = std::max(value, occluder.planes[i][0] * px + rowPlanes[i]);
+                    }
+                    row[px] = std::max(row[px], value);
+                }
+            }
+        }
+
+        for (int level = 1; level <= OCCLUSION_BAND_LEVELS; level++)
+        {
+            BuildLevel(level, firstRow >> level, lastRow >> level);
+        }
+    }
+
+    void OcclusionBuffer::FinishPyramid()
+    {
+        for (int level = OCCLUSION_BAND_LEVELS + 1; level < OCCLUSION_LEVELS; level++)
+        {
+            BuildLevel(level, 0, OCCLUSION_HEIGHT >> level);
+        }
+    }
+
+    void OcclusionBuffer::BuildLevel(int level, int firstRow, int lastRow)
+    {
+        const int width = OCCLUSION_WIDTH >> level;
+        const int sourceWidth = width * 2;
+        const float* source = Level(level - 1);
+        float* target = Level(level);
+
+        for (int y = firstRow; y < lastRow; y++)
+        {
+            const float* row0 = &source[(y * 2) * sourceWidth];
+            const float* row1 = row0 + sourceWidth;
+            float* out = &target[y * width];
+
+            int x = 0;
+#if BLOBBY_SSE
+            // Farthest of each 2x2 texels, four at a time
+            for (; x + 4 <= width; x += 4)
+            {
+                __m128 low = _mm_min_ps(_mm_loadu_ps(&row0[x * 2]), _mm_loadu_ps(&row1[x * 2]));
+                __m128 high = _mm_min_ps(_mm_loadu_ps(&row0[x * 2 + 4]), _mm_loadu_ps(&row1[x * 2 + 4]));
+                __m128 even = _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+                __m128 odd = _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+                _mm_storeu_ps(&out[x], _mm_min_ps(even, odd));
+            }
+#endif
+            for (; x < width; x++)
+            {
+                out[x] = std::min(std::min(row0[x * 2], row0[x * 2 + 1]), std::min(row1[x * 2], row1[x * 2 + 1]));
+            }
+        }
+    }
+
+    bool OcclusionBuffer::IsOccluded(Vec3 min, Vec3 max) const
+    {
+        float clipX[8], clipY[8], clipW[8];
+        TransformBox(min, max, clipX, clipY, clipW);
+        for (int i = 0; i < 8; i++)
+        {
+            if (clipW[i] < NEAR_PLANE)
+                return false;
+        }
+
+        float x[8], y[8], depth[8];
+        ToScreen(clipX, clipY, clipW, 8, x, y, depth);
+
+        float minX = x[0], maxX = x[0], minY = y[0], maxY = y[0], nearest = depth[0];
+        for (int i = 1; i < 8; i++)
+        {
+            minX = std::min(minX, x[i]);
+            maxX = std::max(maxX, x[i]);
+            minY = std::min(minY, y[i]);
+            maxY = std::max(maxY, y[i]);
+            nearest = std::max(nearest, depth[i]);
+        }
+        if (maxX < 0.0f || minX >= OCCLUSION_WIDTH || maxY < 0.0f || minY >= OCCLUSION_HEIGHT)
+            return false;
+
+        // Parts off screen are outside the frustum and can't be seen anyway
+        int x0 = std::max(0, (int)floorf(minX));
+        int x1 = std::min(OCCLUSION_WIDTH - 1, (int)floorf(maxX));
+        int y0 = std::max(0, (int)floorf(minY));
+        int y1 = std::min(OCCLUSION_HEIGHT - 1, (int)floorf(maxY));
+
+        // Coarsest level where the box covers at most 4x4 texels, coarser
+        // levels would mostly add texels far outside the box.
+        int level = 0;
+        while ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3)
+            level++;
+
+        const float* texels = Level(level);
+        int width = OCCLUSION_WIDTH >> level;
+        float farthest = 1.0f / NEAR_PLANE;
+        for (int ty = y0 >> level; ty <= y1 >> level; ty++)
+        {
+            for (int tx = x0 >> level; tx <= x1 >> level; tx++)
+            {
+                farthest = std::min(farthest, texels[ty * width + tx]);
+            }
+        }
+
+        // The nearest corner is behind the farthest occluder
+        return nearest < farthest;
+    }
+}
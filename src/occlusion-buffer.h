@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "math.h"
+
+// Resolution of the software depth buffer, occluders are coarse so it can be far lower than the screen
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+// Rows rasterized per job, a power of two so each band builds its part of the pyramid on its own
+#define OCCLUSION_BAND_HEIGHT 16
+#define OCCLUSION_BANDS (OCCLUSION_HEIGHT / OCCLUSION_BAND_HEIGHT)
+// Pyramid levels built inside a band, log2(OCCLUSION_BAND_HEIGHT)
+#define OCCLUSION_BAND_LEVELS 4
+// Pyramid levels down to 2x1 texels
+#define OCCLUSION_LEVELS 8
+// Outline points of a drawn occluder, a box clipped by the near plane has up to 10
+#define OCCLUDER_MAX_VERTICES 12
+// Occluders drawn per frame, the closest chunks add theirs first
+#define OCCLUSION_MAX_OCCLUDERS 2048
+// Chunks closer than this to the camera add occluders
+#define OCCLUSION_OCCLUDER_DISTANCE 48.0f
+
+namespace blobby
+{
+    // Conservative software depth buffer for culling on the CPU.
+    //
+    // Occluders are boxes hidden behind the rendered surface. Each is drawn as the convex hull
+    // of its projected corners, covering only pixels fully inside it, at the depth where rays
+    // leave the box through its back faces. Depths are the farthest anywhere in the pixel,
+    // so the buffer never hides more than the occluders do. A pyramid of the farthest depth
+    // of every 2x2 texels then tests a box with a few reads.
+    //
+    // Depths are stored as 1 / w, 0 where nothing was drawn.
+    class OcclusionBuffer
+    {
+      public:
+        OcclusionBuffer();
+
+        // Starts a frame with a bx (row vector) view-projection matrix, removes all occluders
+        void Begin(const float viewProj[16], Vec3 camera);
+        // Ignored once the occluder limit is reached
+        void AddOccluder(Vec3 min, Vec3 max);
+
+        int GetOccluderCount() const
+        {
+            return (int)m_occluders.size();
+        }
+
+        // Draws the occluders into one band of rows and builds its part of the pyramid.
+        // Bands write to separate rows, so they can run in parallel.
+        void RasterizeBand(int band);
+        // Builds the levels coarser than a band, once all bands are done
+        void FinishPyramid();
+
+        // True if the box is completely behind occluders. Safe to call from
+        // several threads once the pyramid is finished.
+        bool IsOccluded(Vec3 min, Vec3 max) const;
+
+      private:
+        // Convex hull of a projected occluder in pixels, counter-clockwise
+        struct Occluder
+        {
+            float x[OCCLUDER_MAX_VERTICES];
+            float y[OCCLUDER_MAX_VERTICES];
+            int count;
+            float minY;
+            float maxY;
+            // 1 / w of the back faces as A * x + B * y + C at pixel corners, lowered to the
+            // farthest value inside the pixel. Where rays leave the box is the nearest of them.
+            float planes[6][3];
+            int planeCount;
+            // 1 / w of the farthest point of the outline, the least any pixel gets
+            float depth;
+        };
+
+        // Clip space x, y and w of the corners of a box. Bit 0, 1 and 2 of a corner's index select max x, y and z.
+        void TransformBox(Vec3 min, Vec3 max, float* clipX, float* clipY, float* clipW) const;
+        // Pixel coordinates and 1 / w of points in front of the camera
+        void ToScreen(const float* clipX, const float* clipY, const float* clipW, int count, float* x, float* y,
+                      float* depth) const;
+        // Builds rows [firstRow, lastRow) of a level from the level above
+        void BuildLevel(int level, int firstRow, int lastRow);
+
+        float* Level(int level)
+        {
+            return &m_depth[m_levelOffsets[level]];
+        }
+
+        const float* Level(int level) const
+        {
+            return &m_depth[m_levelOffsets[level]];
+        }
+
+        float m_viewProj[16] = {};
+        Vec3 m_camera = {};
+        // Capacity is reserved up front, adding occluders never allocates
+        std::vector<Occluder> m_occluders;
+        // All levels back to back
+        std::unique_ptr<float[]> m_depth;
+        int m_levelOffsets[OCCLUSION_LEVELS];
+    };
+}
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "png-writer.h"
+
+namespace blobby
+{
+    static uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+    {
+        static const auto table = [] {
+            std::vector<uint32_t> table(256);
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int bit = 0; bit < 8; bit++)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+            return table;
+        }();
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static void PutU32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back(uint8_t(value >> 24));
+        out.push_back(uint8_t(value >> 16));
+        out.push_back(uint8_t(value >> 8));
+        out.push_back(uint8_t(value));
+    }
+
+    static void PutChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+    {
+        PutU32(out, (uint32_t)data.size());
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        PutU32(out, Crc32(&out[start], out.size() - start));
+    }
+
+    bool WritePng(const char* path, const uint8_t* pixels, int width, int height)
+    {
+        std::vector<uint8_t> header;
+        PutU32(header, (uint32_t)width);
+        PutU32(header, (uint32_t)height);
+        // 8 bits per channel, RGBA, no interlacing
+        header.insert(header.end(), {8, 6, 0, 0, 0});
+
+        // Rows with filter type 0, in a zlib stream of stored deflate blocks
+        size_t rowSize = size_t(width) * 4;
+        std::vector<uint8_t> raw;
+        raw.reserve((rowSize + 1) * height);
+        for (int y = 0; y < height; y++)
+        {
+            raw.push_back(0);
+            raw.insert(raw.end(), pixels + y * rowSize, pixels + (y + 1) * rowSize);
+        }
+
+        std::vector<uint8_t> data = {0x78, 0x01};
+        for (size_t offset = 0; offset == 0 || offset < raw.size(); offset += 65535)
+        {
+            size_t size = std::min<size_t>(raw.size() - offset, 65535);
+            bool last = offset + size == raw.size();
+            data.insert(data.end(), {uint8_t(last), uint8_t(size), uint8_t(size >> 8), uint8_t(~size),
+                                     uint8_t(~size >> 8)});
+            data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+        }
+
+        uint32_t a = 1;
+        uint32_t b = 0;
+        for (uint8_t byte : raw)
+        {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        PutU32(data, (b << 16) | a);
+
+        std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        PutChunk(png, "IHDR", header);
+        PutChunk(png, "IDAT", data);
+        PutChunk(png, "IEND", {});
+
+        FILE* file = fopen(path, "wb");
+        if (!file)
+        {
+            printf("Could not open %s for writing\n", path);
+            return false;
+        }
+        bool written = fwrite(png.data(), 1, png.size(), file) == png.size();
+        fclose(file);
+        return written;
+    }
+}
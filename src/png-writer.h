@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+namespace blobby
+{
+    // Writes 8 bit RGBA pixels, top row first, as an uncompressed PNG. Returns false if the file can't be written.
+    bool WritePng(const char* path, const uint8_t* pixels, int width, int height);
+}
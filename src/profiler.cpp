@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+#include <bx/timer.h>
+
+#include "profiler.h"
+
+namespace blobby
+{
+    // Event as stored in a ring slot. Fields are atomic so a snapshot can read a slot while
+    // its thread overwrites it, relaxed accesses compile to plain loads and stores.
+    struct EventSlot
+    {
+        std::atomic<const char*> name;
+        std::atomic<int64_t> start;
+        std::atomic<int64_t> end;
+        std::atomic<int> depth;
+    };
+
+    // Ring of events only written by its own thread, so recording never locks. Snapshots
+    // find out which slots were overwritten while they copied them, like a seqlock.
+    struct ThreadBuffer
+    {
+        int id;
+        // Names change rarely, the mutex is never taken while recording
+        std::mutex nameMutex;
+        std::string name;
+        std::unique_ptr<EventSlot[]> events;
+        // Events started and finished writing, event i goes to slot i % PROFILER_EVENTS_PER_THREAD
+        std::atomic<uint64_t> begun = 0;
+        std::atomic<uint64_t> count = 0;
+    };
+
+    std::atomic<bool> Profiler::s_enabled = true;
+
+    // Buffers outlive their threads so events of finished threads can still be exported
+    static std::mutex s_threadsMutex;
+    static std::vector<std::unique_ptr<ThreadBuffer>> s_threads;
+
+    static thread_local ThreadBuffer* t_buffer = nullptr;
+    static thread_local int t_depth = 0;
+
+    static int64_t s_frameStart = 0;
+    static int64_t s_lastFrameStart = 0;
+    static int64_t s_lastFrameEnd = 0;
+
+    static ThreadBuffer* GetThreadBuffer()
+    {
+        if (!t_buffer)
+        {
+            auto buffer = std::make_unique<ThreadBuffer>();
+            buffer->events = std::make_unique<EventSlot[]>(PROFILER_EVENTS_PER_THREAD);
+
+            std::lock_guard<std::mutex> lock(s_threadsMutex);
+            buffer->id = (int)s_threads.size();
+            buffer->name = "Thread " + std::to_string(buffer->id);
+            t_buffer = buffer.get();
+            s_threads.push_back(std::move(buffer));
+        }
+        return t_buffer;
+    }
+
+    void Profiler::SetThreadName(const char* name)
+    {
+        ThreadBuffer* buffer = GetThreadBuffer();
+        std::lock_guard<std::mutex> lock(buffer->nameMutex);
+        buffer->name = name;
+    }
+
+    void Profiler::BeginFrame()
+    {
+        if (!IsEnabled())
+            return;
+
+        int64_t now = bx::getHPCounter();
+        s_lastFrameStart = s_frameStart;
+        s_lastFrameEnd = now;
+        s_frameStart = now;
+    }
+
+    bool Profiler::GetLastFrame(int64_t* start, int64_t* end)
+    {
+        if (s_lastFrameStart == 0)
+            return false;
+
+        *start = s_lastFrameStart;
+        *end = s_lastFrameEnd;
+        return true;
+    }
+
+    int64_t Profiler::Enter()
+    {
+        t_depth++;
+        return bx::getHPCounter();
+    }
+
+    void Profiler::Leave(const char* name, int64_t start)
+    {
+        int64_t end = bx::getHPCounter();
+        t_depth--;
+
+        // Announce the slot before overwriting it, then publish the event
+        ThreadBuffer* buffer = GetThreadBuffer();
+        uint64_t index = buffer->count.load(std::memory_order_relaxed);
+        buffer->begun.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        EventSlot& slot = buffer->events[index % PROFILER_EVENTS_PER_THREAD];
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.start.store(start, std::memory_order_relaxed);
+        slot.end.store(end, std::memory_order_relaxed);
+        slot.depth.store(t_depth, std::memory_order_relaxed);
+        buffer->count.store(index + 1, std::memory_order_release);
+    }
+
+    void Profiler::Collect(int64_t start, int64_t end, std::vector<ProfileThread>& threads)
+    {
+        // Snapshots are reused so collecting every frame doesn't allocate
+        std::lock_guard<std::mutex> threadsLock(s_threadsMutex);
+        if (threads.size() < s_threads.size())
+            threads.resize(s_threads.size());
+        for (size_t t = s_threads.size(); t < threads.size(); t++)
+            threads[t].events.clear();
+
+        for (size_t t = 0; t < s_threads.size(); t++)
+        {
+            ThreadBuffer* buffer = s_threads[t].get();
+            ProfileThread& thread = threads[t];
+            thread.id = buffer->id;
+            thread.events.clear();
+            thread.events.reserve(PROFILER_EVENTS_PER_THREAD);
+            {
+                std::lock_guard<std::mutex> lock(buffer->nameMutex);
+                thread.name = buffer->name;
+            }
+
+            // Events finish in order on their thread, so walk back from the newest
+            // to the first that ends inside the range and copy forward from there
+            uint64_t count = buffer->count.load(std::memory_order_acquire);
+            uint64_t oldest = count > PROFILER_EVENTS_PER_THREAD ? count - PROFILER_EVENTS_PER_THREAD : 0;
+            uint64_t first = count;
+            while (first > oldest &&
+                   buffer->events[(first - 1) % PROFILER_EVENTS_PER_THREAD].end.load(std::memory_order_relaxed) >=
+                       start)
+                first--;
+
+            for (uint64_t i = first; i < count; i++)
+            {
+                const EventSlot& slot = buffer->events[i % PROFILER_EVENTS_PER_THREAD];
+                thread.events.push_back({slot.name.load(std::memory_order_relaxed),
+                                         slot.start.load(std::memory_order_relaxed),
+                                         slot.end.load(std::memory_order_relaxed),
+                                         slot.depth.load(std::memory_order_relaxed)});
+            }
+
+            // Drop events whose slots the thread started overwriting while they were copied
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t begun = buffer->begun.load(std::memory_order_relaxed);
+            uint64_t valid = begun > PROFILER_EVENTS_PER_THREAD ? begun - PROFILER_EVENTS_PER_THREAD : 0;
+            if (valid > first)
+                thread.events.erase(thread.events.begin(), thread.events.begin() + std::min(valid, count) - first);
+
+            std::erase_if(thread.events, [end](const ProfileEvent& event) { return event.start > end; });
+        }
+    }
+
+    void Profiler::ReserveSnapshots(std::vector<ProfileThread>& threads, int threadCount)
+    {
+        if ((int)threads.size() < threadCount)
+            threads.resize(threadCount);
+        for (ProfileThread& thread : threads)
+            thread.events.reserve(PROFILER_EVENTS_PER_THREAD);
+    }
+
+    bool Profiler::ExportChromeTrace(const char* path)
+    {
+        std::vector<ProfileThread> threads;
+        Collect(INT64_MIN, INT64_MAX, threads);
+
+        FILE* file = fopen(path, "w");
+        if (!file)
+        {
+            printf("Could not open %s for writing\n", path);
+            return false;
+        }
+
+        int64_t origin = INT64_MAX;
+        for (const ProfileThread& thread : threads)
+        {
+            for (const ProfileEvent& event : thread.events)
+                origin = std::min(origin, event.start);
+        }
+
+        // Timestamps are in microseconds
+        const double toMicroseconds = 1000000.0 / double(bx::getHPFrequency());
+        bool first = true;
+        fprintf(file, "{\"traceEvents\":[\n");
+        for (const ProfileThread& thread : threads)
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", thread.id, thread.name.c_str());
+            first = false;
+
+            for (const ProfileEvent& event : thread.events)
+            {
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        event.name, thread.id, (event.start - origin) * toMicroseconds,
+                        (event.end - event.start) * toMicroseconds);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+
+        printf("Wrote profiler trace to %s\n", path);
+        return true;
+    }
+}
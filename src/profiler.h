@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Set to 0 to compile out all profile scopes
+#ifndef BLOBBY_PROFILER
+#define BLOBBY_PROFILER 1
+#endif
+
+// Events kept per thread, the oldest are overwritten
+#define PROFILER_EVENTS_PER_THREAD 16384
+
+#if BLOBBY_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// Times the enclosing scope, name must outlive the profiler (a string literal)
+#define PROFILE_SCOPE(name) blobby::ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+namespace blobby
+{
+    struct ProfileEvent
+    {
+        const char* name;
+        // bx::getHPCounter() ticks
+        int64_t start;
+        int64_t end;
+        // Nesting depth on the recording thread
+        int depth;
+    };
+
+    // Snapshot of a thread's events, see Profiler::Collect
+    struct ProfileThread
+    {
+        int id;
+        std::string name;
+        std::vector<ProfileEvent> events;
+    };
+
+    // Hierarchical CPU profiler. Scopes are recorded into a ring buffer per
+    // thread that only its thread writes, so recording never locks. Snapshots
+    // are copied only when the overlay or a trace export asks for one.
+    // Disabled scopes cost a relaxed atomic load.
+    class Profiler
+    {
+      public:
+        static void SetEnabled(bool enabled)
+        {
+            s_enabled.store(enabled, std::memory_order_relaxed);
+        }
+
+        static bool IsEnabled()
+        {
+            return s_enabled.load(std::memory_order_relaxed);
+        }
+
+        // Name shown for the calling thread
+        static void SetThreadName(const char* name);
+
+        // Marks the start of a frame, called from the main thread
+        static void BeginFrame();
+        // Bounds of the last complete frame, false if there isn't one
+        static bool GetLastFrame(int64_t* start, int64_t* end);
+
+        // Copies events of every thread overlapping [start, end], reusing the snapshots in threads.
+        // Snapshots beyond the threads that have recorded so far are left empty.
+        static void Collect(int64_t start, int64_t end, std::vector<ProfileThread>& threads);
+        // Makes room in threads for snapshots of threadCount threads, so collecting never allocates
+        // when a thread records its first event
+        static void ReserveSnapshots(std::vector<ProfileThread>& threads, int threadCount);
+
+        // Writes every buffered event as Chrome trace JSON, viewable in chrome://tracing or Perfetto
+        static bool ExportChromeTrace(const char* path);
+
+        // Used by ProfileScope
+        static int64_t Enter();
+        static void Leave(const char* name, int64_t start);
+
+      private:
+        static std::atomic<bool> s_enabled;
+    };
+
+    class ProfileScope
+    {
+      public:
+        ProfileScope(const char* name)
+        {
+            m_name = name;
+            m_start = Profiler::IsEnabled() ? Profiler::Enter() : 0;
+        }
+
+        ~ProfileScope()
+        {
+            if (m_start != 0)
+                Profiler::Leave(m_name, m_start);
+        }
+
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+
+      private:
+        const char* m_name;
+        int64_t m_start;
+    };
+}
@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "region-file.h"
+
+#define REGION_MAGIC 0x52424C42 // "BLBR"
+#define REGION_VERSION 1
+#define REGION_HEADER_SIZE (3 * sizeof(uint32_t))
+#define REGION_INDEX_SIZE (CHUNKS_IN_REGION * sizeof(RegionEntry))
+
+// Regions kept open at once. When exceeded the least recently used region no thread
+// is using is closed, regions in use stay open until they can be closed.
+#define MAX_OPEN_REGIONS 64
+
+namespace blobby
+{
+    static int FloorDiv(int a, int b)
+    {
+        return (a >= 0 ? a : a - (b - 1)) / b;
+    }
+
+    static void WriteVarint(std::vector<uint8_t>& out, uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(uint8_t(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(uint8_t(value));
+    }
+
+    static bool ReadVarint(const uint8_t*& data, const uint8_t* end, uint32_t& value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 32 && data < end; shift += 7)
+        {
+            uint8_t byte = *data++;
+            value |= uint32_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    void EncodeBlobs(const BlobType* blobs, int blobCount, std::vector<uint8_t>& out)
+    {
+        // Palette of the types present in this chunk
+        int paletteIndex[256];
+        std::fill(paletteIndex, paletteIndex + 256, -1);
+        uint8_t palette[256];
+        int paletteCount = 0;
+        for (int i = 0; i < blobCount; i++)
+        {
+            if (paletteIndex[blobs[i]] < 0)
+            {
+                paletteIndex[blobs[i]] = paletteCount;
+                palette[paletteCount++] = blobs[i];
+            }
+        }
+
+        out.clear();
+        out.push_back(uint8_t(paletteCount));
+        out.insert(out.end(), palette, palette + paletteCount);
+
+        // Runs of (length, palette index)
+        int i = 0;
+        while (i < blobCount)
+        {
+            BlobType type = blobs[i];
+            int runStart = i;
+            while (i < blobCount && blobs[i] == type)
+            {
+                i++;
+            }
+            WriteVarint(out, uint32_t(i - runStart));
+            out.push_back(uint8_t(paletteIndex[type]));
+        }
+    }
+
+    bool DecodeBlobs(const uint8_t* data, size_t size, BlobType* blobs, int blobCount)
+    {
+        const uint8_t* end = data + size;
+        if (data == end)
+            return false;
+
+        int paletteCount = *data++;
+        if (end - data < paletteCount)
+            return false;
+
+        const uint8_t* palette = data;
+        data += paletteCount;
+
+        int i = 0;
+        while (i < blobCount)
+        {
+            uint32_t runLength;
+            if (!ReadVarint(data, end, runLength) || data == end)
+                return false;
+
+            uint8_t index = *data++;
+            if (index >= paletteCount || runLength > uint32_t(blobCount - i))
+                return false;
+
+            memset(blobs + i, palette[index], runLength);
+            i += runLength;
+        }
+
+        return data == end;
+    }
+
+    RegionFile::RegionFile(const std::string& path)
+    {
+        m_file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (m_file.is_open())
+        {
+            uint32_t header[3];
+            m_file.read((char*)header, sizeof(header));
+            m_file.read((char*)m_index, sizeof(m_index));
+            if (!m_file || header[0] != REGION_MAGIC || header[1] != REGION_VERSION || header[2] != REGION_SIZE)
+            {
+                printf("Invalid region file %s\n", path.c_str());
+                return;
+            }
+
+            m_file.seekg(0, std::ios::end);
+            uint64_t fileSize = (uint64_t)m_file.tellg();
+
+            // Space between the payloads is free, what follows the last one is reused by appending
+            std::vector<RegionExtent> used;
+            for (const RegionEntry& entry : m_index)
+            {
+                if (entry.offset != 0)
+                    used.push_back({entry.offset, entry.capacity});
+            }
+            std::sort(used.begin(), used.end(),
+                      [](const RegionExtent& a, const RegionExtent& b) { return a.offset < b.offset; });
+
+            uint32_t end = REGION_HEADER_SIZE + REGION_INDEX_SIZE;
+            for (const RegionExtent& extent : used)
+            {
+                if (extent.offset < end || uint64_t(extent.offset) + extent.size > fileSize)
+                {
+                    printf("Invalid region file %s\n", path.c_str());
+                    return;
+                }
+
+                if (extent.offset > end)
+                    m_free.push_back({end, extent.offset - end});
+                end = extent.offset + extent.size;
+            }
+            m_end = end;
+        }
+        else
+        {
+            // New region, write an empty index
+            m_file.open(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+            if (!m_file.is_open())
+            {
+                printf("Could not create region file %s\n", path.c_str());
+                return;
+            }
+
+            uint32_t header[3] = {REGION_MAGIC, REGION_VERSION, REGION_SIZE};
+            m_file.write((const char*)header, sizeof(header));
+            m_file.write((const char*)m_index, sizeof(m_index));
+            m_end = REGION_HEADER_SIZE + REGION_INDEX_SIZE;
+        }
+
+        m_valid = true;
+    }
+
+    bool RegionFile::ReadChunk(int localIndex, BlobType* blobs, int blobCount)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const RegionEntry& entry = m_index[localIndex];
+        if (entry.offset == 0)
+            return false;
+
+        m_buffer.resize(entry.size);
+        m_file.seekg(entry.offset);
+        m_file.read((char*)m_buffer.data(), entry.size);
+        if (!m_file)
+        {
+            m_file.clear();
+            return false;
+        }
+
+        return DecodeBlobs(m_buffer.data(), m_buffer.size(), blobs, blobCount);
+    }
+
+    bool RegionFile::WriteChunk(int localIndex, const BlobType* blobs, int blobCount)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        EncodeBlobs(blobs, blobCount, m_buffer);
+        uint32_t size = (uint32_t)m_buffer.size();
+
+        // Never over the saved payload, a write cut short would lose the chunk
+        RegionEntry entry = {Allocate(size), size, size};
+        m_file.seekp(entry.offset);
+        m_file.write((const char*)m_buffer.data(), size);
+        if (m_file)
+        {
+            // Seeking flushes the payload to the file before the entry
+            m_file.seekp(REGION_HEADER_SIZE + localIndex * sizeof(RegionEntry));
+            m_file.write((const char*)&entry, sizeof(RegionEntry));
+        }
+
+        if (!m_file)
+        {
+            m_file.clear();
+            Free(entry.offset, size);
+            return false;
+        }
+
+        RegionEntry& saved = m_index[localIndex];
+        if (saved.offset != 0)
+            Free(saved.offset, saved.capacity);
+        saved = entry;
+        return true;
+    }
+
+    uint32_t RegionFile::Allocate(uint32_t size)
+    {
+        for (auto extent = m_free.begin(); extent != m_free.end(); extent++)
+        {
+            if (extent->size >= size)
+            {
+                uint32_t offset = extent->offset;
+                extent->offset += size;
+                extent->size -= size;
+                if (extent->size == 0)
+                    m_free.erase(extent);
+                return offset;
+            }
+        }
+
+        uint32_t offset = m_end;
+        m_end += size;
+        return offset;
+    }
+
+    void RegionFile::Free(uint32_t offset, uint32_t size)
+    {
+        auto next = std::lower_bound(m_free.begin(), m_free.end(), offset,
+                                     [](const RegionExtent& extent, uint32_t value) { return extent.offset < value; });
+        if (next != m_free.begin() && (next - 1)->offset + (next - 1)->size == offset)
+        {
+            offset = (next - 1)->offset;
+            size += (next - 1)->size;
+            next = m_free.erase(next - 1);
+        }
+        if (next != m_free.end() && offset + size == next->offset)
+        {
+            size += next->size;
+            next = m_free.erase(next);
+        }
+
+        // Space at the end is appended to again
+        if (offset + size == m_end)
+            m_end = offset;
+        else
+            m_free.insert(next, {offset, size});
+    }
+
+    void RegionFile::Flush()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_file.flush();
+    }
+
+    RegionStorage::RegionStorage(const std::string& directory)
+    {
+        m_directory = directory;
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if (error)
+        {
+            printf("Could not create save directory %s: %s\n", directory.c_str(), error.message().c_str());
+        }
+    }
+
+    std::shared_ptr<RegionFile> RegionStorage::GetRegion(int chunkX, int chunkZ, bool create)
+    {
+        int regionX = FloorDiv(chunkX, REGION_SIZE);
+        int regionZ = FloorDiv(chunkZ, REGION_SIZE);
+        int64_t key = (int64_t(regionX) << 32) | uint32_t(regionZ);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_regions.find(key);
+        if (it != m_regions.end())
+        {
+            it->second.lastUsed = ++m_useCount;
+            return it->second.file;
+        }
+
+        std::string path =
+            m_directory + "/r." + std::to_string(regionX) + "." + std::to_string(regionZ) + ".region";
+        if (!create && !std::filesystem::exists(path))
+            return nullptr;
+
+        if (m_regions.size() >= MAX_OPEN_REGIONS)
+        {
+            // Only the map holds a region no thread is using, and new references are only
+            // handed out under the lock, so closing it can't race a read or write. Closing a
+            // region in use would let the path be opened again while the old file still writes.
+            auto oldest = m_regions.end();
+            for (auto candidate = m_regions.begin(); candidate != m_regions.end(); candidate++)
+            {
+                if (candidate->second.file.use_count() == 1 &&
+                    (oldest == m_regions.end() || candidate->second.lastUsed < oldest->second.lastUsed))
+                    oldest = candidate;
+            }
+
+            if (oldest != m_regions.end())
+            {
+                oldest->second.file->Flush();
+                m_regions.erase(oldest);
+            }
+        }
+
+        std::shared_ptr<RegionFile> region = std::make_shared<RegionFile>(path);
+        if (!region->IsValid())
+            return nullptr;
+
+        m_regions.emplace(key, OpenRegion{region, ++m_useCount});
+        return region;
+    }
+
+    bool RegionStorage::ReadChunk(int chunkX, int chunkZ, BlobType* blobs, int blobCount)
+    {
+        std::shared_ptr<RegionFile> region = GetRegion(chunkX, chunkZ, false);
+        if (!region)
+            return false;
+
+        int localX = chunkX - FloorDiv(chunkX, REGION_SIZE) * REGION_SIZE;
+        int localZ = chunkZ - FloorDiv(chunkZ, REGION_SIZE) * REGION_SIZE;
+        return region->ReadChunk(localZ * REGION_SIZE + localX, blobs, blobCount);
+    }
+
+    bool RegionStorage::WriteChunk(int chunkX, int chunkZ, const BlobType* blobs, int blobCount)
+    {
+        std::shared_ptr<RegionFile> region = GetRegion(chunkX, chunkZ, true);
+        if (!region)
+            return false;
+
+        int localX = chunkX - FloorDiv(chunkX, REGION_SIZE) * REGION_SIZE;
+        int localZ = chunkZ - FloorDiv(chunkZ, REGION_SIZE) * REGION_SIZE;
+        return region->WriteChunk(localZ * REGION_SIZE + localX, blobs, blobCount);
+    }
+
+    void RegionStorage::Flush()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& [key, region] : m_regions)
+        {
+            region.file->Flush();
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "blob.h"
+
+// Chunks per side of a region file
+#define REGION_SIZE 32
+#define CHUNKS_IN_REGION (REGION_SIZE * REGION_SIZE)
+
+namespace blobby
+{
+    // Location of a chunk payload inside a region file
+    struct RegionEntry
+    {
+        uint32_t offset = 0;
+        uint32_t size = 0;
+        uint32_t capacity = 0;
+    };
+
+    // Bytes of a region file no chunk uses
+    struct RegionExtent
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // A file holding up to REGION_SIZE x REGION_SIZE chunks.
+    //
+    // Layout:
+    //   header: magic, version, REGION_SIZE
+    //   index:  CHUNKS_IN_REGION RegionEntry, offset 0 if the chunk isn't saved
+    //   data:   palette + run-length encoded chunk payloads
+    //
+    // The index is kept in memory, so reading a chunk is a single positioned read.
+    // Chunks are written to free space, left by rewritten chunks or at the end of the file,
+    // and only then does their index entry point to it. The payload saved before stays
+    // intact until the index is updated, and is freed after. Free space isn't stored,
+    // it is the space between the payloads of the index when the file is opened.
+    class RegionFile
+    {
+      public:
+        RegionFile(const std::string& path);
+
+        bool IsValid()
+        {
+            return m_valid;
+        }
+
+        bool ReadChunk(int localIndex, BlobType* blobs, int blobCount);
+        bool WriteChunk(int localIndex, const BlobType* blobs, int blobCount);
+        void Flush();
+
+      private:
+        // Offset of size free bytes, from the first free extent that fits or the end of the file
+        uint32_t Allocate(uint32_t size);
+        void Free(uint32_t offset, uint32_t size);
+
+        std::fstream m_file;
+        RegionEntry m_index[CHUNKS_IN_REGION];
+        // End of the last payload, the file can be longer
+        uint32_t m_end = 0;
+        // Sorted by offset, neighbours are merged
+        std::vector<RegionExtent> m_free;
+        std::vector<uint8_t> m_buffer;
+        std::mutex m_mutex;
+        bool m_valid = false;
+    };
+
+    // Owns the region files of a world save directory.
+    // Safe to use from multiple threads.
+    class RegionStorage
+    {
+      public:
+        RegionStorage(const std::string& directory);
+
+        bool ReadChunk(int chunkX, int chunkZ, BlobType* blobs, int blobCount);
+        bool WriteChunk(int chunkX, int chunkZ, const BlobType* blobs, int blobCount);
+        void Flush();
+
+      private:
+        std::shared_ptr<RegionFile> GetRegion(int chunkX, int chunkZ, bool create);
+
+        struct OpenRegion
+        {
+            std::shared_ptr<RegionFile> file;
+            // m_useCount when it was last returned by GetRegion
+            uint64_t lastUsed;
+        };
+
+        std::string m_directory;
+        // At most one RegionFile per path is ever open, each has its own index and end of file
+        std::unordered_map<int64_t, OpenRegion> m_regions;
+        uint64_t m_useCount = 0;
+        std::mutex m_mutex;
+    };
+
+    // Palette + run-length encoding of chunk cells
+    void EncodeBlobs(const BlobType* blobs, int blobCount, std::vector<uint8_t>& out);
+    bool DecodeBlobs(const uint8_t* data, size_t size, BlobType* blobs, int blobCount);
+}
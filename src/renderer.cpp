@@ -1,11 +1,13 @@
 #include <algorithm>
 #include <bx/math.h>
+#include <cstring>
 #include <imgui.h>
 #include <vector>
 
 #include "bgfx-imgui/imgui_impl_bgfx.h"
 #include "sdl-imgui/imgui_impl_sdl2.h"
 
+#include "alloc-counter.h"
 #include "blob.h"
 #include "constants.h"
 #include "file-ops.h"
@@ -29,111 +31,606 @@ namespace blobby
     };
     static const uint16_t screen_tri_list[] = {0, 1, 2, 0, 2, 3};
 
-    Renderer::Renderer()
+    static bool load_program(bgfx::ProgramHandle* program, const char* vertex, const char* fragment)
     {
-        bgfx::VertexLayout pos_col_vert_layout;
-        pos_col_vert_layout.begin().add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float).end();
-        bgfx::VertexBufferHandle vbh =
-            bgfx::createVertexBuffer(bgfx::makeRef(screen_vertices, sizeof(screen_vertices)), pos_col_vert_layout);
-        bgfx::IndexBufferHandle ibh = bgfx::createIndexBuffer(bgfx::makeRef(screen_tri_list, sizeof(screen_tri_list)));
-
         const std::string shader_root = "shaders/build/";
 
         std::string vshader;
-        if (!fileops::read_file(shader_root + "v_simple.bin", vshader))
+        if (!fileops::read_file(shader_root + vertex + ".bin", vshader))
         {
             printf("Could not find shader vertex shader (ensure shaders have been "
                    "compiled).\n"
                    "Run compile-shaders-<platform>.sh/bat\n");
-            return;
+            return false;
         }
 
         std::string fshader;
-        if (!fileops::read_file(shader_root + "f_simple.bin", fshader))
+        if (!fileops::read_file(shader_root + fragment + ".bin", fshader))
         {
             printf("Could not find shader fragment shader (ensure shaders have "
                    "been compiled).\n"
                    "Run compile-shaders-<platform>.sh/bat\n");
-            return;
+            return false;
         }
 
         bgfx::ShaderHandle vsh = create_shader(vshader, "vshader");
         bgfx::ShaderHandle fsh = create_shader(fshader, "fshader");
-        bgfx::ProgramHandle program = bgfx::createProgram(vsh, fsh, true);
+        *program = bgfx::createProgram(vsh, fsh, true);
+        return true;
+    }
 
-        m_program = program;
-        m_vbh = vbh;
-        m_ibh = ibh;
+    Renderer::Renderer(bool headless)
+    {
+        m_headless = headless;
+
+        bgfx::VertexLayout pos_col_vert_layout;
+        pos_col_vert_layout.begin().add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float).end();
+        m_vbh = bgfx::createVertexBuffer(bgfx::makeRef(screen_vertices, sizeof(screen_vertices)), pos_col_vert_layout);
+        m_ibh = bgfx::createIndexBuffer(bgfx::makeRef(screen_tri_list, sizeof(screen_tri_list)));
+
+        // The Noop renderer doesn't run shaders, headless runs don't need them compiled
+        if ((!load_program(&m_program, "v_simple", "f_simple") ||
+             !load_program(&m_upscaleProgram, "v_simple", "f_upscale")) &&
+            !headless)
+            return;
 
         m_u_globals = bgfx::createUniform("u_globals", bgfx::UniformType::Vec4, 1);
-        m_u_positions = bgfx::createUniform("u_positions", bgfx::UniformType::Vec4, MAX_SDF);
+        m_u_blobInfo = bgfx::createUniform("u_blobInfo", bgfx::UniformType::Vec4, 1);
+        m_s_blobs = bgfx::createUniform("s_blobs", bgfx::UniformType::Sampler);
+        m_u_tileInfo = bgfx::createUniform("u_tileInfo", bgfx::UniformType::Vec4, 1);
+        m_s_tiles = bgfx::createUniform("s_tiles", bgfx::UniformType::Sampler);
+        m_u_bvhInfo = bgfx::createUniform("u_bvhInfo", bgfx::UniformType::Vec4, 1);
+        m_s_bvh = bgfx::createUniform("s_bvh", bgfx::UniformType::Sampler);
+        m_u_brickInfo = bgfx::createUniform("u_brickInfo", bgfx::UniformType::Vec4, 1);
+        m_s_brickGrid = bgfx::createUniform("s_brickGrid", bgfx::UniformType::Sampler);
+        m_s_brickAtlas = bgfx::createUniform("s_brickAtlas", bgfx::UniformType::Sampler);
+        m_u_upscale = bgfx::createUniform("u_upscale", bgfx::UniformType::Vec4, 1);
+        m_s_scene = bgfx::createUniform("s_scene", bgfx::UniformType::Sampler);
+        m_u_temporal = bgfx::createUniform("u_temporal", bgfx::UniformType::Vec4, 1);
+        m_u_historyInfo = bgfx::createUniform("u_historyInfo", bgfx::UniformType::Vec4, 1);
+        m_u_prevEye = bgfx::createUniform("u_prevEye", bgfx::UniformType::Vec4, 1);
+        m_u_prevViewProj = bgfx::createUniform("u_prevViewProj", bgfx::UniformType::Mat4, 1);
+        m_s_history = bgfx::createUniform("s_history", bgfx::UniformType::Sampler);
+
+        if (bgfx::getCaps()->supported & BGFX_CAPS_TEXTURE_3D)
+        {
+            m_brickGridTexture =
+                bgfx::createTexture3D(BRICK_GRID_XZ, BRICK_GRID_Y, BRICK_GRID_XZ, false, bgfx::TextureFormat::R32F,
+                                      BGFX_SAMPLER_POINT | BGFX_SAMPLER_UVW_CLAMP);
+            m_brickAtlasTexture =
+                bgfx::createTexture3D(BRICK_ATLAS_SIZE, BRICK_ATLAS_SIZE, BRICK_ATLAS_SIZE, false,
+                                      bgfx::TextureFormat::R32F, BGFX_SAMPLER_UVW_CLAMP);
+        }
+        else
+        {
+            printf("3D textures not supported, brick map disabled\n");
+        }
 
         m_valid = true;
     }
 
     Renderer::~Renderer()
     {
-        bgfx::destroy(m_u_positions);
+        for (bgfx::FrameBufferHandle frameBuffer : m_sceneFrameBuffers)
+        {
+            if (bgfx::isValid(frameBuffer))
+                bgfx::destroy(frameBuffer);
+        }
+        bgfx::destroy(m_s_history);
+        bgfx::destroy(m_u_prevViewProj);
+        bgfx::destroy(m_u_prevEye);
+        bgfx::destroy(m_u_historyInfo);
+        bgfx::destroy(m_u_temporal);
+        bgfx::destroy(m_s_scene);
+        bgfx::destroy(m_u_upscale);
+        if (bgfx::isValid(m_upscaleProgram))
+            bgfx::destroy(m_upscaleProgram);
+        if (bgfx::isValid(m_brickAtlasTexture))
+            bgfx::destroy(m_brickAtlasTexture);
+        if (bgfx::isValid(m_brickGridTexture))
+            bgfx::destroy(m_brickGridTexture);
+        bgfx::destroy(m_s_brickAtlas);
+        bgfx::destroy(m_s_brickGrid);
+        bgfx::destroy(m_u_brickInfo);
+        if (bgfx::isValid(m_bvhTexture))
+            bgfx::destroy(m_bvhTexture);
+        bgfx::destroy(m_s_bvh);
+        bgfx::destroy(m_u_bvhInfo);
+        if (bgfx::isValid(m_tileTexture))
+            bgfx::destroy(m_tileTexture);
+        bgfx::destroy(m_s_tiles);
+        bgfx::destroy(m_u_tileInfo);
+        if (bgfx::isValid(m_blobTexture))
+            bgfx::destroy(m_blobTexture);
+        bgfx::destroy(m_s_blobs);
+        bgfx::destroy(m_u_blobInfo);
         bgfx::destroy(m_u_globals);
 
         bgfx::destroy(m_vbh);
         bgfx::destroy(m_ibh);
-        bgfx::destroy(m_program);
+        if (bgfx::isValid(m_program))
+            bgfx::destroy(m_program);
+    }
+
+    void Renderer::DrawStats(Context* context)
+    {
+        const TerrainStats& stats = context->terrain->GetStats();
+
+        ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
+        ImGui::Begin("Stats", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+        ImGui::Text("Frame: %.2f ms", context->deltaTime * 1000.0f);
+        ImGui::Text("Frame allocations: %d, arena: %zu KB", (int)context->frameAllocations,
+                    m_frameArena.GetCapacity() / 1024);
+        ImGui::Separator();
+        ImGui::Text("Chunks resident: %d", stats.residentChunks);
+        ImGui::Text("Chunk pool: %d slots, %d at most, %.0f MB", stats.pooledChunks, stats.pooledChunksHighWater,
+                    stats.chunkPoolMb);
+        ImGui::Text("Chunk memory: %.1f / %d MB, evicted %d (%.1f/s)", stats.chunkMemoryMb, context->chunkBudgetMb,
+                    stats.evictedChunks, stats.evictionsPerSecond);
+        ImGui::Text("Chunks pending: %d", stats.pendingChunks);
+        ImGui::Text("Chunks/s: %.1f", stats.chunksPerSecond);
+        ImGui::Text("Chunk read: %.3f ms, generate: %.3f ms", stats.chunkReadMs, stats.chunkGenerateMs);
+        ImGui::Text("Chunk downsample: %.3f ms", stats.chunkDownsampleMs);
+        ImGui::Text("Generated chunks/s per core: %.0f (target %d)", stats.generatedChunksPerCore,
+                    GENERATE_TARGET_CHUNKS_PER_CORE);
+        ImGui::Text("Chunks saved: %d", stats.chunksSaved);
+        ImGui::Text("Integration: %.3f ms (max %.3f ms)", stats.integrationMs, stats.maxIntegrationMs);
+        ImGui::SliderInt("Load radius", &context->loadRadius, 1, 16);
+        ImGui::SliderInt("Chunk budget (MB)", &context->chunkBudgetMb, 4, 128);
+        ImGui::Text("Edited cells: %d in %.3f ms", stats.editedCells, stats.editMs);
+        ImGui::SliderFloat("Sculpt radius", &context->sculptRadius, 0.5f, 8.0f);
+        ImGui::Separator();
+        ImGui::Text("Chunks visible: %d, frustum culled: %d", stats.visibleChunks, stats.frustumCulledChunks);
+        ImGui::Text("Blobs visible: %d, frustum culled: %d", stats.visibleBlobs, stats.frustumCulledBlobs);
+        ImGui::Text("Buried blobs skipped: %d", stats.buriedBlobs);
+        ImGui::Text("Blob rows uploaded: %d/%d", m_blobRowsUploaded, m_blobTextureHeight);
+        if (!context->useBlobBvh)
+        {
+            int tileCount = m_tileBinner.GetTilesX() * m_tileBinner.GetTilesY();
+            ImGui::Text("Blobs per tile: %.1f",
+                        tileCount > 0 ? float(m_tileBinner.GetIndexCount()) / tileCount : 0.0f);
+        }
+        ImGui::Checkbox("Frustum cull blobs", &context->frustumCullBlobs);
+        ImGui::Text("BVH: %d nodes, depth %d, built in %.3f ms", m_blobBvh.GetNodeCount(), m_blobBvh.GetDepth(),
+                    m_bvhBuildMs);
+        ImGui::Checkbox("Blob BVH", &context->useBlobBvh);
+        ImGui::Text("Occluders: %d, drawn in %.3f ms", stats.occluders, stats.occlusionRasterMs);
+        ImGui::Text("Occlusion culled: %d chunks, %d blobs (%.1f%%)", stats.occlusionCulledChunks,
+                    stats.occlusionCulledBlobs, stats.occlusionCullRate * 100.0f);
+        ImGui::Checkbox("Occlusion culling", &context->occlusionCulling);
+        ImGui::Separator();
+        const BrickMap& brickMap = context->terrain->GetBrickMap();
+        ImGui::Text("Brick slots: %d/%d", brickMap.GetUsedSlots(),
+                    BRICK_ATLAS_SLOTS * BRICK_ATLAS_SLOTS * BRICK_ATLAS_SLOTS);
+        ImGui::Text("Bricks dirty: %d, uploaded: %d", brickMap.GetDirtyBricks(), m_bricksUploaded);
+        ImGui::Checkbox("Brick map", &context->useBrickMap);
+        ImGui::Separator();
+        ImGui::Text("GPU: %.2f ms, smoothed: %.2f ms", m_gpuMs, m_resolutionScaler.GetSmoothedMs());
+        ImGui::Text("Render scale: %.0f%% (%dx%d)", context->renderScale * 100.0f, m_renderWidth, m_renderHeight);
+        ImGui::Checkbox("Dynamic resolution", &context->dynamicResolution);
+        if (context->dynamicResolution)
+            ImGui::SliderFloat("Target GPU time", &context->targetFrameMs, 4.0f, 33.0f, "%.1f ms");
+        else
+            ImGui::SliderFloat("Render scale", &context->renderScale, RENDER_SCALE_MIN, RENDER_SCALE_MAX);
+        ImGui::Checkbox("Temporal reprojection", &context->temporalReprojection);
+        ImGui::SameLine();
+        ImGui::Checkbox("Step heatmap", &context->stepHeatmap);
+        ImGui::End();
+    }
+
+    void Renderer::DrawProfiler()
+    {
+        const float rowHeight = 18.0f;
+        const double toMs = 1000.0 / double(bx::getHPFrequency());
+
+        ImGui::SetNextWindowPos(ImVec2(10, 400), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(800, 260), ImGuiCond_FirstUseEver);
+        ImGui::Begin("Profiler");
+
+        bool enabled = Profiler::IsEnabled();
+        if (ImGui::Checkbox("Enabled", &enabled))
+            Profiler::SetEnabled(enabled);
+        ImGui::SameLine();
+        ImGui::Checkbox("Pause", &m_profilerPaused);
+        ImGui::SameLine();
+        if (ImGui::Button("Export trace"))
+        {
+            // Only when asked, frames are otherwise allocation free
+            UncountedAllocations uncounted;
+            Profiler::ExportChromeTrace("trace.json");
+        }
+
+        if (!m_profilerPaused && Profiler::GetLastFrame(&m_profileFrameStart, &m_profileFrameEnd))
+            Profiler::Collect(m_profileFrameStart, m_profileFrameEnd, m_profileThreads);
+
+        double frameMs = (m_profileFrameEnd - m_profileFrameStart) * toMs;
+        ImGui::Text("Frame: %.3f ms", frameMs);
+
+        // One lane per thread, nested scopes stacked below their parents
+        ImDrawList* drawList = ImGui::GetWindowDrawList();
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        float width = std::max(ImGui::GetContentRegionAvail().x, 1.0f);
+        float y = origin.y;
+        for (const ProfileThread& thread : m_profileThreads)
+        {
+            if (thread.events.empty())
+                continue;
+
+            int maxDepth = 0;
+            for (const ProfileEvent& event : thread.events)
+                maxDepth = std::max(maxDepth, event.depth);
+
+            drawList->AddText(ImVec2(origin.x, y), IM_COL32(255, 255, 255, 255), thread.name.c_str());
+            y += rowHeight;
+
+            for (const ProfileEvent& event : thread.events)
+            {
+                float x0 = origin.x + float((event.start - m_profileFrameStart) * toMs / frameMs) * width;
+                float x1 = origin.x + float((event.end - m_profileFrameStart) * toMs / frameMs) * width;
+                x0 = std::max(x0, origin.x);
+                x1 = std::max(std::min(x1, origin.x + width), x0 + 1.0f);
+                ImVec2 min(x0, y + event.depth * rowHeight);
+                ImVec2 max(x1, min.y + rowHeight - 1.0f);
+
+                // Color by name so a scope keeps its color between frames
+                uint32_t hash = uint32_t(uintptr_t(event.name) * 2654435761u);
+                ImU32 color = IM_COL32(80 + (hash & 0x7f), 80 + ((hash >> 8) & 0x7f), 80 + ((hash >> 16) & 0x7f), 255);
+                drawList->AddRectFilled(min, max, color);
+
+                drawList->PushClipRect(min, max, true);
+                drawList->AddText(ImVec2(min.x + 2.0f, min.y + 1.0f), IM_COL32(0, 0, 0, 255), event.name);
+                drawList->PopClipRect();
+
+                if (ImGui::IsMouseHoveringRect(min, max))
+                    ImGui::SetTooltip("%s: %.3f ms", event.name, (event.end - event.start) * toMs);
+            }
+            y += (maxDepth + 1) * rowHeight;
+        }
+        ImGui::Dummy(ImVec2(width, y - origin.y));
+
+        ImGui::End();
+    }
+
+    void Renderer::UpdateRenderScale(Context* context)
+    {
+        // Recreated only when the window resizes, scale changes just use less of them
+        if (context->width != m_sceneWidth || context->height != m_sceneHeight)
+        {
+            uint16_t width = uint16_t(context->width);
+            uint16_t height = uint16_t(context->height);
+            for (bgfx::FrameBufferHandle& frameBuffer : m_sceneFrameBuffers)
+            {
+                if (bgfx::isValid(frameBuffer))
+                    bgfx::destroy(frameBuffer);
+
+                // Color is filtered when scaled up, distances are read a pixel at a time
+                bgfx::TextureHandle attachments[2] = {
+                    bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::RGBA8,
+                                          BGFX_TEXTURE_RT | BGFX_SAMPLER_UVW_CLAMP),
+                    bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::R32F,
+                                          BGFX_TEXTURE_RT | BGFX_SAMPLER_POINT | BGFX_SAMPLER_UVW_CLAMP),
+                };
+                frameBuffer = bgfx::createFrameBuffer(2, attachments, true);
+            }
+            m_sceneWidth = context->width;
+            m_sceneHeight = context->height;
+            m_historyValid = false;
+        }
+
+        // bgfx reports the last frame the GPU finished, a frame or two behind
+        const bgfx::Stats* stats = bgfx::getStats();
+        m_gpuMs = 0.0f;
+        if (stats->gpuTimerFreq > 0 && stats->gpuTimeEnd > stats->gpuTimeBegin)
+        {
+            m_gpuMs = float(double(stats->gpuTimeEnd - stats->gpuTimeBegin) * 1000.0 / double(stats->gpuTimerFreq));
+            m_timings.Add(GPU_FRAME, m_gpuMs);
+        }
+
+        if (context->dynamicResolution)
+            m_resolutionScaler.Update(m_gpuMs, context->targetFrameMs);
+        else if (context->renderScale != m_resolutionScaler.GetScale())
+            m_resolutionScaler.SetScale(context->renderScale);
+        context->renderScale = m_resolutionScaler.GetScale();
+
+        m_renderWidth = std::max(1, int(float(m_sceneWidth) * context->renderScale + 0.5f));
+        m_renderHeight = std::max(1, int(float(m_sceneHeight) * context->renderScale + 0.5f));
+    }
+
+    const bgfx::Memory* Renderer::Stage(const void* data, size_t size)
+    {
+        void* staged = m_staging[m_stagingIndex].Allocate(size);
+        memcpy(staged, data, size);
+        return bgfx::makeRef(staged, (uint32_t)size);
+    }
+
+    int Renderer::UploadBlobs(std::span<const Blob> blobs)
+    {
+        int numSDF = (int)blobs.size();
+        int maxRows = (int)bgfx::getCaps()->limits.maxTextureSize;
+        if (numSDF > maxRows * BLOB_TEXTURE_WIDTH)
+        {
+            printf("Exceeded max blob texture size, some will not be rendered! (%d/%d)\n", numSDF,
+                   maxRows * BLOB_TEXTURE_WIDTH);
+            numSDF = maxRows * BLOB_TEXTURE_WIDTH;
+        }
+
+        int rows = std::max(1, (numSDF + BLOB_TEXTURE_WIDTH - 1) / BLOB_TEXTURE_WIDTH);
+        m_blobData.resize(rows * BLOB_TEXTURE_WIDTH);
+        for (int i = 0; i < numSDF; i++)
+        {
+            m_blobData[i] = {blobs[i].Position.x, blobs[i].Position.y, blobs[i].Position.z, blobs[i].Radius};
+        }
+        std::fill(m_blobData.begin() + numSDF, m_blobData.end(), Vec4{0, 0, 0, 0});
+
+        bool recreated =
+            GrowTexture(m_blobTexture, m_blobTextureHeight, BLOB_TEXTURE_WIDTH, rows, bgfx::TextureFormat::RGBA32F);
+
+        // Find the range of rows that changed since the last upload
+        int firstRow = 0;
+        int lastRow = rows - 1;
+        if (!recreated)
+        {
+            const int rowBytes = BLOB_TEXTURE_WIDTH * sizeof(Vec4);
+            int uploadedRows = (int)m_uploadedBlobData.size() / BLOB_TEXTURE_WIDTH;
+            auto rowChanged = [&](int row) {
+                return row >= uploadedRows || memcmp(&m_blobData[row * BLOB_TEXTURE_WIDTH],
+                                                     &m_uploadedBlobData[row * BLOB_TEXTURE_WIDTH], rowBytes) != 0;
+            };
+
+            while (firstRow < rows && !rowChanged(firstRow))
+                firstRow++;
+            while (lastRow >= firstRow && !rowChanged(lastRow))
+                lastRow--;
+        }
+
+        m_blobRowsUploaded = lastRow - firstRow + 1;
+        if (m_blobRowsUploaded > 0)
+        {
+            // The data is swapped into m_uploadedBlobData below and
+            // not written again until the frame after next
+            const bgfx::Memory* mem = bgfx::makeRef(&m_blobData[firstRow * BLOB_TEXTURE_WIDTH],
+                                                    m_blobRowsUploaded * BLOB_TEXTURE_WIDTH * sizeof(Vec4));
+            bgfx::updateTexture2D(m_blobTexture, 0, 0, 0, firstRow, BLOB_TEXTURE_WIDTH, m_blobRowsUploaded, mem);
+        }
+        m_uploadedBlobData.swap(m_blobData);
+
+        return numSDF;
+    }
+
+    bool Renderer::GrowTexture(bgfx::TextureHandle& texture, int& height, int width, int rows,
+                               bgfx::TextureFormat::Enum format)
+    {
+        if (rows <= height)
+            return false;
+
+        if (bgfx::isValid(texture))
+            bgfx::destroy(texture);
+
+        height = 1;
+        while (height < rows)
+            height *= 2;
+
+        texture = bgfx::createTexture2D(uint16_t(width), uint16_t(height), false, 1, format,
+                                        BGFX_SAMPLER_POINT | BGFX_SAMPLER_UVW_CLAMP);
+        return true;
+    }
+
+    void Renderer::UploadRows(bgfx::TextureHandle& texture, int& height, int width, int channels,
+                              bgfx::TextureFormat::Enum format, const std::vector<float>& data)
+    {
+        const int rowFloats = width * channels;
+        int rows = std::max(1, ((int)data.size() + rowFloats - 1) / rowFloats);
+        GrowTexture(texture, height, width, rows, format);
+
+        // Only the used rows are uploaded
+        size_t size = rows * rowFloats * sizeof(float);
+        uint8_t* staged = (uint8_t*)m_staging[m_stagingIndex].Allocate(size);
+        memcpy(staged, data.data(), data.size() * sizeof(float));
+        memset(staged + data.size() * sizeof(float), 0, size - data.size() * sizeof(float));
+        bgfx::updateTexture2D(texture, 0, 0, 0, 0, uint16_t(width), uint16_t(rows),
+                              bgfx::makeRef(staged, (uint32_t)size));
+    }
+
+    void Renderer::UploadBricks(BrickMap& brickMap)
+    {
+        m_bricksUploaded = 0;
+        if (!bgfx::isValid(m_brickGridTexture))
+            return;
+
+        if (brickMap.IsGridChanged())
+        {
+            const int gridSize = BRICK_GRID_XZ * BRICK_GRID_Y * BRICK_GRID_XZ * sizeof(float);
+            bgfx::updateTexture3D(m_brickGridTexture, 0, 0, 0, 0, BRICK_GRID_XZ, BRICK_GRID_Y, BRICK_GRID_XZ,
+                                  Stage(brickMap.GetGridData(), gridSize));
+        }
+
+        // Slots rebuilt more than once since the last upload are only uploaded once
+        const std::vector<int>& changedSlots = brickMap.GetChangedSlots();
+        int* slots = m_frameArena.Allocate<int>(changedSlots.size());
+        std::copy(changedSlots.begin(), changedSlots.end(), slots);
+        std::sort(slots, slots + changedSlots.size());
+        int slotCount = int(std::unique(slots, slots + changedSlots.size()) - slots);
+
+        const int brickSize = BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES * sizeof(float);
+        for (int i = 0; i < slotCount; i++)
+        {
+            int slot = slots[i];
+            uint16_t x = uint16_t(slot % BRICK_ATLAS_SLOTS * BRICK_SAMPLES);
+            uint16_t y = uint16_t(slot / BRICK_ATLAS_SLOTS % BRICK_ATLAS_SLOTS * BRICK_SAMPLES);
+            uint16_t z = uint16_t(slot / (BRICK_ATLAS_SLOTS * BRICK_ATLAS_SLOTS) * BRICK_SAMPLES);
+            bgfx::updateTexture3D(m_brickAtlasTexture, 0, x, y, z, BRICK_SAMPLES, BRICK_SAMPLES, BRICK_SAMPLES,
+                                  Stage(brickMap.GetBrickData(slot), brickSize));
+        }
+        m_bricksUploaded = slotCount;
+
+        brickMap.ClearChanges();
     }
 
     void Renderer::Loop(Context* context)
     {
+        PROFILE_SCOPE("Renderer::Loop");
+        int64_t frameStart = bx::getHPCounter();
+
+        // bgfx is done with the staging memory of the frame before last
+        m_frameArena.Reset();
+        m_stagingIndex ^= 1;
+        m_staging[m_stagingIndex].Reset();
+
         // imgui
-        ImGui_Implbgfx_NewFrame();
-        ImGui_ImplSDL2_NewFrame();
+        if (!m_headless)
+        {
+            ImGui_Implbgfx_NewFrame();
+            ImGui_ImplSDL2_NewFrame();
 
-        ImGui::NewFrame();
-        ImGui::ShowDemoWindow(); // your drawing here
-        ImGui::Render();
-        ImGui_Implbgfx_RenderDrawLists(ImGui::GetDrawData());
+            ImGui::NewFrame();
+            DrawStats(context);
+            DrawProfiler();
+            ImGui::Render();
+            ImGui_Implbgfx_RenderDrawLists(ImGui::GetDrawData());
+        }
+
+        // Render resolution
+        UpdateRenderScale(context);
+        bool originBottomLeft = bgfx::getCaps()->originBottomLeft;
+        m_sceneIndex ^= 1;
+        bgfx::setViewFrameBuffer(SCENE_VIEW, m_sceneFrameBuffers[m_sceneIndex]);
+        bgfx::setViewRect(SCENE_VIEW, 0, 0, uint16_t(m_renderWidth), uint16_t(m_renderHeight));
+        bgfx::setViewRect(UPSCALE_VIEW, 0, 0, uint16_t(context->width), uint16_t(context->height));
 
         // Matrices
         float view[16];
         bx::mtxInverse(view, context->camTransform);
 
         float proj[16];
-        bx::mtxProj(proj, 75.0f, float(context->width) / float(context->height), NEAR_PLANE, FAR_PLANE,
+        bx::mtxProj(proj, FIELD_OF_VIEW, float(context->width) / float(context->height), NEAR_PLANE, FAR_PLANE,
                     bgfx::getCaps()->homogeneousDepth);
 
-        bgfx::setViewTransform(0, view, proj);
+        bgfx::setViewTransform(SCENE_VIEW, view, proj);
 
         float model[16];
         bx::mtxIdentity(model);
         bgfx::setTransform(model);
 
         // Update terrain culling
+        int64_t phaseStart = bx::getHPCounter();
         context->terrain->Update(context, proj);
+        m_timings.AddSince(TERRAIN_UPDATE, phaseStart);
 
-        // Uniforms
-        std::vector<Blob*> blobs = context->terrain->GetBlobsToRender();
-        int numSDF = blobs.size();
-        if (numSDF > MAX_SDF)
+        // Blob BVH, blobs are rendered in its leaf order
+        std::span<const Blob> blobs = context->terrain->GetBlobsToRender();
+        bool useBvh = context->useBlobBvh && !blobs.empty();
+        if (useBvh)
         {
-            printf("Exceeded max SDF limit, some will not be rendered! (%d/%d)\n", numSDF, MAX_SDF);
-            numSDF = MAX_SDF;
+            phaseStart = bx::getHPCounter();
+            m_blobBvh.Build(blobs.data(), (int)blobs.size());
+            blobs = m_blobBvh.GetBlobs();
+            UploadRows(m_bvhTexture, m_bvhTextureHeight, BVH_TEXTURE_WIDTH, 4, bgfx::TextureFormat::RGBA32F,
+                       m_blobBvh.GetData());
+            m_bvhBuildMs = float((bx::getHPCounter() - phaseStart) / double(bx::getHPFrequency()) * 1000.0);
+            m_timings.Add(BVH_BUILD, m_bvhBuildMs);
         }
 
-        std::vector<Vec4> positions = std::vector<Vec4>(numSDF);
-        for (int i = 0; i < numSDF; i++)
+        // Blobs
+        phaseStart = bx::getHPCounter();
+        int numSDF = UploadBlobs(blobs);
+        m_timings.AddSince(BLOB_PACKING, phaseStart);
+
+        // Screen tiles, the shader only reads them when it doesn't traverse the BVH
+        if (!useBvh)
         {
-            positions[i] = {blobs[i]->Position.x, blobs[i]->Position.y, blobs[i]->Position.z, blobs[i]->Radius};
+            phaseStart = bx::getHPCounter();
+            m_tileBinner.Build(blobs.data(), numSDF, view, proj, m_renderWidth, m_renderHeight, originBottomLeft,
+                               SMOOTHNESS + WAVE_AMPLITUDE);
+            UploadRows(m_tileTexture, m_tileTextureHeight, TILE_TEXTURE_WIDTH, 1, bgfx::TextureFormat::R32F,
+                       m_tileBinner.GetData());
+            m_timings.AddSince(TILE_BINNING, phaseStart);
         }
 
-        float globals[4] = {context->time, (float)numSDF, 0, 0};
+        // Brick map
+        BrickMap& brickMap = context->terrain->GetBrickMap();
+        UploadBricks(brickMap);
+        bool useBricks = context->useBrickMap && bgfx::isValid(m_brickGridTexture);
+
+        // The view is the top rows of the scene target, the last ones with a bottom left origin
+        float viewStartY = originBottomLeft ? float(m_sceneHeight - m_renderHeight) : 0.0f;
+        float globals[4] = {context->time, (float)numSDF, viewStartY, context->stepHeatmap ? 1.0f : 0.0f};
+        float blobInfo[4] = {BLOB_TEXTURE_WIDTH, (float)m_blobTextureHeight, 0, 0};
+        float tileInfo[4] = {(float)m_tileBinner.GetTilesX(), TILE_SIZE, TILE_TEXTURE_WIDTH,
+                             (float)m_tileTextureHeight};
         bgfx::setUniform(m_u_globals, globals, 1);
-        bgfx::setUniform(m_u_positions, &positions[0], numSDF);
+        bgfx::setUniform(m_u_blobInfo, blobInfo, 1);
+        float brickInfo[4] = {useBricks ? 1.0f : 0.0f, (float)brickMap.GetOriginX(), (float)brickMap.GetOriginZ(),
+                              0};
+        float bvhInfo[4] = {useBvh ? 1.0f : 0.0f, BVH_TEXTURE_WIDTH, (float)m_bvhTextureHeight, 0};
+        bgfx::setUniform(m_u_tileInfo, tileInfo, 1);
+        bgfx::setUniform(m_u_bvhInfo, bvhInfo, 1);
+        bgfx::setUniform(m_u_brickInfo, brickInfo, 1);
+        bgfx::setTexture(1, m_s_blobs, m_blobTexture);
+        if (useBvh)
+            bgfx::setTexture(5, m_s_bvh, m_bvhTexture);
+        else
+            bgfx::setTexture(0, m_s_tiles, m_tileTexture);
+        if (bgfx::isValid(m_brickGridTexture))
+        {
+            bgfx::setTexture(2, m_s_brickGrid, m_brickGridTexture);
+            bgfx::setTexture(3, m_s_brickAtlas, m_brickAtlasTexture);
+        }
+
+        // Hit distances of the last frame, from the other target
+        bool useHistory = context->temporalReprojection && m_historyValid;
+        float temporal[4] = {useHistory ? 1.0f : 0.0f, originBottomLeft ? 1.0f : 0.0f, 0, 0};
+        float historyInfo[4] = {(float)m_prevRenderWidth, (float)m_prevRenderHeight, (float)m_sceneWidth,
+                                (float)m_sceneHeight};
+        float prevEye[4] = {m_prevEye.x, m_prevEye.y, m_prevEye.z, 0};
+        bgfx::setUniform(m_u_temporal, temporal, 1);
+        bgfx::setUniform(m_u_historyInfo, historyInfo, 1);
+        bgfx::setUniform(m_u_prevEye, prevEye, 1);
+        bgfx::setUniform(m_u_prevViewProj, m_prevViewProj, 1);
+        bgfx::setTexture(4, m_s_history, bgfx::getTexture(m_sceneFrameBuffers[m_sceneIndex ^ 1], 1));
 
         // Buffers
         bgfx::setVertexBuffer(0, m_vbh);
         bgfx::setIndexBuffer(m_ibh);
 
         // Draw
-        bgfx::submit(0, m_program);
+        if (bgfx::isValid(m_program))
+        {
+            bgfx::submit(SCENE_VIEW, m_program);
+        }
+        else
+        {
+            bgfx::discard();
+            bgfx::touch(SCENE_VIEW);
+        }
+
+        // The shader measures distances from the camera space point (1, 1, 1), see f_simple.sc
+        bx::mtxMul(m_prevViewProj, view, proj);
+        bx::Vec3 eye = bx::mul(bx::Vec3(1.0f, 1.0f, 1.0f), context->camTransform);
+        m_prevEye = {eye.x, eye.y, eye.z};
+        m_prevRenderWidth = m_renderWidth;
+        m_prevRenderHeight = m_renderHeight;
+        m_historyValid = true;
+
+        // Scale the scene up to the window
+        if (bgfx::isValid(m_upscaleProgram))
+        {
+            float upscale[4] = {float(m_renderWidth) / float(m_sceneWidth),
+                                float(m_renderHeight) / float(m_sceneHeight), originBottomLeft ? 1.0f : 0.0f, 0};
+            bgfx::setUniform(m_u_upscale, upscale, 1);
+            bgfx::setTexture(0, m_s_scene, bgfx::getTexture(m_sceneFrameBuffers[m_sceneIndex]));
+            bgfx::setVertexBuffer(0, m_vbh);
+            bgfx::setIndexBuffer(m_ibh);
+            bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A);
+            bgfx::submit(UPSCALE_VIEW, m_upscaleProgram);
+        }
+        else
+        {
+            bgfx::touch(UPSCALE_VIEW);
+        }
+
+        phaseStart = bx::getHPCounter();
         bgfx::frame();
+        m_timings.AddSince(BGFX_FRAME, phaseStart);
+        m_timings.AddSince(FRAME_TOTAL, frameStart);
     }
 }
\ No newline at end of file
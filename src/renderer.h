@@ -1,6 +1,7 @@
 #pragma once
 
 #include <list>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -9,17 +10,28 @@
 #include <bx/math.h>
 #include <bx/timer.h>
 
+#include "blob-bvh.h"
 #include "blob.h"
 #include "context.h"
+#include "frame-arena.h"
+#include "frame-timings.h"
 #include "math.h"
+#include "profiler.h"
+#include "resolution-scaler.h"
 #include "terrain.h"
+#include "tile-binning.h"
+
+// The SDF pass is drawn to an offscreen target, then scaled up to the window before ImGui (view 255)
+#define SCENE_VIEW 0
+#define UPSCALE_VIEW 1
 
 namespace blobby
 {
     class Renderer
     {
       public:
-        Renderer();
+        // Headless renderers don't need shaders or ImGui
+        Renderer(bool headless);
         ~Renderer();
 
         void Loop(Context* context);
@@ -29,14 +41,119 @@ namespace blobby
             return m_valid;
         }
 
+        const FrameTimings& GetTimings()
+        {
+            return m_timings;
+        }
+
+        // Threads the profiler overlay shows, so it doesn't allocate when a new one records
+        void ReserveProfilerThreads(int threadCount)
+        {
+            Profiler::ReserveSnapshots(m_profileThreads, threadCount);
+        }
+
       private:
+        void DrawStats(Context* context);
+        void DrawProfiler();
+        // Resizes the scene target with the window and picks this frame's render resolution
+        void UpdateRenderScale(Context* context);
+        int UploadBlobs(std::span<const Blob> blobs);
+        // Recreates texture with the next power of two rows if it has fewer than rows, never shrinks.
+        // Returns true if it was recreated.
+        static bool GrowTexture(bgfx::TextureHandle& texture, int& height, int width, int rows,
+                                bgfx::TextureFormat::Enum format);
+        // Grows texture to fit data and uploads the rows it fills, padded with zeros
+        void UploadRows(bgfx::TextureHandle& texture, int& height, int width, int channels,
+                        bgfx::TextureFormat::Enum format, const std::vector<float>& data);
+        void UploadBricks(BrickMap& brickMap);
+        // Copies data to this frame's staging memory for bgfx to read
+        const bgfx::Memory* Stage(const void* data, size_t size);
+
         bgfx::ProgramHandle m_program = BGFX_INVALID_HANDLE;
         bgfx::VertexBufferHandle m_vbh = BGFX_INVALID_HANDLE;
         bgfx::IndexBufferHandle m_ibh = BGFX_INVALID_HANDLE;
 
         bgfx::UniformHandle m_u_globals = BGFX_INVALID_HANDLE;
-        bgfx::UniformHandle m_u_positions = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_u_blobInfo = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_s_blobs = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_u_tileInfo = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_s_tiles = BGFX_INVALID_HANDLE;
+
+        // Scratch memory for the current frame
+        FrameArena m_frameArena;
+        // Upload staging, double buffered. bgfx reads referenced memory
+        // until the bgfx::frame after the one it was submitted in returns:
+        // in multithreaded mode the render thread submits the last frame
+        // while this frame is staged.
+        FrameArena m_staging[2];
+        int m_stagingIndex = 0;
+
+        // Blob data of the current and last uploaded frame,
+        // only rows that changed are uploaded. Uploads reference
+        // these directly, see UploadBlobs.
+        std::vector<Vec4> m_blobData;
+        std::vector<Vec4> m_uploadedBlobData;
+        bgfx::TextureHandle m_blobTexture = BGFX_INVALID_HANDLE;
+        int m_blobTextureHeight = 0;
+        int m_blobRowsUploaded = 0;
+
+        TileBinner m_tileBinner;
+        bgfx::TextureHandle m_tileTexture = BGFX_INVALID_HANDLE;
+        int m_tileTextureHeight = 0;
+
+        BlobBvh m_blobBvh;
+        bgfx::UniformHandle m_u_bvhInfo = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_s_bvh = BGFX_INVALID_HANDLE;
+        bgfx::TextureHandle m_bvhTexture = BGFX_INVALID_HANDLE;
+        int m_bvhTextureHeight = 0;
+        float m_bvhBuildMs = 0.0f;
+
+        // Brick map grid and distance atlas, null if 3D textures are not supported
+        bgfx::UniformHandle m_u_brickInfo = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_s_brickGrid = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_s_brickAtlas = BGFX_INVALID_HANDLE;
+        bgfx::TextureHandle m_brickGridTexture = BGFX_INVALID_HANDLE;
+        bgfx::TextureHandle m_brickAtlasTexture = BGFX_INVALID_HANDLE;
+        int m_bricksUploaded = 0;
+
+        // Scene targets the size of the window, lower render scales draw to their top left corner.
+        // Each has a color and a hit distance attachment, frames alternate between them so the
+        // last frame's distances can be read while drawing.
+        bgfx::ProgramHandle m_upscaleProgram = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_u_upscale = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_s_scene = BGFX_INVALID_HANDLE;
+        bgfx::FrameBufferHandle m_sceneFrameBuffers[2] = {BGFX_INVALID_HANDLE, BGFX_INVALID_HANDLE};
+        int m_sceneIndex = 0;
+        int m_sceneWidth = 0;
+        int m_sceneHeight = 0;
+        int m_renderWidth = 0;
+        int m_renderHeight = 0;
+
+        // Temporal reprojection, the last frame's camera and render size
+        bgfx::UniformHandle m_u_temporal = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_u_historyInfo = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_u_prevEye = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_u_prevViewProj = BGFX_INVALID_HANDLE;
+        bgfx::UniformHandle m_s_history = BGFX_INVALID_HANDLE;
+        float m_prevViewProj[16] = {};
+        Vec3 m_prevEye = {};
+        int m_prevRenderWidth = 0;
+        int m_prevRenderHeight = 0;
+        // False until a frame was drawn to the current targets
+        bool m_historyValid = false;
+        ResolutionScaler m_resolutionScaler;
+        // GPU time of the last frame bgfx finished, 0 without GPU timers
+        float m_gpuMs = 0.0f;
+
+        FrameTimings m_timings;
+
+        // Profiler overlay, keeps showing the same frame while paused
+        std::vector<ProfileThread> m_profileThreads;
+        int64_t m_profileFrameStart = 0;
+        int64_t m_profileFrameEnd = 0;
+        bool m_profilerPaused = false;
 
+        bool m_headless;
         bool m_valid;
     };
 }
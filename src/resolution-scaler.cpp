@@ -0,0 +1,34 @@
+#include <algorithm>
+#include <cmath>
+
+#include "resolution-scaler.h"
+
+namespace blobby
+{
+    float ResolutionScaler::Update(float gpuMs, float targetMs)
+    {
+        if (gpuMs <= 0.0f || targetMs <= 0.0f)
+            return m_scale;
+
+        if (m_smoothedMs == 0.0f)
+            m_smoothedMs = gpuMs;
+        else
+            m_smoothedMs += (gpuMs - m_smoothedMs) * RENDER_SCALE_SMOOTHING;
+
+        float ratio = targetMs / m_smoothedMs;
+        if (fabsf(ratio - 1.0f) < RENDER_SCALE_DEADBAND)
+            return m_scale;
+
+        // Part of the way each frame, the smoothed time lags behind the scale it was measured at
+        float wanted = m_scale * sqrtf(ratio);
+        float step = std::clamp((wanted - m_scale) * RENDER_SCALE_GAIN, -RENDER_SCALE_MAX_STEP, RENDER_SCALE_MAX_STEP);
+        m_scale = std::clamp(m_scale + step, RENDER_SCALE_MIN, RENDER_SCALE_MAX);
+        return m_scale;
+    }
+
+    void ResolutionScaler::SetScale(float scale)
+    {
+        m_scale = std::clamp(scale, RENDER_SCALE_MIN, RENDER_SCALE_MAX);
+        m_smoothedMs = 0.0f;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// Limits of the render scale, the SDF pass is drawn at scale * window size in each axis
+#define RENDER_SCALE_MIN 0.5f
+#define RENDER_SCALE_MAX 1.0f
+// GPU times this close to the target, as a fraction of it, leave the scale alone so it doesn't oscillate
+#define RENDER_SCALE_DEADBAND 0.1f
+// Fraction of the way to the wanted scale moved in one frame, and the largest change
+#define RENDER_SCALE_GAIN 0.2f
+#define RENDER_SCALE_MAX_STEP 0.05f
+// Weight of the newest GPU time in the smoothed time
+#define RENDER_SCALE_SMOOTHING 0.25f
+
+namespace blobby
+{
+    // Picks the render scale that keeps GPU frame time at a target. The SDF pass costs about
+    // the same per pixel, so time scales with the pixel count, the square of the scale.
+    class ResolutionScaler
+    {
+      public:
+        // Moves the scale towards the target from the last measured GPU frame time,
+        // times of 0 (no GPU timer, e.g. the Noop renderer) are ignored
+        float Update(float gpuMs, float targetMs);
+
+        // Sets the scale directly and forgets the measured times
+        void SetScale(float scale);
+
+        float GetScale() const
+        {
+            return m_scale;
+        }
+
+        float GetSmoothedMs() const
+        {
+            return m_smoothedMs;
+        }
+
+      private:
+        float m_scale = RENDER_SCALE_MAX;
+        float m_smoothedMs = 0.0f;
+    };
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// SIMD support. SSE2 is part of the x86-64 baseline and used directly,
+// wider instruction sets are selected at runtime, see HasAVX2.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BLOBBY_SSE 1
+#include <immintrin.h>
+#else
+#define BLOBBY_SSE 0
+#endif
+
+#if BLOBBY_SSE
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC allows AVX2 intrinsics in any function
+#define BLOBBY_TARGET_AVX2
+#else
+// Compiles a function for AVX2, only call it if HasAVX2
+#define BLOBBY_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace blobby
+{
+    // Whether the CPU and OS support AVX2, checked once
+    inline bool HasAVX2()
+    {
+#if defined(_MSC_VER)
+        static const bool hasAVX2 = [] {
+            int info[4];
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+                return false;
+
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+        }();
+#else
+        static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+#endif
+        return hasAVX2;
+    }
+
+    // Bit scans for movemask results, mask must not be 0
+    inline int CountTrailingZeros(uint32_t mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (int)index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    inline int CountTrailingZeros64(uint64_t mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return (int)index;
+#else
+        return __builtin_ctzll(mask);
+#endif
+    }
+
+    inline int PopCount(uint32_t mask)
+    {
+#if defined(_MSC_VER)
+        return (int)__popcnt(mask);
+#else
+        return __builtin_popcount(mask);
+#endif
+    }
+}
+#endif
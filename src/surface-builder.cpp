@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+
+#include "simd.h"
+#include "surface-builder.h"
+
+namespace blobby
+{
+    void BuildAirRows(const BlobType* cells, int width, int minY, int maxY, uint16_t* rows)
+    {
+        for (int row = minY * width; row < maxY * width; row++)
+        {
+            const BlobType* rowCells = &cells[row * width];
+#if BLOBBY_SSE
+            if (width == 16)
+            {
+                __m128i types = _mm_loadu_si128((const __m128i*)rowCells);
+                rows[row] = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(types, _mm_set1_epi8((char)BlobType::AIR)));
+                continue;
+            }
+#endif
+            uint32_t air = 0;
+            for (int x = 0; x < width; x++)
+            {
+                air |= uint32_t(rowCells[x] == BlobType::AIR) << x;
+            }
+            rows[row] = (uint16_t)air;
+        }
+    }
+
+    void BuildSurface(const uint16_t* air, const SurfaceNeighbours& neighbours, int width, int height, int minY,
+                      int maxY, int minZ, int maxZ, uint64_t* surface)
+    {
+        const uint32_t full = (1u << width) - 1;
+
+        for (int y = minY; y <= maxY; y++)
+        {
+            for (int z = minZ; z <= maxZ; z++)
+            {
+                int row = y * width + z;
+                uint32_t rowAir = air[row];
+                uint32_t solid = ~rowAir & full;
+
+                uint32_t exposed = 0;
+                if (solid != 0)
+                {
+                    // Air on either side along the row, the first and last cell border the neighbours
+                    uint32_t west = neighbours.west ? neighbours.west[row] >> (width - 1) : 1;
+                    uint32_t east = neighbours.east ? neighbours.east[row] & 1 : 1;
+                    exposed |= (rowAir << 1) | (west & 1);
+                    exposed |= (rowAir >> 1) | (east << (width - 1));
+
+                    if (z > 0)
+                        exposed |= air[row - 1];
+                    else
+                        exposed |= neighbours.north ? neighbours.north[row + width - 1] : full;
+
+                    if (z < width - 1)
+                        exposed |= air[row + 1];
+                    else
+                        exposed |= neighbours.south ? neighbours.south[row - (width - 1)] : full;
+
+                    exposed |= y < height - 1 ? air[row + width] : full;
+                    if (y > 0)
+                        exposed |= air[row - width];
+                }
+
+                // Rows never straddle words, widths are powers of two up to 16
+                int bit = row * width;
+                uint64_t mask = uint64_t(full) << (bit & 63);
+                uint64_t& word = surface[bit >> 6];
+                word = (word & ~mask) | (uint64_t(solid & exposed) << (bit & 63));
+            }
+        }
+    }
+
+    int CountSurface(const uint64_t* surface, int count)
+    {
+        int cells = 0;
+        for (int i = 0; i < (count + 63) / 64; i++)
+        {
+            cells += std::popcount(surface[i]);
+        }
+        return cells;
+    }
+
+    int CountSurfaceRange(const uint64_t* surface, int first, int count)
+    {
+        int cells = 0;
+        int end = first + count;
+        for (int bit = first; bit < end;)
+        {
+            int shift = bit & 63;
+            int bits = std::min(64 - shift, end - bit);
+            uint64_t mask = (bits == 64 ? ~0ull : (1ull << bits) - 1) << shift;
+            cells += std::popcount(surface[bit >> 6] & mask);
+            bit += bits;
+        }
+        return cells;
+    }
+
+    void ClearSurfaceRange(uint64_t* surface, int first, int count)
+    {
+        int end = first + count;
+        for (int bit = first; bit < end;)
+        {
+            int shift = bit & 63;
+            int bits = std::min(64 - shift, end - bit);
+            uint64_t mask = (bits == 64 ? ~0ull : (1ull << bits) - 1) << shift;
+            surface[bit >> 6] &= ~mask;
+            bit += bits;
+        }
+    }
+
+    uint32_t BuildSectionBounds(const uint64_t* surface, int lodLevel, int width, int height, int sectionCount,
+                                CellBox* bounds)
+    {
+        const uint32_t full = (1u << width) - 1;
+        const int layers = height / sectionCount;
+        uint32_t sections = 0;
+
+        for (int section = 0; section < sectionCount; section++)
+        {
+            int minY = height, maxY = -1, minZ = width, maxZ = -1;
+            uint32_t columns = 0;
+            for (int y = section * layers; y < (section + 1) * layers; y++)
+            {
+                for (int z = 0; z < width; z++)
+                {
+                    int bit = (y * width + z) * width;
+                    uint32_t row = uint32_t(surface[bit >> 6] >> (bit & 63)) & full;
+                    if (row == 0)
+                        continue;
+
+                    columns |= row;
+                    minY = std::min(minY, y);
+                    maxY = y;
+                    minZ = std::min(minZ, z);
+                    maxZ = std::max(maxZ, z);
+                }
+            }
+            if (columns == 0)
+                continue;
+
+            sections |= 1u << section;
+            int minX = std::countr_zero(columns);
+            int maxX = std::bit_width(columns) - 1;
+            bounds[section] = {uint8_t(minX << lodLevel),       uint8_t(minY << lodLevel),
+                               uint8_t(minZ << lodLevel),       uint8_t((maxX + 1) << lodLevel),
+                               uint8_t((maxY + 1) << lodLevel), uint8_t((maxZ + 1) << lodLevel)};
+        }
+        return sections;
+    }
+
+    int BuildOccluders(const uint16_t* air, const uint64_t* surface, int lodLevel, int width, int height,
+                       CellBox* boxes, int maxBoxes)
+    {
+        // Vertical run of buried groups, in groups and layers, max exclusive
+        struct Run
+        {
+            int x0, x1;
+            int z0, z1;
+            int y0, y1;
+            bool merged;
+        };
+
+        const int size = 1 << lodLevel;
+        const int group = std::max(1, OCCLUDER_GROUP_SIZE >> lodLevel);
+        const int groups = width / group;
+        const int minLayers = std::max(1, (OCCLUDER_MIN_HEIGHT + size - 1) / size);
+        const uint32_t full = (1u << width) - 1;
+        const uint32_t groupBits = (1u << group) - 1;
+
+        // Bit gx of buried[y * groups + gz] is set if all cells of the group are buried
+        uint8_t buried[1024];
+        assert(height * groups <= 1024 && groups <= 8);
+        for (int y = 0; y < height; y++)
+        {
+            for (int gz = 0; gz < groups; gz++)
+            {
+                uint32_t rows = full;
+                for (int z = gz * group; z < (gz + 1) * group; z++)
+                {
+                    int row = y * width + z;
+                    int bit = row * width;
+                    uint32_t rowSurface = uint32_t(surface[bit >> 6] >> (bit & 63)) & full;
+                    rows &= ~(air[row] | rowSurface);
+                }
+
+                uint8_t mask = 0;
+                for (int gx = 0; gx < groups; gx++)
+                {
+                    if (((rows >> (gx * group)) & groupBits) == groupBits)
+                        mask |= 1 << gx;
+                }
+                buried[y * groups + gz] = mask;
+            }
+        }
+
+        // Runs per column from the top down, in column order so neighbours come later
+        Run runs[512];
+        int runCount = 0;
+        for (int gz = 0; gz < groups; gz++)
+        {
+            for (int gx = 0; gx < groups; gx++)
+            {
+                int top = -1;
+                for (int y = height - 1; y >= -1; y--)
+                {
+                    bool isBuried = y >= 0 && (buried[y * groups + gz] >> gx) & 1;
+                    if (isBuried && top < 0)
+                        top = y + 1;
+                    if (!isBuried && top >= 0)
+                    {
+                        if (top - (y + 1) >= minLayers && runCount < 512)
+                            runs[runCount++] = {gx, gx + 1, gz, gz + 1, y + 1, top, false};
+                        top = -1;
+                    }
+                }
+            }
+        }
+
+        // Merge runs spanning the same layers along x, then along z
+        for (int i = 0; i < runCount; i++)
+        {
+            for (int j = i + 1; j < runCount && !runs[i].merged; j++)
+            {
+                Run& next = runs[j];
+                if (!next.merged && next.z0 == runs[i].z0 && next.y0 == runs[i].y0 && next.y1 == runs[i].y1 &&
+                    next.x0 == runs[i].x1)
+                {
+                    runs[i].x1 = next.x1;
+                    next.merged = true;
+                }
+            }
+        }
+        for (int i = 0; i < runCount; i++)
+        {
+            for (int j = i + 1; j < runCount && !runs[i].merged; j++)
+            {
+                Run& next = runs[j];
+                if (!next.merged && next.x0 == runs[i].x0 && next.x1 == runs[i].x1 && next.y0 == runs[i].y0 &&
+                    next.y1 == runs[i].y1 && next.z0 == runs[i].z1)
+                {
+                    runs[i].z1 = next.z1;
+                    next.merged = true;
+                }
+            }
+        }
+
+        int count = 0;
+        for (int i = 0; i < runCount; i++)
+        {
+            if (!runs[i].merged)
+                runs[count++] = runs[i];
+        }
+
+        // Boxes near the surface hide the most, then larger ones
+        std::sort(runs, runs + count, [](const Run& a, const Run& b) {
+            if (a.y1 != b.y1)
+                return a.y1 > b.y1;
+            return (a.x1 - a.x0) * (a.z1 - a.z0) * (a.y1 - a.y0) > (b.x1 - b.x0) * (b.z1 - b.z0) * (b.y1 - b.y0);
+        });
+
+        count = std::min(count, maxBoxes);
+        int cells = group * size;
+        for (int i = 0; i < count; i++)
+        {
+            const Run& run = runs[i];
+            boxes[i] = {uint8_t(run.x0 * cells), uint8_t(run.y0 * size), uint8_t(run.z0 * cells),
+                        uint8_t(run.x1 * cells), uint8_t(run.y1 * size), uint8_t(run.z1 * cells)};
+        }
+        return count;
+    }
+}
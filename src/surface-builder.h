@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+
+#include "blob.h"
+
+// Width of the columns occluders are built from in LOD 0 cells, levels with larger cells use one cell
+#define OCCLUDER_GROUP_SIZE 4
+// Runs of buried cells at least this tall in LOD 0 cells become occluders,
+// shorter ones hardly hide anything once shrunk by the test wave
+#define OCCLUDER_MIN_HEIGHT 4
+
+namespace blobby
+{
+    // Air rows of the same LOD level of the chunks next to a chunk, null where not loaded
+    struct SurfaceNeighbours
+    {
+        // -x and +x
+        const uint16_t* west = nullptr;
+        const uint16_t* east = nullptr;
+        // -z and +z
+        const uint16_t* north = nullptr;
+        const uint16_t* south = nullptr;
+    };
+
+    // Bit x of row y * width + z is set for AIR cells, for the layers [minY, maxY)
+    // of a level of width x height x width cells. Width is at most 16.
+    void BuildAirRows(const BlobType* cells, int width, int minY, int maxY, uint16_t* rows);
+
+    // Sets the bit of every non-air cell with an air neighbour and clears the rest, one bit per cell
+    // in cell order. Only rows of the layers [minY, maxY] and z in [minZ, maxZ] are written.
+    // Cells beyond a missing neighbour and above the top count as air, below the bottom as solid.
+    void BuildSurface(const uint16_t* air, const SurfaceNeighbours& neighbours, int width, int height, int minY,
+                      int maxY, int minZ, int maxZ, uint64_t* surface);
+
+    // Cells set in a surface bitset of count cells
+    int CountSurface(const uint64_t* surface, int count);
+    // Cells set in the bits [first, first + count) of a surface bitset
+    int CountSurfaceRange(const uint64_t* surface, int first, int count);
+    // Clears the bits [first, first + count) of a surface bitset
+    void ClearSurfaceRange(uint64_t* surface, int first, int count);
+
+    // Box of LOD 0 cells relative to a chunk, max is exclusive
+    struct CellBox
+    {
+        uint8_t minX;
+        uint8_t minY;
+        uint8_t minZ;
+        uint8_t maxX;
+        uint8_t maxY;
+        uint8_t maxZ;
+    };
+
+    // Bounds of the surface cells of a level of width x height x width cells, split into sections of equal
+    // height. Returns a mask with bit s set if section s has surface cells, bounds of the others are not written.
+    uint32_t BuildSectionBounds(const uint64_t* surface, int lodLevel, int width, int height, int sectionCount,
+                                CellBox* bounds);
+
+    // Finds boxes of solid cells without air neighbours in a level of width x height x width cells,
+    // grouped into columns of OCCLUDER_GROUP_SIZE LOD 0 cells and merged where they line up.
+    // Rays from outside only reach buried cells through the surface, so the boxes hide what is behind them.
+    // Boxes with the highest tops are kept first, returns the number written.
+    int BuildOccluders(const uint16_t* air, const uint64_t* surface, int lodLevel, int width, int height,
+                       CellBox* boxes, int maxBoxes);
+}
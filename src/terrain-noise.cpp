@@ -0,0 +1,567 @@
+#include <cmath>
+
+#include "simd.h"
+#include "terrain-noise.h"
+
+namespace blobby
+{
+    // Lattice hashing. Corners are hashed from the sum of their coordinates times
+    // large odd constants, then mixed, so neighbouring corners only need adds.
+    static constexpr uint32_t PRIME_X = 0x27d4eb2du;
+    static constexpr uint32_t PRIME_Y = 0x165667b1u;
+    static constexpr uint32_t PRIME_Z = 0x9e3779b1u;
+    static constexpr uint32_t MIX_A = 0x2c1b3c6du;
+    static constexpr uint32_t MIX_B = 0x297a2d39u;
+    // Decorrelates octaves and the cave noise from the height noise
+    static constexpr uint32_t OCTAVE_SEED = 0x68e31da4u;
+    static constexpr uint32_t CAVE_SEED = 0x5bd1e995u;
+
+    // Hash to a value in [-1, 1), 24 bits are exact in a float
+    static constexpr float HASH_SCALE = 2.0f / 16777216.0f;
+
+    // The SIMD paths below mirror these operation for operation,
+    // so they produce the exact same floats.
+
+    static uint32_t Mix(uint32_t h)
+    {
+        h = (h ^ (h >> 15)) * MIX_A;
+        h = (h ^ (h >> 12)) * MIX_B;
+        return h ^ (h >> 15);
+    }
+
+    static float HashToFloat(uint32_t h)
+    {
+        return float(int32_t(h >> 8)) * HASH_SCALE - 1.0f;
+    }
+
+    static float Fade(float t)
+    {
+        return t * t * (3.0f - 2.0f * t);
+    }
+
+    static float Lerp(float a, float b, float t)
+    {
+        return a + (b - a) * t;
+    }
+
+    static float ValueNoise2(float x, float z, uint32_t seed)
+    {
+        float xf = floorf(x);
+        float zf = floorf(z);
+        float u = Fade(x - xf);
+        float w = Fade(z - zf);
+
+        uint32_t hx0 = uint32_t(int32_t(xf)) * PRIME_X;
+        uint32_t hx1 = hx0 + PRIME_X;
+        uint32_t hz0 = seed + uint32_t(int32_t(zf)) * PRIME_Z;
+        uint32_t hz1 = hz0 + PRIME_Z;
+
+        float c00 = HashToFloat(Mix(hx0 + hz0));
+        float c10 = HashToFloat(Mix(hx1 + hz0));
+        float c01 = HashToFloat(Mix(hx0 + hz1));
+        float c11 = HashToFloat(Mix(hx1 + hz1));
+        return Lerp(Lerp(c00, c10, u), Lerp(c01, c11, u), w);
+    }
+
+    static float ValueNoise3(float x, float y, float z, uint32_t seed)
+    {
+        float xf = floorf(x);
+        float yf = floorf(y);
+        float zf = floorf(z);
+        float u = Fade(x - xf);
+        float v = Fade(y - yf);
+        float w = Fade(z - zf);
+
+        uint32_t hx0 = uint32_t(int32_t(xf)) * PRIME_X;
+        uint32_t hx1 = hx0 + PRIME_X;
+        uint32_t hy0 = uint32_t(int32_t(yf)) * PRIME_Y;
+        uint32_t hy1 = hy0 + PRIME_Y;
+        uint32_t hz0 = seed + uint32_t(int32_t(zf)) * PRIME_Z;
+        uint32_t hz1 = hz0 + PRIME_Z;
+
+        float c000 = HashToFloat(Mix(hx0 + hy0 + hz0));
+        float c100 = HashToFloat(Mix(hx1 + hy0 + hz0));
+        float c010 = HashToFloat(Mix(hx0 + hy1 + hz0));
+        float c110 = HashToFloat(Mix(hx1 + hy1 + hz0));
+        float c001 = HashToFloat(Mix(hx0 + hy0 + hz1));
+        float c101 = HashToFloat(Mix(hx1 + hy0 + hz1));
+        float c011 = HashToFloat(Mix(hx0 + hy1 + hz1));
+        float c111 = HashToFloat(Mix(hx1 + hy1 + hz1));
+
+        float z0 = Lerp(Lerp(c000, c100, u), Lerp(c010, c110, u), v);
+        float z1 = Lerp(Lerp(c001, c101, u), Lerp(c011, c111, u), v);
+        return Lerp(z0, z1, w);
+    }
+
+    void GenerateHeightsScalar(uint32_t seed, int originX, int originZ, int width, float* heights)
+    {
+        for (int z = 0; z < width; z++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                float px = float(originX + x) * TERRAIN_HEIGHT_FREQUENCY;
+                float pz = float(originZ + z) * TERRAIN_HEIGHT_FREQUENCY;
+
+                float sum = 0.0f;
+                float amplitude = 1.0f;
+                float frequency = 1.0f;
+                for (int octave = 0; octave < TERRAIN_HEIGHT_OCTAVES; octave++)
+                {
+                    sum += amplitude * ValueNoise2(px * frequency, pz * frequency, seed + octave * OCTAVE_SEED);
+                    amplitude *= 0.5f;
+                    frequency *= 2.0f;
+                }
+                heights[z * width + x] = TERRAIN_BASE_HEIGHT + TERRAIN_HEIGHT_AMPLITUDE * sum;
+            }
+        }
+    }
+
+    void GenerateLayersScalar(uint32_t seed, int originX, int originZ, int width, const float* heights, int minY,
+                              int maxY, BlobType* types)
+    {
+        uint32_t caveSeed = seed ^ CAVE_SEED;
+
+        for (int y = minY; y < maxY; y++)
+        {
+            for (int z = 0; z < width; z++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    float height = heights[z * width + x];
+                    BlobType type = BlobType::AIR;
+
+                    // The bottom layer is always solid
+                    if (y == 0 || float(y) < height)
+                    {
+                        type = BlobType::GROUND;
+
+                        if (y >= TERRAIN_CAVE_FLOOR && float(y) < height - TERRAIN_CAVE_DEPTH)
+                        {
+                            float px = float(originX + x) * TERRAIN_CAVE_FREQUENCY;
+                            float py = float(y) * TERRAIN_CAVE_FREQUENCY;
+                            float pz = float(originZ + z) * TERRAIN_CAVE_FREQUENCY;
+
+                            float sum = 0.0f;
+                            float amplitude = 1.0f;
+                            float frequency = 1.0f;
+                            for (int octave = 0; octave < TERRAIN_CAVE_OCTAVES; octave++)
+                            {
+                                sum += amplitude * ValueNoise3(px * frequency, py * frequency, pz * frequency,
+                                                               caveSeed + octave * OCTAVE_SEED);
+                                amplitude *= 0.5f;
+                                frequency *= 2.0f;
+                            }
+
+                            if (sum > TERRAIN_CAVE_THRESHOLD)
+                                type = BlobType::AIR;
+                        }
+                    }
+
+                    types[((y - minY) * width + z) * width + x] = type;
+                }
+            }
+        }
+    }
+
+#if BLOBBY_SSE
+    // Writes one type per lane, GROUND where the lane's bit of mask is set
+    static void StoreTypes(BlobType* types, int mask, int lanes)
+    {
+        for (int i = 0; i < lanes; i++)
+        {
+            types[i] = (mask >> i) & 1 ? BlobType::GROUND : BlobType::AIR;
+        }
+    }
+
+    // SSE2 has no 32-bit low multiply, combine two 32x32->64 multiplies of the even and odd lanes
+    static inline __m128i MulSSE(__m128i a, uint32_t b)
+    {
+        __m128i factor = _mm_set1_epi32((int)b);
+        __m128i even = _mm_mul_epu32(a, factor);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), factor);
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                                  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    // Same as floorf, SSE2 only truncates
+    static inline __m128 FloorSSE(__m128 x, __m128i* xi)
+    {
+        __m128i i = _mm_cvttps_epi32(x);
+        __m128 f = _mm_cvtepi32_ps(i);
+        __m128 roundedUp = _mm_cmpgt_ps(f, x);
+        *xi = _mm_add_epi32(i, _mm_castps_si128(roundedUp));
+        return _mm_sub_ps(f, _mm_and_ps(roundedUp, _mm_set1_ps(1.0f)));
+    }
+
+    static inline __m128 HashSSE(__m128i h)
+    {
+        h = MulSSE(_mm_xor_si128(h, _mm_srli_epi32(h, 15)), MIX_A);
+        h = MulSSE(_mm_xor_si128(h, _mm_srli_epi32(h, 12)), MIX_B);
+        h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+        __m128 value = _mm_cvtepi32_ps(_mm_srli_epi32(h, 8));
+        return _mm_sub_ps(_mm_mul_ps(value, _mm_set1_ps(HASH_SCALE)), _mm_set1_ps(1.0f));
+    }
+
+    static inline __m128 FadeSSE(__m128 t)
+    {
+        return _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), t)));
+    }
+
+    static inline __m128 LerpSSE(__m128 a, __m128 b, __m128 t)
+    {
+        return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+    }
+
+    static __m128 ValueNoise2SSE(__m128 x, __m128 z, uint32_t seed)
+    {
+        __m128i xi, zi;
+        __m128 xf = FloorSSE(x, &xi);
+        __m128 zf = FloorSSE(z, &zi);
+        __m128 u = FadeSSE(_mm_sub_ps(x, xf));
+        __m128 w = FadeSSE(_mm_sub_ps(z, zf));
+
+        __m128i hx0 = MulSSE(xi, PRIME_X);
+        __m128i hx1 = _mm_add_epi32(hx0, _mm_set1_epi32((int)PRIME_X));
+        __m128i hz0 = _mm_add_epi32(_mm_set1_epi32((int)seed), MulSSE(zi, PRIME_Z));
+        __m128i hz1 = _mm_add_epi32(hz0, _mm_set1_epi32((int)PRIME_Z));
+
+        __m128 c00 = HashSSE(_mm_add_epi32(hx0, hz0));
+        __m128 c10 = HashSSE(_mm_add_epi32(hx1, hz0));
+        __m128 c01 = HashSSE(_mm_add_epi32(hx0, hz1));
+        __m128 c11 = HashSSE(_mm_add_epi32(hx1, hz1));
+        return LerpSSE(LerpSSE(c00, c10, u), LerpSSE(c01, c11, u), w);
+    }
+
+    static __m128 ValueNoise3SSE(__m128 x, __m128 y, __m128 z, uint32_t seed)
+    {
+        __m128i xi, yi, zi;
+        __m128 xf = FloorSSE(x, &xi);
+        __m128 yf = FloorSSE(y, &yi);
+        __m128 zf = FloorSSE(z, &zi);
+        __m128 u = FadeSSE(_mm_sub_ps(x, xf));
+        __m128 v = FadeSSE(_mm_sub_ps(y, yf));
+        __m128 w = FadeSSE(_mm_sub_ps(z, zf));
+
+        __m128i hx0 = MulSSE(xi, PRIME_X);
+        __m128i hx1 = _mm_add_epi32(hx0, _mm_set1_epi32((int)PRIME_X));
+        __m128i hy0 = MulSSE(yi, PRIME_Y);
+        __m128i hy1 = _mm_add_epi32(hy0, _mm_set1_epi32((int)PRIME_Y));
+        __m128i hz0 = _mm_add_epi32(_mm_set1_epi32((int)seed), MulSSE(zi, PRIME_Z));
+        __m128i hz1 = _mm_add_epi32(hz0, _mm_set1_epi32((int)PRIME_Z));
+
+        __m128i h00 = _mm_add_epi32(hy0, hz0);
+        __m128i h10 = _mm_add_epi32(hy1, hz0);
+        __m128i h01 = _mm_add_epi32(hy0, hz1);
+        __m128i h11 = _mm_add_epi32(hy1, hz1);
+
+        __m128 c000 = HashSSE(_mm_add_epi32(hx0, h00));
+        __m128 c100 = HashSSE(_mm_add_epi32(hx1, h00));
+        __m128 c010 = HashSSE(_mm_add_epi32(hx0, h10));
+        __m128 c110 = HashSSE(_mm_add_epi32(hx1, h10));
+        __m128 c001 = HashSSE(_mm_add_epi32(hx0, h01));
+        __m128 c101 = HashSSE(_mm_add_epi32(hx1, h01));
+        __m128 c011 = HashSSE(_mm_add_epi32(hx0, h11));
+        __m128 c111 = HashSSE(_mm_add_epi32(hx1, h11));
+
+        __m128 z0 = LerpSSE(LerpSSE(c000, c100, u), LerpSSE(c010, c110, u), v);
+        __m128 z1 = LerpSSE(LerpSSE(c001, c101, u), LerpSSE(c011, c111, u), v);
+        return LerpSSE(z0, z1, w);
+    }
+
+    // Cell coordinates of 4 consecutive cells starting at x
+    static inline __m128 RowSSE(int x)
+    {
+        return _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3)));
+    }
+
+    static void GenerateHeightsSSE(uint32_t seed, int originX, int originZ, int width, float* heights)
+    {
+        for (int z = 0; z < width; z++)
+        {
+            __m128 pz = _mm_mul_ps(_mm_set1_ps(float(originZ + z)), _mm_set1_ps(TERRAIN_HEIGHT_FREQUENCY));
+            for (int x = 0; x < width; x += 4)
+            {
+                __m128 px = _mm_mul_ps(RowSSE(originX + x), _mm_set1_ps(TERRAIN_HEIGHT_FREQUENCY));
+
+                __m128 sum = _mm_setzero_ps();
+                float amplitude = 1.0f;
+                float frequency = 1.0f;
+                for (int octave = 0; octave < TERRAIN_HEIGHT_OCTAVES; octave++)
+                {
+                    __m128 f = _mm_set1_ps(frequency);
+                    __m128 noise = ValueNoise2SSE(_mm_mul_ps(px, f), _mm_mul_ps(pz, f), seed + octave * OCTAVE_SEED);
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amplitude), noise));
+                    amplitude *= 0.5f;
+                    frequency *= 2.0f;
+                }
+
+                __m128 height = _mm_mul_ps(_mm_set1_ps(TERRAIN_HEIGHT_AMPLITUDE), sum);
+                _mm_storeu_ps(&heights[z * width + x], _mm_add_ps(_mm_set1_ps(TERRAIN_BASE_HEIGHT), height));
+            }
+        }
+    }
+
+    static void GenerateLayersSSE(uint32_t seed, int originX, int originZ, int width, const float* heights, int minY,
+                                  int maxY, BlobType* types)
+    {
+        uint32_t caveSeed = seed ^ CAVE_SEED;
+
+        for (int y = minY; y < maxY; y++)
+        {
+            __m128 cellY = _mm_set1_ps(float(y));
+            __m128 py = _mm_mul_ps(cellY, _mm_set1_ps(TERRAIN_CAVE_FREQUENCY));
+
+            for (int z = 0; z < width; z++)
+            {
+                __m128 pz = _mm_mul_ps(_mm_set1_ps(float(originZ + z)), _mm_set1_ps(TERRAIN_CAVE_FREQUENCY));
+                BlobType* row = &types[((y - minY) * width + z) * width];
+
+                for (int x = 0; x < width; x += 4)
+                {
+                    __m128 height = _mm_loadu_ps(&heights[z * width + x]);
+                    int solid = y == 0 ? 0xF : _mm_movemask_ps(_mm_cmplt_ps(cellY, height));
+
+                    // Most rows are all air or all ground without caves
+                    int caves = 0;
+                    if (solid != 0 && y >= TERRAIN_CAVE_FLOOR)
+                    {
+                        __m128 caveTop = _mm_sub_ps(height, _mm_set1_ps(TERRAIN_CAVE_DEPTH));
+                        caves = _mm_movemask_ps(_mm_cmplt_ps(cellY, caveTop));
+                    }
+
+                    if (caves != 0)
+                    {
+                        __m128 px = _mm_mul_ps(RowSSE(originX + x), _mm_set1_ps(TERRAIN_CAVE_FREQUENCY));
+
+                        __m128 sum = _mm_setzero_ps();
+                        float amplitude = 1.0f;
+                        float frequency = 1.0f;
+                        for (int octave = 0; octave < TERRAIN_CAVE_OCTAVES; octave++)
+                        {
+                            __m128 f = _mm_set1_ps(frequency);
+                            __m128 noise = ValueNoise3SSE(_mm_mul_ps(px, f), _mm_mul_ps(py, f), _mm_mul_ps(pz, f),
+                                                          caveSeed + octave * OCTAVE_SEED);
+                            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amplitude), noise));
+                            amplitude *= 0.5f;
+                            frequency *= 2.0f;
+                        }
+
+                        caves &= _mm_movemask_ps(_mm_cmpgt_ps(sum, _mm_set1_ps(TERRAIN_CAVE_THRESHOLD)));
+                    }
+
+                    StoreTypes(&row[x], solid & ~caves, 4);
+                }
+            }
+        }
+    }
+
+    BLOBBY_TARGET_AVX2 static inline __m256i MulAVX2(__m256i a, uint32_t b)
+    {
+        return _mm256_mullo_epi32(a, _mm256_set1_epi32((int)b));
+    }
+
+    BLOBBY_TARGET_AVX2 static inline __m256 FloorAVX2(__m256 x, __m256i* xi)
+    {
+        __m256 f = _mm256_round_ps(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        *xi = _mm256_cvttps_epi32(f);
+        return f;
+    }
+
+    BLOBBY_TARGET_AVX2 static inline __m256 HashAVX2(__m256i h)
+    {
+        h = MulAVX2(_mm256_xor_si256(h, _mm256_srli_epi32(h, 15)), MIX_A);
+        h = MulAVX2(_mm256_xor_si256(h, _mm256_srli_epi32(h, 12)), MIX_B);
+        h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+        __m256 value = _mm256_cvtepi32_ps(_mm256_srli_epi32(h, 8));
+        return _mm256_sub_ps(_mm256_mul_ps(value, _mm256_set1_ps(HASH_SCALE)), _mm256_set1_ps(1.0f));
+    }
+
+    BLOBBY_TARGET_AVX2 static inline __m256 FadeAVX2(__m256 t)
+    {
+        return _mm256_mul_ps(_mm256_mul_ps(t, t),
+                             _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_set1_ps(2.0f), t)));
+    }
+
+    BLOBBY_TARGET_AVX2 static inline __m256 LerpAVX2(__m256 a, __m256 b, __m256 t)
+    {
+        return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+    }
+
+    BLOBBY_TARGET_AVX2 static __m256 ValueNoise2AVX2(__m256 x, __m256 z, uint32_t seed)
+    {
+        __m256i xi, zi;
+        __m256 xf = FloorAVX2(x, &xi);
+        __m256 zf = FloorAVX2(z, &zi);
+        __m256 u = FadeAVX2(_mm256_sub_ps(x, xf));
+        __m256 w = FadeAVX2(_mm256_sub_ps(z, zf));
+
+        __m256i hx0 = MulAVX2(xi, PRIME_X);
+        __m256i hx1 = _mm256_add_epi32(hx0, _mm256_set1_epi32((int)PRIME_X));
+        __m256i hz0 = _mm256_add_epi32(_mm256_set1_epi32((int)seed), MulAVX2(zi, PRIME_Z));
+        __m256i hz1 = _mm256_add_epi32(hz0, _mm256_set1_epi32((int)PRIME_Z));
+
+        __m256 c00 = HashAVX2(_mm256_add_epi32(hx0, hz0));
+        __m256 c10 = HashAVX2(_mm256_add_epi32(hx1, hz0));
+        __m256 c01 = HashAVX2(_mm256_add_epi32(hx0, hz1));
+        __m256 c11 = HashAVX2(_mm256_add_epi32(hx1, hz1));
+        return LerpAVX2(LerpAVX2(c00, c10, u), LerpAVX2(c01, c11, u), w);
+    }
+
+    BLOBBY_TARGET_AVX2 static __m256 ValueNoise3AVX2(__m256 x, __m256 y, __m256 z, uint32_t seed)
+    {
+        __m256i xi, yi, zi;
+        __m256 xf = FloorAVX2(x, &xi);
+        __m256 yf = FloorAVX2(y, &yi);
+        __m256 zf = FloorAVX2(z, &zi);
+        __m256 u = FadeAVX2(_mm256_sub_ps(x, xf));
+        __m256 v = FadeAVX2(_mm256_sub_ps(y, yf));
+        __m256 w = FadeAVX2(_mm256_sub_ps(z, zf));
+
+        __m256i hx0 = MulAVX2(xi, PRIME_X);
+        __m256i hx1 = _mm256_add_epi32(hx0, _mm256_set1_epi32((int)PRIME_X));
+        __m256i hy0 = MulAVX2(yi, PRIME_Y);
+        __m256i hy1 = _mm256_add_epi32(hy0, _mm256_set1_epi32((int)PRIME_Y));
+        __m256i hz0 = _mm256_add_epi32(_mm256_set1_epi32((int)seed), MulAVX2(zi, PRIME_Z));
+        __m256i hz1 = _mm256_add_epi32(hz0, _mm256_set1_epi32((int)PRIME_Z));
+
+        __m256i h00 = _mm256_add_epi32(hy0, hz0);
+        __m256i h10 = _mm256_add_epi32(hy1, hz0);
+        __m256i h01 = _mm256_add_epi32(hy0, hz1);
+        __m256i h11 = _mm256_add_epi32(hy1, hz1);
+
+        __m256 c000 = HashAVX2(_mm256_add_epi32(hx0, h00));
+        __m256 c100 = HashAVX2(_mm256_add_epi32(hx1, h00));
+        __m256 c010 = HashAVX2(_mm256_add_epi32(hx0, h10));
+        __m256 c110 = HashAVX2(_mm256_add_epi32(hx1, h10));
+        __m256 c001 = HashAVX2(_mm256_add_epi32(hx0, h01));
+        __m256 c101 = HashAVX2(_mm256_add_epi32(hx1, h01));
+        __m256 c011 = HashAVX2(_mm256_add_epi32(hx0, h11));
+        __m256 c111 = HashAVX2(_mm256_add_epi32(hx1, h11));
+
+        __m256 z0 = LerpAVX2(LerpAVX2(c000, c100, u), LerpAVX2(c010, c110, u), v);
+        __m256 z1 = LerpAVX2(LerpAVX2(c001, c101, u), LerpAVX2(c011, c111, u), v);
+        return LerpAVX2(z0, z1, w);
+    }
+
+    BLOBBY_TARGET_AVX2 static inline __m256 RowAVX2(int x)
+    {
+        return _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+    }
+
+    BLOBBY_TARGET_AVX2 static void GenerateHeightsAVX2(uint32_t seed, int originX, int originZ, int width,
+                                                       float* heights)
+    {
+        for (int z = 0; z < width; z++)
+        {
+            __m256 pz = _mm256_mul_ps(_mm256_set1_ps(float(originZ + z)), _mm256_set1_ps(TERRAIN_HEIGHT_FREQUENCY));
+            for (int x = 0; x < width; x += 8)
+            {
+                __m256 px = _mm256_mul_ps(RowAVX2(originX + x), _mm256_set1_ps(TERRAIN_HEIGHT_FREQUENCY));
+
+                __m256 sum = _mm256_setzero_ps();
+                float amplitude = 1.0f;
+                float frequency = 1.0f;
+                for (int octave = 0; octave < TERRAIN_HEIGHT_OCTAVES; octave++)
+                {
+                    __m256 f = _mm256_set1_ps(frequency);
+                    __m256 noise =
+                        ValueNoise2AVX2(_mm256_mul_ps(px, f), _mm256_mul_ps(pz, f), seed + octave * OCTAVE_SEED);
+                    sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(amplitude), noise));
+                    amplitude *= 0.5f;
+                    frequency *= 2.0f;
+                }
+
+                __m256 height = _mm256_mul_ps(_mm256_set1_ps(TERRAIN_HEIGHT_AMPLITUDE), sum);
+                _mm256_storeu_ps(&heights[z * width + x], _mm256_add_ps(_mm256_set1_ps(TERRAIN_BASE_HEIGHT), height));
+            }
+        }
+    }
+
+    BLOBBY_TARGET_AVX2 static void GenerateLayersAVX2(uint32_t seed, int originX, int originZ, int width,
+                                                      const float* heights, int minY, int maxY, BlobType* types)
+    {
+        uint32_t caveSeed = seed ^ CAVE_SEED;
+
+        for (int y = minY; y < maxY; y++)
+        {
+            __m256 cellY = _mm256_set1_ps(float(y));
+            __m256 py = _mm256_mul_ps(cellY, _mm256_set1_ps(TERRAIN_CAVE_FREQUENCY));
+
+            for (int z = 0; z < width; z++)
+            {
+                __m256 pz = _mm256_mul_ps(_mm256_set1_ps(float(originZ + z)), _mm256_set1_ps(TERRAIN_CAVE_FREQUENCY));
+                BlobType* row = &types[((y - minY) * width + z) * width];
+
+                for (int x = 0; x < width; x += 8)
+                {
+                    __m256 height = _mm256_loadu_ps(&heights[z * width + x]);
+                    int solid = y == 0 ? 0xFF : _mm256_movemask_ps(_mm256_cmp_ps(cellY, height, _CMP_LT_OQ));
+
+                    // Most rows are all air or all ground without caves
+                    int caves = 0;
+                    if (solid != 0 && y >= TERRAIN_CAVE_FLOOR)
+                    {
+                        __m256 caveTop = _mm256_sub_ps(height, _mm256_set1_ps(TERRAIN_CAVE_DEPTH));
+                        caves = _mm256_movemask_ps(_mm256_cmp_ps(cellY, caveTop, _CMP_LT_OQ));
+                    }
+
+                    if (caves != 0)
+                    {
+                        __m256 px = _mm256_mul_ps(RowAVX2(originX + x), _mm256_set1_ps(TERRAIN_CAVE_FREQUENCY));
+
+                        __m256 sum = _mm256_setzero_ps();
+                        float amplitude = 1.0f;
+                        float frequency = 1.0f;
+                        for (int octave = 0; octave < TERRAIN_CAVE_OCTAVES; octave++)
+                        {
+                            __m256 f = _mm256_set1_ps(frequency);
+                            __m256 noise =
+                                ValueNoise3AVX2(_mm256_mul_ps(px, f), _mm256_mul_ps(py, f), _mm256_mul_ps(pz, f),
+                                                caveSeed + octave * OCTAVE_SEED);
+                            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(amplitude), noise));
+                            amplitude *= 0.5f;
+                            frequency *= 2.0f;
+                        }
+
+                        caves &= _mm256_movemask_ps(_mm256_cmp_ps(sum, _mm256_set1_ps(TERRAIN_CAVE_THRESHOLD),
+                                                                  _CMP_GT_OQ));
+                    }
+
+                    StoreTypes(&row[x], solid & ~caves, 8);
+                }
+            }
+        }
+    }
+#endif
+
+    void GenerateHeights(uint32_t seed, int originX, int originZ, int width, float* heights)
+    {
+#if BLOBBY_SSE
+        if (width % 8 == 0)
+        {
+            if (HasAVX2())
+                GenerateHeightsAVX2(seed, originX, originZ, width, heights);
+            else
+                GenerateHeightsSSE(seed, originX, originZ, width, heights);
+            return;
+        }
+#endif
+        GenerateHeightsScalar(seed, originX, originZ, width, heights);
+    }
+
+    void GenerateLayers(uint32_t seed, int originX, int originZ, int width, const float* heights, int minY,
+                        int maxY, BlobType* types)
+    {
+#if BLOBBY_SSE
+        if (width % 8 == 0)
+        {
+            if (HasAVX2())
+                GenerateLayersAVX2(seed, originX, originZ, width, heights, minY, maxY, types);
+            else
+                GenerateLayersSSE(seed, originX, originZ, width, heights, minY, maxY, types);
+            return;
+        }
+#endif
+        GenerateLayersScalar(seed, originX, originZ, width, heights, minY, maxY, types);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#include "blob.h"
+
+// Surface height in cells, fBm of 2D value noise
+#define TERRAIN_BASE_HEIGHT 32.0f
+#define TERRAIN_HEIGHT_AMPLITUDE 24.0f
+#define TERRAIN_HEIGHT_FREQUENCY (1.0f / 128.0f)
+#define TERRAIN_HEIGHT_OCTAVES 5
+
+// Caves, cells where fBm of 3D value noise is above the threshold are hollowed out.
+// They stay a few cells below the surface and above the bottom of the world.
+#define TERRAIN_CAVE_FREQUENCY (1.0f / 32.0f)
+#define TERRAIN_CAVE_OCTAVES 2
+#define TERRAIN_CAVE_THRESHOLD 0.35f
+#define TERRAIN_CAVE_DEPTH 4.0f
+#define TERRAIN_CAVE_FLOOR 2
+
+namespace blobby
+{
+    // Procedural terrain, deterministic for a seed. Cells are evaluated a row at a time
+    // with the widest SIMD the CPU supports, results are identical to the scalar versions.
+
+    // Surface height of width x width columns starting at originX, originZ, indexed z * width + x
+    void GenerateHeights(uint32_t seed, int originX, int originZ, int width, float* heights);
+    void GenerateHeightsScalar(uint32_t seed, int originX, int originZ, int width, float* heights);
+
+    // Types of the layers [minY, maxY) of width x width columns, with heights from GenerateHeights.
+    // Cells are indexed ((y - minY) * width + z) * width + x.
+    void GenerateLayers(uint32_t seed, int originX, int originZ, int width, const float* heights, int minY,
+                        int maxY, BlobType* types);
+    void GenerateLayersScalar(uint32_t seed, int originX, int originZ, int width, const float* heights, int minY,
+                              int maxY, BlobType* types);
+}
@@ -1,73 +1,182 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <bx/math.h>
+#include <bx/timer.h>
 
 #include "blob.h"
 #include "constants.h"
+#include "lod-builder.h"
+#include "profiler.h"
+#include "surface-builder.h"
+#include "terrain-noise.h"
 #include "terrain.h"
 
 namespace blobby
 {
-    Terrain::Terrain(int seed)
+    Terrain::Terrain(int seed, JobSystem* jobs, bool hugePages) : m_chunkPool(sizeof(Chunk), hugePages)
     {
         printf("Terrain seed: %d\n", seed);
-        m_seed = seed;
-        m_chunks = std::vector<Chunk>();
-        m_visibleBlobs = std::vector<Blob*>();
-
-        // TEST
-        LoadChunk(0, 0);
+        m_seed = (uint32_t)seed;
+        m_jobs = jobs;
+        m_visibleBlobs = std::vector<Blob>();
+        m_storage = std::make_unique<RegionStorage>("saves/world-" + std::to_string(seed));
+        m_statsWindowStart = bx::getHPCounter();
     }
 
     Terrain::~Terrain()
     {
+        // Stop streaming before saving, queued loads are skipped
+        // and queued saves are finished.
+        m_streaming = false;
+        m_jobs->WaitIdle();
         Save();
     }
 
-    Blob* Terrain::GetBlob(int blobX, int blobY, int blobZ)
+    bool Terrain::SetBlob(int blobX, int blobY, int blobZ, BlobType type)
     {
-        Blob* blob = nullptr;
-        int chunkX = blobX / CHUNK_SIZE;
-        int chunkZ = blobZ / CHUNK_SIZE;
+        if (blobY < 0 || blobY >= MAX_HEIGHT)
+            return false;
+
+        int chunkX = ChunkCoord(blobX);
+        int chunkZ = ChunkCoord(blobZ);
+        Chunk* chunk = GetChunk(chunkX, chunkZ);
+        if (!chunk)
+            return false;
+
+        int localX = blobX - chunkX * CHUNK_SIZE;
+        int localZ = blobZ - chunkZ * CHUNK_SIZE;
+        int index = (CHUNK_SIZE * CHUNK_SIZE * blobY) + (CHUNK_SIZE * localZ) + localX;
+        if (chunk->blobs[index] != type)
+        {
+            chunk->blobs[index] = type;
+            m_editedCells[ChunkKey(chunkX, chunkZ)].push_back(index);
+        }
+        return true;
+    }
+
+    int Terrain::ApplyEdit(const TerrainEdit& edit)
+    {
+        int minX = (int)ceilf(edit.center.x - edit.radius);
+        int minY = std::max(0, (int)ceilf(edit.center.y - edit.radius));
+        int minZ = (int)ceilf(edit.center.z - edit.radius);
+        int maxX = (int)floorf(edit.center.x + edit.radius);
+        int maxY = std::min(MAX_HEIGHT - 1, (int)floorf(edit.center.y + edit.radius));
+        int maxZ = (int)floorf(edit.center.z + edit.radius);
+
+        int changed = 0;
+        for (int z = minZ; z <= maxZ; z++)
+        {
+            for (int y = minY; y <= maxY; y++)
+            {
+                for (int x = minX; x <= maxX; x++)
+                {
+                    Vec3 d = {x - edit.center.x, y - edit.center.y, z - edit.center.z};
+                    if (lengthSquared(d) > edit.radius * edit.radius)
+                        continue;
+
+                    Blob blob;
+                    if (GetBlob(x, y, z, &blob) && blob.Type != edit.type)
+                    {
+                        SetBlob(x, y, z, edit.type);
+                        changed++;
+                    }
+                }
+            }
+        }
+        return changed;
+    }
+
+    bool Terrain::GetBlob(int blobX, int blobY, int blobZ, Blob* blob)
+    {
+        if (blobY < 0 || blobY >= MAX_HEIGHT)
+            return false;
+
+        int chunkX = ChunkCoord(blobX);
+        int chunkZ = ChunkCoord(blobZ);
         Chunk* chunk = GetChunk(chunkX, chunkZ);
         if (chunk)
         {
-            int index = (CHUNK_SIZE * CHUNK_SIZE * blobY) + (CHUNK_SIZE * (blobZ % CHUNK_SIZE)) + blobX % CHUNK_SIZE;
-            return &chunk->blobs[index];
+            int localX = blobX - chunkX * CHUNK_SIZE;
+            int localZ = blobZ - chunkZ * CHUNK_SIZE;
+            int index = (CHUNK_SIZE * CHUNK_SIZE * blobY) + (CHUNK_SIZE * localZ) + localX;
+            *blob = chunk->GetBlob(0, index);
+            return true;
         }
 
-        return blob;
+        return false;
     }
 
     Chunk* Terrain::GetChunk(int chunkX, int chunkZ)
     {
-        for (int i = 0; i < m_chunks.size(); i++)
+        auto it = m_chunks.find(ChunkKey(chunkX, chunkZ));
+        if (it != m_chunks.end())
         {
-            if (m_chunks[i].chunkX == chunkX && m_chunks[i].chunkZ == chunkZ)
-            {
-                return &m_chunks[i];
-            }
+            return it->second.get();
         }
         return nullptr;
     }
 
     void Terrain::Save()
     {
-        for (Chunk chunk : m_chunks)
+        int64_t start = bx::getHPCounter();
+
+        for (const auto& [key, chunk] : m_chunks)
         {
-            SaveChunk(chunk);
+            SaveChunk(chunk.get());
         }
+        m_storage->Flush();
+
+        m_stats.lastSaveMs = float((bx::getHPCounter() - start) / double(bx::getHPFrequency()) * 1000.0);
+        m_stats.chunksSaved = m_chunksSaved;
+        printf("Saved terrain in %.2f ms\n", m_stats.lastSaveMs);
     }
 
     void Terrain::Update(Context* context, float projMatrix[16])
     {
-        // TODO
-        // frustrum cull chunks
-        // load visible chunks
-        // unload hidden chunks
-
-        m_visibleBlobs.clear();
-
-        for (std::vector<Chunk>::iterator chunk = m_chunks.begin(); chunk != m_chunks.end();)
+        PROFILE_SCOPE("Terrain::Update");
+
+        m_frame++;
+        m_changed = false;
+        FlushEdits();
+        UpdateStreaming(context);
+
+        float view[16];
+        float viewProj[16];
+        bx::mtxInverse(view, context->camTransform);
+        bx::mtxMul(viewProj, view, projMatrix);
+        m_frustum.Extract(viewProj);
+
+        // Blobs affect the surface a bit beyond their radius
+        // through smoothing and the wave in the shader.
+        const float margin = SMOOTHNESS + WAVE_AMPLITUDE;
+
+        m_stats.visibleChunks = 0;
+        m_stats.frustumCulledChunks = 0;
+        m_stats.frustumCulledBlobs = 0;
+        m_stats.buriedBlobs = 0;
+        m_stats.occlusionCulledChunks = 0;
+        m_stats.occlusionCulledBlobs = 0;
+
+        m_cullChunks.clear();
+        for (const auto& [key, chunk] : m_chunks)
         {
+            Vec3 min = chunk->Min();
+            Vec3 max = chunk->Max();
+            FrustumResult chunkResult = m_frustum.TestAABB({min.x - margin, min.y - margin, min.z - margin},
+                                                           {max.x + margin, max.y + margin, max.z + margin});
+            if (chunkResult == OUTSIDE)
+            {
+                m_stats.frustumCulledChunks++;
+                continue;
+            }
+            m_stats.visibleChunks++;
+            chunk->lastUsedFrame = m_frame;
+
             // Select LOD based on distance
             int lodLevel = 0;
             float chunkDistance = chunk->Distance(context->camPosition);
@@ -81,184 +190,738 @@ namespace blobby
             else if (chunkDistance > FAR_PLANE * 0.2f)
                 lodLevel = 1;
 
-            int blobCount = BLOBS_IN_CHUNK / pow(8, lodLevel);
-            Blob* blobArrays[] = {
-                chunk->blobs, chunk->lod1Blobs, chunk->lod2Blobs, chunk->lod3Blobs, chunk->lod4Blobs,
-            };
-            Blob* blobs = blobArrays[lodLevel];
+            // Blobs of chunks fully inside the frustum don't need testing
+            m_cullChunks.push_back(
+                {chunk.get(), lodLevel, chunkDistance, chunkResult == INTERSECTS && context->frustumCullBlobs});
+        }
+
+        // Occluders are drawn while the brick map is updated
+        m_occlusionCulling = context->occlusionCulling;
+        m_occlusion.Begin(viewProj, context->camPosition);
+        JobHandle occlusion = RasterizeOccluders();
+
+        if (m_brickMap.Update(this, context->camPosition, context->brickBudgetMs) > 0)
+            m_changed = true;
+        m_stats.idle = !m_changed;
+
+        m_jobs->Wait(occlusion);
+        if (m_occlusionCulling)
+            m_occlusion.FinishPyramid();
+
+        m_cullParams.camera = context->camPosition;
+        m_cullParams.maxDistance = FAR_PLANE;
+        m_cullParams.frustumMargin = margin;
+
+        int batchCount = ((int)m_cullChunks.size() + CULL_CHUNKS_PER_JOB - 1) / CULL_CHUNKS_PER_JOB;
+        if ((int)m_cullBatches.size() < batchCount)
+            m_cullBatches.resize(batchCount);
+
+        JobHandle cull = m_jobs->CreateGroup();
+        for (int i = 0; i < batchCount; i++)
+        {
+            CullBatch* batch = &m_cullBatches[i];
+            batch->firstChunk = i * CULL_CHUNKS_PER_JOB;
+            batch->chunkCount = std::min(CULL_CHUNKS_PER_JOB, (int)m_cullChunks.size() - batch->firstChunk);
+            m_jobs->Run(m_jobs->Create([this, batch]() { CullChunks(batch); }, cull));
+        }
+        m_jobs->Run(cull);
+        m_jobs->Wait(cull);
+
+        int surfaceBlobs = 0;
+        m_visibleBlobs.clear();
+        for (int i = 0; i < batchCount; i++)
+        {
+            const CullBatch& batch = m_cullBatches[i];
+            m_visibleBlobs.insert(m_visibleBlobs.end(), batch.blobs.begin(), batch.blobs.end());
+            m_stats.frustumCulledBlobs += batch.frustumCulledBlobs;
+            m_stats.buriedBlobs += batch.buriedBlobs;
+            m_stats.occlusionCulledChunks += batch.occlusionCulledChunks;
+            m_stats.occlusionCulledBlobs += batch.occlusionCulledBlobs;
+            surfaceBlobs += batch.surfaceBlobs;
+        }
+
+        m_stats.visibleBlobs = (int)m_visibleBlobs.size();
+
+        m_occlusionCulledBlobsTotal += m_stats.occlusionCulledBlobs;
+        m_surfaceBlobsTotal += surfaceBlobs;
+        m_stats.occlusionCullRate = surfaceBlobs > 0 ? float(m_stats.occlusionCulledBlobs) / surfaceBlobs : 0.0f;
+        m_stats.averageOcclusionCullRate =
+            m_surfaceBlobsTotal > 0 ? float(double(m_occlusionCulledBlobsTotal) / m_surfaceBlobsTotal) : 0.0f;
+        m_stats.occlusionRasterMs = float(m_occlusionTicks.exchange(0) / double(bx::getHPFrequency()) * 1000.0);
+    }
+
+    JobHandle Terrain::RasterizeOccluders()
+    {
+        PROFILE_SCOPE("Terrain::RasterizeOccluders");
+
+        m_stats.occluders = 0;
+        if (!m_occlusionCulling)
+            return {};
 
-            // Check and add blobs from selected LOD
-            for (int j = 0; j < blobCount; j++)
+        m_occluderChunks.clear();
+        for (int i = 0; i < (int)m_cullChunks.size(); i++)
+        {
+            if (m_cullChunks[i].distance < OCCLUSION_OCCLUDER_DISTANCE)
+                m_occluderChunks.push_back(i);
+        }
+        std::sort(m_occluderChunks.begin(), m_occluderChunks.end(),
+                  [this](int a, int b) { return m_cullChunks[a].distance < m_cullChunks[b].distance; });
+
+        // Occluders of the LOD level being rendered, shrunk by the test wave which moves blobs up and down
+        for (int i : m_occluderChunks)
+        {
+            const CullChunk& cull = m_cullChunks[i];
+            const Chunk* chunk = cull.chunk;
+            float baseX = chunk->chunkX * CHUNK_SIZE - 0.5f;
+            float baseZ = chunk->chunkZ * CHUNK_SIZE - 0.5f;
+
+            for (int j = 0; j < chunk->occluderCount[cull.lodLevel]; j++)
             {
-                // Distance cull
-                if (distance(blobs[j].Position, context->camPosition) > FAR_PLANE + blobs[j].Radius)
-                    continue;
+                const CellBox& box = chunk->occluders[cull.lodLevel][j];
+                m_occlusion.AddOccluder({baseX + box.minX, box.minY - 0.5f + WAVE_AMPLITUDE, baseZ + box.minZ},
+                                        {baseX + box.maxX, box.maxY - 0.5f - WAVE_AMPLITUDE, baseZ + box.maxZ});
+            }
+        }
+        m_stats.occluders = m_occlusion.GetOccluderCount();
+
+        JobHandle occlusion = m_jobs->CreateGroup();
+        for (int band = 0; band < OCCLUSION_BANDS; band++)
+        {
+            m_jobs->Run(m_jobs->Create(
+                [this, band]() {
+                    int64_t start = bx::getHPCounter();
+                    m_occlusion.RasterizeBand(band);
+                    m_occlusionTicks += bx::getHPCounter() - start;
+                },
+                occlusion));
+        }
+        m_jobs->Run(occlusion);
+        return occlusion;
+    }
+
+    // Runs in a job, must only write to the batch
+    void Terrain::CullChunks(CullBatch* batch)
+    {
+        PROFILE_SCOPE("Terrain::CullChunks");
+
+        // Capacity is kept between frames like m_visibleBlobs
+        batch->blobs.clear();
+        batch->indices.resize(BLOBS_IN_CHUNK);
+        batch->surface.resize(LodSurfaceOffset(1));
+        batch->frustumCulledBlobs = 0;
+        batch->buriedBlobs = 0;
+        batch->surfaceBlobs = 0;
+        batch->occlusionCulledChunks = 0;
+        batch->occlusionCulledBlobs = 0;
+
+        const float margin = m_cullParams.frustumMargin;
+
+        for (int i = batch->firstChunk; i < batch->firstChunk + batch->chunkCount; i++)
+        {
+            const CullChunk& cull = m_cullChunks[i];
+            Chunk* chunk = cull.chunk;
+            int lodLevel = cull.lodLevel;
+
+            BlobCullParams params = m_cullParams;
+            params.frustum = cull.intersects ? &m_frustum : nullptr;
+
+            batch->buriedBlobs += chunk->solidCount[lodLevel] - chunk->surfaceCount[lodLevel];
+            batch->surfaceBlobs += chunk->surfaceCount[lodLevel];
 
-                // Cull empty air
-                if (blobs[j].Type == BlobType::AIR)
+            const uint64_t* surface = chunk->Surface(lodLevel);
+            uint32_t sections = chunk->surfaceSections[lodLevel];
+            if (m_occlusionCulling && sections != 0)
+            {
+                // Bounds of the surface cells of all sections, then of each section on its own
+                const CellBox* bounds = chunk->sectionBounds[lodLevel];
+                CellBox all = bounds[std::countr_zero(sections)];
+                for (int section = 0; section < CHUNK_SECTIONS; section++)
+                {
+                    if (((sections >> section) & 1) == 0)
+                        continue;
+
+                    all = {std::min(all.minX, bounds[section].minX), all.minY,
+                           std::min(all.minZ, bounds[section].minZ), std::max(all.maxX, bounds[section].maxX),
+                           bounds[section].maxY, std::max(all.maxZ, bounds[section].maxZ)};
+                }
+
+                if (IsOccluded(chunk, all, margin))
+                {
+                    batch->occlusionCulledChunks++;
+                    batch->occlusionCulledBlobs += chunk->surfaceCount[lodLevel];
                     continue;
+                }
 
-                // TODO: frustrum cull blobs? might be slower with already frustrum culled chunks
-                // TODO: occlusion cull blobs
-                // TODO: pre-calc pixel bounds for blobs and
-                // only check blobs near current pixel in fragment shader
+                int sectionCells = LodBlobCount(lodLevel) / CHUNK_SECTIONS;
+                for (int section = 0; section < CHUNK_SECTIONS && std::popcount(sections) > 1; section++)
+                {
+                    if (((sections >> section) & 1) == 0 || !IsOccluded(chunk, bounds[section], margin))
+                        continue;
 
-                m_visibleBlobs.push_back(&blobs[j]);
+                    if (surface != batch->surface.data())
+                    {
+                        memcpy(batch->surface.data(), surface,
+                               (LodSurfaceOffset(lodLevel + 1) - LodSurfaceOffset(lodLevel)) * sizeof(uint64_t));
+                        surface = batch->surface.data();
+                    }
+                    batch->occlusionCulledBlobs += CountSurfaceRange(surface, section * sectionCells, sectionCells);
+                    ClearSurfaceRange(batch->surface.data(), section * sectionCells, sectionCells);
+                }
+            }
+
+            BlobCullResult result = CullChunkBlobs(surface, lodLevel, chunk->chunkX, chunk->chunkZ, params,
+                                                   batch->indices.data());
+            batch->frustumCulledBlobs += result.frustumCulled;
+
+            for (int j = 0; j < result.visible; j++)
+            {
+                batch->blobs.push_back(chunk->GetBlob(lodLevel, batch->indices[j]));
             }
-            chunk++;
         }
     }
 
-    std::vector<Blob*> Terrain::GetBlobsToRender()
+    bool Terrain::IsOccluded(const Chunk* chunk, const CellBox& box, float margin) const
     {
-        return m_visibleBlobs;
+        float baseX = chunk->chunkX * CHUNK_SIZE - 0.5f;
+        float baseZ = chunk->chunkZ * CHUNK_SIZE - 0.5f;
+        return m_occlusion.IsOccluded({baseX + box.minX - margin, box.minY - 0.5f - margin, baseZ + box.minZ - margin},
+                                      {baseX + box.maxX + margin, box.maxY - 0.5f + margin, baseZ + box.maxZ + margin});
     }
 
-    void Terrain::LoadChunk(int chunkX, int chunkZ)
+    void Terrain::UpdateStreaming(Context* context)
     {
-        for (Chunk chunk : m_chunks)
+        PROFILE_SCOPE("Terrain::UpdateStreaming");
+
+        int64_t start = bx::getHPCounter();
+        const double freq = double(bx::getHPFrequency());
+
+        int radius = context->loadRadius;
+        int centerX = ChunkCoord((int)floorf(context->camPosition.x));
+        int centerZ = ChunkCoord((int)floorf(context->camPosition.z));
+        m_streamCenterX = centerX;
+        m_streamCenterZ = centerZ;
+        m_streamRadius = radius;
+
+        // Chunks that fit the memory budget, resident, loading or being saved
+        const int maxInFlight = m_jobs->GetWorkerCount() * 2;
+        const int maxChunks = std::max(int(context->chunkBudgetMb * 1024.0 * 1024.0 / sizeof(Chunk)), maxInFlight);
+
+        // Every chunk that can be resident, in flight or waiting to be saved once the camera
+        // moves on, so streaming at this radius and budget never grows the pool
+        if (radius != m_reservedRadius || maxChunks != m_reservedChunks)
         {
-            if (chunk.chunkX == chunkX && chunk.chunkZ == chunkZ)
+            int inRange = 0;
+            for (int z = -radius - 1; z <= radius + 1; z++)
             {
-                return;
+                for (int x = -radius - 1; x <= radius + 1; x++)
+                {
+                    if (x * x + z * z <= (radius + 1) * (radius + 1))
+                        inRange++;
+                }
             }
+            m_chunkPool.Reserve(std::min(inRange + maxInFlight, maxChunks));
+            m_reservedRadius = radius;
+            m_reservedChunks = maxChunks;
         }
 
-        Chunk* savedChunk = LoadSavedChunk(chunkX, chunkZ);
+        // Unload chunks that left the radius, with one chunk of slack
+        // so moving back and forth over a border doesn't reload chunks.
+        m_unloadCandidates.clear();
+        for (const auto& [key, chunk] : m_chunks)
+        {
+            if (!InStreamingRange(chunk->chunkX, chunk->chunkZ, radius + 1))
+            {
+                m_unloadCandidates.push_back(key);
+            }
+        }
+        for (int64_t key : m_unloadCandidates)
+        {
+            UnloadChunk(int(key >> 32), int(int32_t(key)));
+        }
+
+        auto distanceSquared = [centerX, centerZ](int64_t key) {
+            int dx = int(key >> 32) - centerX;
+            int dz = int(int32_t(key)) - centerZ;
+            return dx * dx + dz * dz;
+        };
 
-        if (savedChunk)
+        // Over the budget, evict the least valuable chunks. Saving a dirty chunk keeps it in memory
+        // a little longer, but it counts as freed here so the next ones aren't evicted for it.
+        int inMemory = (int)(m_chunks.size() + m_pendingChunks.size());
+        size_t nextEviction = 0;
+        if (inMemory + maxInFlight > maxChunks)
         {
-            DownsampleChunk(savedChunk);
-            m_chunks.push_back(*savedChunk);
-            delete savedChunk;
+            m_evictionCandidates.clear();
+            for (const auto& [key, chunk] : m_chunks)
+            {
+                bool recent = m_frame - chunk->lastUsedFrame < CHUNK_RECENT_FRAMES;
+                m_evictionCandidates.push_back({key, recent, distanceSquared(key)});
+            }
+            std::sort(m_evictionCandidates.begin(), m_evictionCandidates.end(), LessValuable);
         }
-        else
+
+        int evicted = 0;
+        while (inMemory > maxChunks && nextEviction < m_evictionCandidates.size() &&
+               evicted < CHUNK_MAX_EVICTIONS_PER_FRAME)
         {
-            Chunk chunk = GenerateChunk(chunkX, chunkZ);
-            DownsampleChunk(&chunk);
-            m_chunks.push_back(chunk);
+            int64_t key = m_evictionCandidates[nextEviction++].key;
+            UnloadChunk(int(key >> 32), int(int32_t(key)));
+            inMemory--;
+            evicted++;
         }
+
+        // Request missing chunks, nearest first. Only a few requests are kept
+        // in flight so the order follows the camera as it moves.
+        if ((int)m_pendingChunks.size() < maxInFlight)
+        {
+            m_requestCandidates.clear();
+            for (int z = centerZ - radius; z <= centerZ + radius; z++)
+            {
+                for (int x = centerX - radius; x <= centerX + radius; x++)
+                {
+                    int64_t key = ChunkKey(x, z);
+                    if (InStreamingRange(x, z, radius) && !m_chunks.contains(key) && !m_pendingChunks.contains(key))
+                    {
+                        m_requestCandidates.push_back(key);
+                    }
+                }
+            }
+
+            std::sort(m_requestCandidates.begin(), m_requestCandidates.end(),
+                      [&](int64_t a, int64_t b) { return distanceSquared(a) < distanceSquared(b); });
+
+            for (int64_t key : m_requestCandidates)
+            {
+                if ((int)m_pendingChunks.size() >= maxInFlight)
+                    break;
+
+                // At the budget, a chunk is only loaded in place of a less valuable one.
+                // Chunks in the last frame's frustum count as recently used.
+                if (inMemory >= maxChunks)
+                {
+                    int x = int(key >> 32);
+                    int z = int(int32_t(key));
+                    Vec3 min = {x * CHUNK_SIZE - 0.5f, -0.5f, z * CHUNK_SIZE - 0.5f};
+                    Vec3 max = {(x + 1) * CHUNK_SIZE - 0.5f, MAX_HEIGHT - 0.5f, (z + 1) * CHUNK_SIZE - 0.5f};
+                    ChunkValue value = {key, m_frustum.TestAABB(min, max) != OUTSIDE, distanceSquared(key)};
+                    if (nextEviction >= m_evictionCandidates.size() || evicted >= CHUNK_MAX_EVICTIONS_PER_FRAME ||
+                        !LessValuable(m_evictionCandidates[nextEviction], value))
+                        continue;
+
+                    int64_t victim = m_evictionCandidates[nextEviction++].key;
+                    UnloadChunk(int(victim >> 32), int(int32_t(victim)));
+                    inMemory--;
+                    evicted++;
+                }
+
+                RequestChunk(int(key >> 32), int(int32_t(key)));
+                inMemory++;
+            }
+        }
+        m_evictedChunks += evicted;
+        m_statsWindowEvictions += evicted;
+
+        // Integrate finished chunks until the frame budget is used up,
+        // the rest are picked up next frame.
+        const int64_t budget = int64_t(context->streamingBudgetMs * 0.001 * freq);
+        int integrated = 0;
+        int received = 0;
+        // Always take at least one so streaming progresses on slow frames
+        while (received == 0 || bx::getHPCounter() - start < budget)
+        {
+            StreamedChunk streamed;
+            {
+                std::lock_guard<std::mutex> lock(m_streamedMutex);
+                if (m_streamedChunks.empty())
+                    break;
+
+                streamed = std::move(m_streamedChunks.back());
+                m_streamedChunks.pop_back();
+            }
+            received++;
+            m_changed = true;
+
+            m_pendingChunks.erase(streamed.key);
+            Chunk* chunk = streamed.chunk.get();
+            if (chunk && InStreamingRange(chunk->chunkX, chunk->chunkZ, radius + 1))
+            {
+                chunk->lastUsedFrame = m_frame;
+                m_chunks.emplace(streamed.key, std::move(streamed.chunk));
+                m_brickMap.MarkChunkDirty(chunk->chunkX, chunk->chunkZ);
+
+                // Borders with loaded neighbours were treated as air until now
+                UpdateSurface(chunk, 0, CHUNK_SIZE - 1, 0, MAX_HEIGHT - 1, 0, CHUNK_SIZE - 1);
+                UpdateNeighbourSurfaces(chunk->chunkX, chunk->chunkZ, 0, CHUNK_SIZE - 1, 0, MAX_HEIGHT - 1, 0,
+                                        CHUNK_SIZE - 1);
+                integrated++;
+            }
+        }
+
+        // Stats
+        int64_t now = bx::getHPCounter();
+        float integrationMs = float((now - start) / freq * 1000.0);
+        m_stats.integrationMs = integrationMs;
+        m_statsWindowMaxMs = std::max(m_statsWindowMaxMs, integrationMs);
+        m_statsWindowChunks += integrated;
+
+        double windowSeconds = (now - m_statsWindowStart) / freq;
+        if (windowSeconds >= 1.0)
+        {
+            m_stats.chunksPerSecond = float(m_statsWindowChunks / windowSeconds);
+            m_stats.maxIntegrationMs = m_statsWindowMaxMs;
+            m_stats.evictionsPerSecond = float(m_statsWindowEvictions / windowSeconds);
+            m_statsWindowStart = now;
+            m_statsWindowChunks = 0;
+            m_statsWindowEvictions = 0;
+            m_statsWindowMaxMs = 0.0f;
+        }
+
+        int readCount = m_chunkReadCount;
+        int generateCount = m_chunkGenerateCount;
+        if (readCount > 0)
+        {
+            m_stats.chunkReadMs = float(m_chunkReadTicks / freq * 1000.0 / readCount);
+        }
+        if (generateCount > 0)
+        {
+            m_stats.chunkGenerateMs = float(m_chunkGenerateTicks / freq * 1000.0 / generateCount);
+            m_stats.generatedChunksPerCore = 1000.0f / std::max(m_stats.chunkGenerateMs, 0.001f);
+        }
+        if (readCount + generateCount > 0)
+        {
+            m_stats.chunkDownsampleMs = float(m_chunkDownsampleTicks / freq * 1000.0 / (readCount + generateCount));
+        }
+        m_stats.chunksSaved = m_chunksSaved;
+        m_stats.residentChunks = (int)m_chunks.size();
+        m_stats.pendingChunks = (int)m_pendingChunks.size();
+
+        ChunkPoolStats pool = m_chunkPool.GetStats();
+        m_stats.pooledChunks = pool.capacity;
+        m_stats.pooledChunksHighWater = pool.highWater;
+        m_stats.chunkPoolMb = float(pool.bytes / (1024.0 * 1024.0));
+        m_stats.chunkMemoryMb = float(pool.used * sizeof(Chunk) / (1024.0 * 1024.0));
+        m_stats.evictedChunks = m_evictedChunks;
     }
 
-    void Terrain::UnloadChunk(int chunkX, int chunkZ)
+    void Terrain::RequestChunk(int chunkX, int chunkZ)
     {
-        for (std::vector<Chunk>::iterator chunk = m_chunks.begin(); chunk != m_chunks.end();)
-        {
-            if (chunk->chunkX == chunkX && chunk->chunkZ == chunkZ)
+        int64_t key = ChunkKey(chunkX, chunkZ);
+        m_pendingChunks.insert(key);
+        m_changed = true;
+
+        JobHandle job = m_jobs->Create([this, key, chunkX, chunkZ]() {
+            StreamedChunk streamed = {key, nullptr};
+
+            // Skip requests the camera has moved away from while queued
+            if (m_streaming && InStreamingRange(chunkX, chunkZ, m_streamRadius + 1))
             {
-                SaveChunk(*chunk);
-                m_chunks.erase(chunk);
-                break;
+                streamed.chunk = NewChunk(chunkX, chunkZ);
+                LoadChunk(streamed.chunk.get());
             }
-            chunk++;
+
+            std::lock_guard<std::mutex> lock(m_streamedMutex);
+            m_streamedChunks.push_back(std::move(streamed));
+        });
+        m_jobs->RunBackground(job);
+    }
+
+    ChunkPtr Terrain::NewChunk(int chunkX, int chunkZ)
+    {
+        return ChunkPtr(new (m_chunkPool.Allocate()) Chunk(chunkX, chunkZ), ChunkDeleter{&m_chunkPool});
+    }
+
+    bool Terrain::InStreamingRange(int chunkX, int chunkZ, int radius)
+    {
+        int dx = chunkX - m_streamCenterX;
+        int dz = chunkZ - m_streamCenterZ;
+        return dx * dx + dz * dz <= radius * radius;
+    }
+
+    // Runs in a job, must only touch the given chunk
+    void Terrain::LoadChunk(Chunk* chunk)
+    {
+        PROFILE_SCOPE("Terrain::LoadChunk");
+
+        // Load or generate in place, the chunk is never copied
+        int64_t start = bx::getHPCounter();
+        if (LoadSavedChunk(chunk))
+        {
+            m_chunkReadTicks += bx::getHPCounter() - start;
+            m_chunkReadCount++;
         }
+        else
+        {
+            // Times its jobs itself, so waiting for them isn't counted
+            GenerateChunk(chunk);
+            // Saving generated chunks makes loading them again cheaper than regenerating
+            chunk->dirty = true;
+            m_chunkGenerateCount++;
+        }
+
+        // Surfaces need the neighbours, they are built when the chunk is integrated
+        start = bx::getHPCounter();
+        DownsampleChunk(chunk);
+        for (int level = 0; level < LOD_LEVELS; level++)
+        {
+            BuildAirRows(chunk->Lod(level), LodWidth(level), 0, LodHeight(level), chunk->AirRows(level));
+        }
+        m_chunkDownsampleTicks += bx::getHPCounter() - start;
     }
 
-    Chunk* Terrain::LoadSavedChunk(int chunkX, int chunkZ)
+    void Terrain::UnloadChunk(int chunkX, int chunkZ)
     {
-        Chunk* chunk = nullptr;
-        // TODO
-        return chunk;
+        auto it = m_chunks.find(ChunkKey(chunkX, chunkZ));
+        if (it == m_chunks.end())
+            return;
+
+        m_changed = true;
+        if (it->second->dirty)
+        {
+            // Save on a worker. The chunk stays pending until it's written,
+            // so it can't be requested again and read back stale.
+            int64_t key = it->first;
+            ChunkDeleter deleter = it->second.get_deleter();
+            Chunk* chunk = it->second.release();
+            m_pendingChunks.insert(key);
+
+            m_jobs->RunBackground(m_jobs->Create([this, key, chunk, deleter]() {
+                SaveChunk(chunk);
+                deleter(chunk);
+
+                std::lock_guard<std::mutex> lock(m_streamedMutex);
+                m_streamedChunks.push_back({key, nullptr});
+            }));
+        }
+
+        m_chunks.erase(it);
+        m_editedCells.erase(ChunkKey(chunkX, chunkZ));
+        m_brickMap.MarkChunkDirty(chunkX, chunkZ);
+        UpdateNeighbourSurfaces(chunkX, chunkZ, 0, CHUNK_SIZE - 1, 0, MAX_HEIGHT - 1, 0, CHUNK_SIZE - 1);
     }
 
-    void Terrain::SaveChunk(Chunk chunk)
+    bool Terrain::LoadSavedChunk(Chunk* chunk)
     {
-        // TODO
+        return m_storage->ReadChunk(chunk->chunkX, chunk->chunkZ, chunk->blobs, BLOBS_IN_CHUNK);
     }
 
-    Chunk Terrain::GenerateChunk(int chunkX, int chunkZ)
+    // Writes the full resolution blobs, LODs are rebuilt when loading
+    void Terrain::SaveChunk(Chunk* chunk)
     {
-        Chunk chunk = Chunk(chunkX, chunkZ);
+        PROFILE_SCOPE("Terrain::SaveChunk");
+
+        if (!chunk->dirty)
+            return;
 
-        for (int y = 0; y < MAX_HEIGHT; y++)
+        if (m_storage->WriteChunk(chunk->chunkX, chunk->chunkZ, chunk->blobs, BLOBS_IN_CHUNK))
         {
-            for (int z = 0; z < CHUNK_SIZE; z++)
-            {
-                for (int x = 0; x < CHUNK_SIZE; x++)
-                {
-                    int index = (CHUNK_SIZE * CHUNK_SIZE * y) + (CHUNK_SIZE * z) + x;
-                    int blobX = chunkX * CHUNK_SIZE + x;
-                    int blobY = y;
-                    int blobZ = chunkZ * CHUNK_SIZE + z;
-                    GenerateBlob(blobX, blobY, blobZ, &chunk.blobs[index]);
-                }
-            }
+            chunk->dirty = false;
+            m_chunksSaved++;
         }
+    }
 
-        return chunk;
+    // Column heights are generated first, then the layers up to the highest column
+    // in parallel jobs. The calling job helps until they are done.
+    void Terrain::GenerateChunk(Chunk* chunk)
+    {
+        PROFILE_SCOPE("Terrain::GenerateChunk");
+
+        int64_t start = bx::getHPCounter();
+        float heights[CHUNK_SIZE * CHUNK_SIZE];
+        GenerateHeights(m_seed, chunk->chunkX * CHUNK_SIZE, chunk->chunkZ * CHUNK_SIZE, CHUNK_SIZE, heights);
+
+        // Layers above every column are air, the bottom layer is always solid
+        float maxHeight = *std::max_element(heights, heights + CHUNK_SIZE * CHUNK_SIZE);
+        int solidLayers = std::clamp((int)ceilf(maxHeight), 1, MAX_HEIGHT);
+        memset(&chunk->blobs[solidLayers * CHUNK_SIZE * CHUNK_SIZE], BlobType::AIR,
+               (MAX_HEIGHT - solidLayers) * CHUNK_SIZE * CHUNK_SIZE);
+        m_chunkGenerateTicks += bx::getHPCounter() - start;
+
+        const float* columnHeights = heights;
+        JobHandle generate = m_jobs->CreateGroup();
+        for (int y = 0; y < solidLayers; y += GENERATE_LAYERS_PER_JOB)
+        {
+            int maxY = std::min(y + GENERATE_LAYERS_PER_JOB, solidLayers);
+            m_jobs->Run(m_jobs->Create(
+                [this, chunk, columnHeights, y, maxY]() { GenerateChunkLayers(chunk, columnHeights, y, maxY); },
+                generate));
+        }
+        m_jobs->Run(generate);
+        m_jobs->Wait(generate);
     }
 
-    void Terrain::GenerateBlob(int blobX, int blobY, int blobZ, Blob* blob)
+    void Terrain::GenerateChunkLayers(Chunk* chunk, const float* heights, int minY, int maxY)
     {
-        blob->Position.x = blobX;
-        blob->Position.y = blobY;
-        blob->Position.z = blobZ;
-        blob->Radius = 0.5f;
-        blob->Type = blobY > 0 ? BlobType::AIR : BlobType::GROUND;
+        PROFILE_SCOPE("Terrain::GenerateChunkLayers");
+
+        int64_t start = bx::getHPCounter();
+        GenerateLayers(m_seed, chunk->chunkX * CHUNK_SIZE, chunk->chunkZ * CHUNK_SIZE, CHUNK_SIZE, heights, minY, maxY,
+                       &chunk->blobs[minY * CHUNK_SIZE * CHUNK_SIZE]);
+        m_chunkGenerateTicks += bx::getHPCounter() - start;
     }
 
     void Terrain::DownsampleChunk(Chunk* chunk)
     {
-        // TODO perf: when editing,
-        // we shouldn't have to update the whole chunk.
-        // just update the affected areas.
-
-        int width = CHUNK_SIZE;
-        int height = MAX_HEIGHT;
-        float blobRadius = 1.0f;
-        Blob* blobs[] = {
-            chunk->blobs, chunk->lod1Blobs, chunk->lod2Blobs, chunk->lod3Blobs, chunk->lod4Blobs,
-        };
+        PROFILE_SCOPE("Terrain::DownsampleChunk");
+
+        // Levels depend on the one below, chunks are downsampled in parallel jobs instead.
+        // Edits only update the cells they affect, see FlushEdits
+        for (int level = 0; level < LOD_LEVELS - 1; level++)
+        {
+            BuildLodLevel(chunk->Lod(level), chunk->Lod(level + 1), LodWidth(level), LodHeight(level));
+        }
+    }
 
-        for (int level = 0; level < 4; level++)
+    void Terrain::FlushEdits()
+    {
+        PROFILE_SCOPE("Terrain::FlushEdits");
+
+        int64_t start = bx::getHPCounter();
+        m_stats.editedCells = 0;
+
+        for (auto& [key, cells] : m_editedCells)
         {
-            Blob* sourceLod = blobs[level];
-            Blob* targetLod = blobs[level + 1];
+            auto it = m_chunks.find(key);
+            if (it == m_chunks.end())
+                continue;
+
+            Chunk* chunk = it->second.get();
+            chunk->dirty = true;
+            m_changed = true;
+            m_stats.editedCells += (int)cells.size();
+
+            // Bounds of every changed cell at any level, in LOD 0 cells
+            int minX = CHUNK_SIZE, minY = MAX_HEIGHT, minZ = CHUNK_SIZE;
+            int maxX = -1, maxY = -1, maxZ = -1;
+            auto grow = [&](int level, int index) {
+                int width = LodWidth(level);
+                int x = (index % width) << level;
+                int z = (index / width % width) << level;
+                int y = (index / (width * width)) << level;
+                int size = 1 << level;
+                minX = std::min(minX, x);
+                minY = std::min(minY, y);
+                minZ = std::min(minZ, z);
+                maxX = std::max(maxX, x + size - 1);
+                maxY = std::max(maxY, y + size - 1);
+                maxZ = std::max(maxZ, z + size - 1);
+            };
 
-            for (int y = 0; y < height; y += 2)
+            for (int index : cells)
+                grow(0, index);
+
+            // Recompute the 2x2x2 parents of changed cells, up the LOD levels
+            // until no parent changes
+            std::vector<int>& changed = cells;
+            for (int level = 0; level < LOD_LEVELS - 1 && !changed.empty(); level++)
             {
-                for (int z = 0; z < width; z += 2)
+                int width = LodWidth(level);
+                int parentWidth = LodWidth(level + 1);
+
+                m_editParents.clear();
+                for (int index : changed)
                 {
-                    for (int x = 0; x < width; x += 2)
+                    int x = index % width;
+                    int z = index / width % width;
+                    int y = index / (width * width);
+                    m_editParents.push_back(((y / 2) * parentWidth + z / 2) * parentWidth + x / 2);
+                }
+                std::sort(m_editParents.begin(), m_editParents.end());
+                m_editParents.erase(std::unique(m_editParents.begin(), m_editParents.end()), m_editParents.end());
+
+                const BlobType* sourceLod = chunk->Lod(level);
+                BlobType* targetLod = chunk->Lod(level + 1);
+                m_editChanged.clear();
+                for (int parent : m_editParents)
+                {
+                    int x = parent % parentWidth * 2;
+                    int z = parent / parentWidth % parentWidth * 2;
+                    int y = parent / (parentWidth * parentWidth) * 2;
+                    BlobType type = DownsampleCell(sourceLod, width, x, y, z);
+                    if (type != targetLod[parent])
                     {
-                        int sourceIndex = (width * width * y) + (width * z) + x;
-                        int targetIndex = (width * width * y / 8) + (width * z / 4) + x / 2;
-                        int sourceTypeCount[BlobType::MAX];
-
-                        for (int yD = 0; yD < 2; yD++)
-                        {
-                            for (int zD = 0; zD < 2; zD++)
-                            {
-                                for (int xD = 0; xD < 2; xD++)
-                                {
-                                    int index = sourceIndex + (width * width * yD) + (width * zD) + xD;
-                                    Blob sourceBlob = sourceLod[index];
-                                    sourceTypeCount[sourceBlob.Type]++;
-                                }
-                            }
-                        }
-
-                        BlobType mostCommonType = BlobType::GROUND;
-                        for (int t = BlobType::GROUND + 1; t < BlobType::MAX; t++)
-                        {
-                            if (sourceTypeCount[t] > sourceTypeCount[mostCommonType])
-                            {
-                                mostCommonType = (BlobType)t;
-                            }
-                        }
-
-                        targetLod[targetIndex].Radius = blobRadius;
-                        targetLod[targetIndex].Type = mostCommonType;
-                        targetLod[targetIndex].Position.x = sourceLod[sourceIndex].Position.x + blobRadius * 0.5f;
-                        targetLod[targetIndex].Position.y = sourceLod[sourceIndex].Position.y + blobRadius * 0.5f;
-                        targetLod[targetIndex].Position.z = sourceLod[sourceIndex].Position.z + blobRadius * 0.5f;
+                        targetLod[parent] = type;
+                        m_editChanged.push_back(parent);
+                        grow(level + 1, parent);
                     }
                 }
+                changed.swap(m_editChanged);
+            }
+
+            for (int level = 0; level < LOD_LEVELS; level++)
+            {
+                BuildAirRows(chunk->Lod(level), LodWidth(level), minY >> level, (maxY >> level) + 1,
+                             chunk->AirRows(level));
+            }
+            UpdateSurface(chunk, minX, maxX, minY, maxY, minZ, maxZ);
+            UpdateNeighbourSurfaces(chunk->chunkX, chunk->chunkZ, minX, maxX, minY, maxY, minZ, maxZ);
+
+            int baseX = chunk->chunkX * CHUNK_SIZE;
+            int baseZ = chunk->chunkZ * CHUNK_SIZE;
+            m_brickMap.MarkDirty(baseX + minX, minY, baseZ + minZ, baseX + maxX, maxY, baseZ + maxZ);
+        }
+        m_editedCells.clear();
+
+        m_stats.editMs = float((bx::getHPCounter() - start) / double(bx::getHPFrequency()) * 1000.0);
+    }
+
+    void Terrain::UpdateSurface(Chunk* chunk, int minX, int maxX, int minY, int maxY, int minZ, int maxZ)
+    {
+        PROFILE_SCOPE("Terrain::UpdateSurface");
+
+        Chunk* west = GetChunk(chunk->chunkX - 1, chunk->chunkZ);
+        Chunk* east = GetChunk(chunk->chunkX + 1, chunk->chunkZ);
+        Chunk* north = GetChunk(chunk->chunkX, chunk->chunkZ - 1);
+        Chunk* south = GetChunk(chunk->chunkX, chunk->chunkZ + 1);
+
+        for (int level = 0; level < LOD_LEVELS; level++)
+        {
+            int width = LodWidth(level);
+            int height = LodHeight(level);
+
+            // Cells of this level in or next to the box, shifts round negative coordinates down
+            int x0 = std::max((minX >> level) - 1, 0);
+            int x1 = std::min((maxX >> level) + 1, width - 1);
+            int y0 = std::max((minY >> level) - 1, 0);
+            int y1 = std::min((maxY >> level) + 1, height - 1);
+            int z0 = std::max((minZ >> level) - 1, 0);
+            int z1 = std::min((maxZ >> level) + 1, width - 1);
+            if (x0 > x1 || y0 > y1 || z0 > z1)
+                continue;
+
+            SurfaceNeighbours neighbours;
+            neighbours.west = west ? west->AirRows(level) : nullptr;
+            neighbours.east = east ? east->AirRows(level) : nullptr;
+            neighbours.north = north ? north->AirRows(level) : nullptr;
+            neighbours.south = south ? south->AirRows(level) : nullptr;
+
+            // Whole rows are rebuilt, x only decides whether any are
+            BuildSurface(chunk->AirRows(level), neighbours, width, height, y0, y1, z0, z1, chunk->Surface(level));
+
+            chunk->surfaceCount[level] = CountSurface(chunk->Surface(level), LodBlobCount(level));
+            int airCount = 0;
+            for (int row = 0; row < height * width; row++)
+            {
+                airCount += std::popcount(chunk->AirRows(level)[row]);
             }
+            chunk->solidCount[level] = LodBlobCount(level) - airCount;
 
-            width /= 2;
-            height /= 2;
-            blobRadius *= 2;
+            chunk->surfaceSections[level] = BuildSectionBounds(chunk->Surface(level), level, width, height,
+                                                               CHUNK_SECTIONS, chunk->sectionBounds[level]);
+            chunk->occluderCount[level] = BuildOccluders(chunk->AirRows(level), chunk->Surface(level), level, width,
+                                                         height, chunk->occluders[level], CHUNK_OCCLUDERS);
         }
     }
-}
\ No newline at end of file
+
+    void Terrain::UpdateNeighbourSurfaces(int chunkX, int chunkZ, int minX, int maxX, int minY, int maxY, int minZ,
+                                          int maxZ)
+    {
+        if (Chunk* west = GetChunk(chunkX - 1, chunkZ))
+            UpdateSurface(west, minX + CHUNK_SIZE, maxX + CHUNK_SIZE, minY, maxY, minZ, maxZ);
+        if (Chunk* east = GetChunk(chunkX + 1, chunkZ))
+            UpdateSurface(east, minX - CHUNK_SIZE, maxX - CHUNK_SIZE, minY, maxY, minZ, maxZ);
+        if (Chunk* north = GetChunk(chunkX, chunkZ - 1))
+            UpdateSurface(north, minX, maxX, minY, maxY, minZ + CHUNK_SIZE, maxZ + CHUNK_SIZE);
+        if (Chunk* south = GetChunk(chunkX, chunkZ + 1))
+            UpdateSurface(south, minX, maxX, minY, maxY, minZ - CHUNK_SIZE, maxZ - CHUNK_SIZE);
+    }
+}
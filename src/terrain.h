@@ -1,27 +1,116 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "blob.h"
+#include "blob-cull.h"
+#include "brick-map.h"
+#include "chunk-pool.h"
 #include "context.h"
+#include "frustum.h"
+#include "job-system.h"
+#include "occlusion-buffer.h"
+#include "region-file.h"
+#include "surface-builder.h"
 
 #define CHUNK_SIZE 16
 #define MAX_HEIGHT 128
 #define BLOBS_IN_CHUNK (MAX_HEIGHT * CHUNK_SIZE * CHUNK_SIZE)
+#define LOD_LEVELS 5
+// Layers of LOD 0 cells per section, sections are culled on their own
+#define CHUNK_SECTIONS (MAX_HEIGHT / CHUNK_SIZE)
+// Occluder boxes kept per chunk and LOD level
+#define CHUNK_OCCLUDERS 16
+// Chunks culled per job
+#define CULL_CHUNKS_PER_JOB 4
+// Layers of a chunk generated per job
+#define GENERATE_LAYERS_PER_JOB 16
+// Chunks in the frustum within this many frames are kept over closer ones when over the memory budget
+#define CHUNK_RECENT_FRAMES 120
+// Limits the hitch of lowering the memory budget, the rest are evicted over the next frames
+#define CHUNK_MAX_EVICTIONS_PER_FRAME 16
+// Chunks one core should generate per second. Moving 200 cells per second
+// with the largest load radius of 16 streams in about 400 chunks per second.
+#define GENERATE_TARGET_CHUNKS_PER_CORE 500
 
 namespace blobby
 {
+    // Cells per side of a chunk at the given LOD level
+    constexpr int LodWidth(int lodLevel)
+    {
+        return CHUNK_SIZE >> lodLevel;
+    }
+
+    constexpr int LodHeight(int lodLevel)
+    {
+        return MAX_HEIGHT >> lodLevel;
+    }
+
+    constexpr int LodBlobCount(int lodLevel)
+    {
+        return BLOBS_IN_CHUNK >> (3 * lodLevel);
+    }
+
+    // Air rows and surface bits of all levels are stored back to back, see Chunk
+    constexpr int LodRowOffset(int lodLevel)
+    {
+        int offset = 0;
+        for (int level = 0; level < lodLevel; level++)
+            offset += LodHeight(level) * LodWidth(level);
+        return offset;
+    }
+
+    constexpr int LodSurfaceOffset(int lodLevel)
+    {
+        int offset = 0;
+        for (int level = 0; level < lodLevel; level++)
+            offset += (LodBlobCount(level) + 63) / 64;
+        return offset;
+    }
+
+    // Air rows are 16 bits wide
+    static_assert(CHUNK_SIZE <= 16);
+
     struct Chunk
     {
         int chunkX;
         int chunkZ;
 
-        Blob blobs[BLOBS_IN_CHUNK];
-        Blob lod1Blobs[BLOBS_IN_CHUNK / 8];    // 2x2x2
-        Blob lod2Blobs[BLOBS_IN_CHUNK / 64];   // 4x4x4
-        Blob lod3Blobs[BLOBS_IN_CHUNK / 512];  // 8x8x8
-        Blob lod4Blobs[BLOBS_IN_CHUNK / 4096]; // 16x16x16
+        // Changed since it was last saved
+        bool dirty = false;
+        // Terrain::Update frame the chunk was last in the frustum, or loaded
+        uint32_t lastUsedFrame = 0;
+
+        // Only the type of each cell is stored, one byte per cell.
+        // Position and radius are implied by the cell index and LOD level,
+        // see GetBlob.
+        BlobType blobs[BLOBS_IN_CHUNK];
+        BlobType lod1Blobs[BLOBS_IN_CHUNK / 8];    // 2x2x2
+        BlobType lod2Blobs[BLOBS_IN_CHUNK / 64];   // 4x4x4
+        BlobType lod3Blobs[BLOBS_IN_CHUNK / 512];  // 8x8x8
+        BlobType lod4Blobs[BLOBS_IN_CHUNK / 4096]; // 16x16x16
+
+        // Per LOD level, bit x of row y * width + z is set for AIR cells
+        uint16_t airRows[LodRowOffset(LOD_LEVELS)];
+        // Per LOD level, one bit per cell in the order of the cells. Set for non-air cells
+        // with an air neighbour, buried cells can't affect the surface and are never rendered.
+        uint64_t surface[LodSurfaceOffset(LOD_LEVELS)] = {};
+        int surfaceCount[LOD_LEVELS] = {};
+        int solidCount[LOD_LEVELS] = {};
+        // Per LOD level, bit s is set if section s has surface cells, and their bounds
+        uint32_t surfaceSections[LOD_LEVELS] = {};
+        CellBox sectionBounds[LOD_LEVELS][CHUNK_SECTIONS];
+        // Per LOD level, boxes of buried cells, see BuildOccluders
+        CellBox occluders[LOD_LEVELS][CHUNK_OCCLUDERS];
+        int occluderCount[LOD_LEVELS] = {};
 
         Chunk(int x, int z)
         {
@@ -29,9 +118,72 @@ namespace blobby
             this->chunkZ = z;
         }
 
+        // Chunks are large, never copy them by value
+        Chunk(const Chunk&) = delete;
+        Chunk& operator=(const Chunk&) = delete;
+
+        BlobType* Lod(int lodLevel)
+        {
+            BlobType* lods[] = {blobs, lod1Blobs, lod2Blobs, lod3Blobs, lod4Blobs};
+            return lods[lodLevel];
+        }
+
+        const BlobType* Lod(int lodLevel) const
+        {
+            const BlobType* lods[] = {blobs, lod1Blobs, lod2Blobs, lod3Blobs, lod4Blobs};
+            return lods[lodLevel];
+        }
+
+        uint16_t* AirRows(int lodLevel)
+        {
+            return &airRows[LodRowOffset(lodLevel)];
+        }
+
+        const uint16_t* AirRows(int lodLevel) const
+        {
+            return &airRows[LodRowOffset(lodLevel)];
+        }
+
+        uint64_t* Surface(int lodLevel)
+        {
+            return &surface[LodSurfaceOffset(lodLevel)];
+        }
+
+        const uint64_t* Surface(int lodLevel) const
+        {
+            return &surface[LodSurfaceOffset(lodLevel)];
+        }
+
+        // Materialize the blob for a cell index at the given LOD level
+        Blob GetBlob(int lodLevel, int index) const
+        {
+            int width = LodWidth(lodLevel);
+            int x = index % width;
+            int z = (index / width) % width;
+            int y = index / (width * width);
+
+            // LOD cells cover 2^level cells of the level below,
+            // the blob sits in the middle of them.
+            float size = float(1 << lodLevel);
+            float offset = (size - 1.0f) * 0.5f;
+            return Blob(chunkX * CHUNK_SIZE + x * size + offset, y * size + offset,
+                        chunkZ * CHUNK_SIZE + z * size + offset, size * 0.5f, Lod(lodLevel)[index]);
+        }
+
+        // Bounds of all blobs in the chunk, at any LOD
+        Vec3 Min()
+        {
+            return {chunkX * CHUNK_SIZE - 0.5f, -0.5f, chunkZ * CHUNK_SIZE - 0.5f};
+        }
+
+        Vec3 Max()
+        {
+            return {(chunkX + 1) * CHUNK_SIZE - 0.5f, MAX_HEIGHT - 0.5f, (chunkZ + 1) * CHUNK_SIZE - 0.5f};
+        }
+
         Vec3 Center()
         {
-            return {(chunkX + 0.5f) * CHUNK_SIZE, 0.5f * MAX_HEIGHT, (chunkX + 0.5f) * CHUNK_SIZE};
+            return {(chunkX + 0.5f) * CHUNK_SIZE, 0.5f * MAX_HEIGHT, (chunkZ + 0.5f) * CHUNK_SIZE};
         }
 
         // Distance from point p to the closest point inside this chunk
@@ -74,35 +226,298 @@ namespace blobby
         }
     };
 
+    // Returns chunks to the pool they were allocated from
+    struct ChunkDeleter
+    {
+        ChunkPool* pool = nullptr;
+
+        void operator()(Chunk* chunk) const
+        {
+            chunk->~Chunk();
+            pool->Free(chunk);
+        }
+    };
+
+    using ChunkPtr = std::unique_ptr<Chunk, ChunkDeleter>;
+
+    // Packs chunk coordinates into a single key for hashed lookup
+    inline int64_t ChunkKey(int chunkX, int chunkZ)
+    {
+        return (int64_t(chunkX) << 32) | uint32_t(chunkZ);
+    }
+
+    // Chunk coordinate containing the given blob coordinate
+    inline int ChunkCoord(int blobCoord)
+    {
+        // floor division, so negative coordinates map to the correct chunk
+        return (blobCoord >= 0 ? blobCoord : blobCoord - (CHUNK_SIZE - 1)) / CHUNK_SIZE;
+    }
+
+    struct TerrainStats
+    {
+        int residentChunks = 0;
+        int pendingChunks = 0;
+
+        // Chunks integrated into the world during the last second
+        float chunksPerSecond = 0.0f;
+        // Main thread time spent integrating and unloading chunks
+        float integrationMs = 0.0f;
+        float maxIntegrationMs = 0.0f;
+        // Average CPU time per chunk for reading a saved chunk,
+        // generating a new one and downsampling either
+        float chunkReadMs = 0.0f;
+        float chunkGenerateMs = 0.0f;
+        float chunkDownsampleMs = 0.0f;
+        // Generation throughput of a single core, see GENERATE_TARGET_CHUNKS_PER_CORE
+        float generatedChunksPerCore = 0.0f;
+
+        // Nothing was streamed, edited or rebuilt during the last update
+        bool idle = false;
+
+        int chunksSaved = 0;
+        float lastSaveMs = 0.0f;
+
+        // Cells changed by edits during the last frame and the time it took
+        // to propagate them up the LOD levels
+        int editedCells = 0;
+        float editMs = 0.0f;
+
+        int visibleChunks = 0;
+        int frustumCulledChunks = 0;
+        int frustumCulledBlobs = 0;
+        int visibleBlobs = 0;
+        // Solid cells of chunks in the frustum skipped for having no air neighbour
+        int buriedBlobs = 0;
+
+        // Chunk slots of the pool, see ChunkPool
+        int pooledChunks = 0;
+        int pooledChunksHighWater = 0;
+        float chunkPoolMb = 0.0f;
+        // Chunks in memory against Context::chunkBudgetMb, and chunks evicted to stay within it
+        float chunkMemoryMb = 0.0f;
+        int evictedChunks = 0;
+        float evictionsPerSecond = 0.0f;
+
+        // Occlusion culling, see OcclusionBuffer
+        int occluders = 0;
+        int occlusionCulledChunks = 0;
+        // Surface blobs of occluded chunks and sections
+        int occlusionCulledBlobs = 0;
+        // Share of the surface blobs in chunks in the frustum culled by occlusion,
+        // during the last frame and since the start
+        float occlusionCullRate = 0.0f;
+        float averageOcclusionCullRate = 0.0f;
+        // CPU time of drawing occluders, summed over the jobs
+        float occlusionRasterMs = 0.0f;
+    };
+
+    // Sets every cell whose center is inside a sphere
+    struct TerrainEdit
+    {
+        Vec3 center;
+        float radius;
+        BlobType type;
+    };
+
     class Terrain
     {
       public:
-        Terrain(int seed);
+        // Streaming and culling run on the given jobs. hugePages backs chunks
+        // with transparent huge pages where the OS supports them.
+        Terrain(int seed, JobSystem* jobs, bool hugePages = false);
         ~Terrain();
 
         void Update(Context* context, float projMatrix[16]);
-        std::vector<Blob*> GetBlobsToRender();
+        // Valid until the next Update
+        std::span<const Blob> GetBlobsToRender() const
+        {
+            return m_visibleBlobs;
+        }
+
+        const TerrainStats& GetStats()
+        {
+            return m_stats;
+        }
+
+        const BrickMap& GetBrickMap() const
+        {
+            return m_brickMap;
+        }
 
-        Blob* GetBlob(int blobX, int blobY, int blobZ);
+        BrickMap& GetBrickMap()
+        {
+            return m_brickMap;
+        }
+
+        bool GetBlob(int blobX, int blobY, int blobZ, Blob* blob);
         Chunk* GetChunk(int chunkX, int chunkZ);
 
+        // Edits change LOD 0 cells of loaded chunks right away,
+        // LOD levels and the brick map are updated in the next Update.
+        // Returns false if the cell is not loaded.
+        bool SetBlob(int blobX, int blobY, int blobZ, BlobType type);
+        // Returns the number of cells changed
+        int ApplyEdit(const TerrainEdit& edit);
+
         void Save();
 
       private:
-        void LoadChunk(int chunkX, int chunkZ);
+        // Result of a streaming request, chunk is null if the request was dropped
+        struct StreamedChunk
+        {
+            int64_t key;
+            ChunkPtr chunk;
+        };
+
+        // Value of keeping a chunk in memory, see LessValuable
+        struct ChunkValue
+        {
+            int64_t key;
+            // In the frustum within CHUNK_RECENT_FRAMES
+            bool recent;
+            // From the chunk the camera is in, in chunks
+            int distanceSquared;
+        };
+
+        // Chunks used recently are worth more, then closer ones
+        static bool LessValuable(const ChunkValue& a, const ChunkValue& b)
+        {
+            if (a.recent != b.recent)
+                return b.recent;
+            return a.distanceSquared > b.distanceSquared;
+        }
+
+        // Loads chunks in the load radius and unloads those outside it. Over the memory
+        // budget the least valuable chunks are evicted, and missing chunks are only
+        // loaded in place of less valuable ones.
+        void UpdateStreaming(Context* context);
+        // Constructs a chunk in a pool slot, safe to call from jobs
+        ChunkPtr NewChunk(int chunkX, int chunkZ);
+        void RequestChunk(int chunkX, int chunkZ);
+        bool InStreamingRange(int chunkX, int chunkZ, int radius);
+
+        void LoadChunk(Chunk* chunk);
         void UnloadChunk(int chunkX, int chunkZ);
-        void UnloadChunk(Chunk chunk);
 
-        Chunk* LoadSavedChunk(int chunkX, int chunkZ);
-        void SaveChunk(Chunk chunk);
+        bool LoadSavedChunk(Chunk* chunk);
+        void SaveChunk(Chunk* chunk);
 
-        Chunk GenerateChunk(int chunkX, int chunkZ);
-        void GenerateBlob(int blobX, int blobY, int blobZ, Blob* blob);
+        void GenerateChunk(Chunk* chunk);
+        // Generates the layers in [minY, maxY) from the heights of the chunk's columns
+        void GenerateChunkLayers(Chunk* chunk, const float* heights, int minY, int maxY);
 
         void DownsampleChunk(Chunk* chunk);
+        void FlushEdits();
+
+        // Rebuilds the surface bits of a chunk's cells next to or inside a box of LOD 0 cells
+        // relative to the chunk, at every level. The box may reach outside the chunk.
+        // Air rows of the chunk and its neighbours must be up to date.
+        void UpdateSurface(Chunk* chunk, int minX, int maxX, int minY, int maxY, int minZ, int maxZ);
+        // Same for the four chunks next to chunkX, chunkZ, with the box relative to that chunk
+        void UpdateNeighbourSurfaces(int chunkX, int chunkZ, int minX, int maxX, int minY, int maxY, int minZ,
+                                     int maxZ);
+
+        struct CullChunk
+        {
+            Chunk* chunk;
+            int lodLevel;
+            float distance;
+            // Crosses the frustum edges, blobs are tested individually
+            bool intersects;
+        };
+
+        // Output of a culling job. Jobs write to their own batch,
+        // batches are merged in order so the result doesn't depend on scheduling.
+        struct CullBatch
+        {
+            int firstChunk;
+            int chunkCount;
+            std::vector<Blob> blobs;
+            // Visible cell indices of the chunk being culled
+            std::vector<uint32_t> indices;
+            int frustumCulledBlobs;
+            int buriedBlobs;
+            int surfaceBlobs;
+            int occlusionCulledChunks;
+            int occlusionCulledBlobs;
+            // Surface of a chunk with some sections occluded
+            std::vector<uint64_t> surface;
+        };
+
+        // Draws the buried cells of the closest chunks in the frustum into the occlusion buffer in jobs
+        JobHandle RasterizeOccluders();
+        void CullChunks(CullBatch* batch);
+        // Tests a box of a chunk's cells grown by margin against the occlusion buffer
+        bool IsOccluded(const Chunk* chunk, const CellBox& box, float margin) const;
+
+        uint32_t m_seed;
+        // Declared before everything holding chunks, so it outlives them
+        ChunkPool m_chunkPool;
+        // Pool slots never move, so pointers to chunks stay valid
+        // while other chunks are loaded and unloaded.
+        std::unordered_map<int64_t, ChunkPtr> m_chunks;
+        // Capacity is kept between frames, so culling only allocates when more blobs are visible than ever before
+        std::vector<Blob> m_visibleBlobs;
+        bool m_changed = false;
+
+        // Culling, chunks are tested on the main thread
+        // and their blobs in parallel jobs.
+        Frustum m_frustum;
+        BlobCullParams m_cullParams;
+        std::vector<CullChunk> m_cullChunks;
+        std::vector<CullBatch> m_cullBatches;
+
+        // Occlusion culling, occluders are drawn while the main thread updates the brick map
+        OcclusionBuffer m_occlusion;
+        bool m_occlusionCulling = false;
+        // Indices into m_cullChunks of chunks adding occluders, closest first
+        std::vector<int> m_occluderChunks;
+
+        // Distance bounds for ray marching, rebuilt as chunks come and go
+        BrickMap m_brickMap;
+
+        // LOD 0 cell indices edited since the last FlushEdits, per chunk
+        std::unordered_map<int64_t, std::vector<int>> m_editedCells;
+        std::vector<int> m_editParents;
+        std::vector<int> m_editChanged;
+
+        std::unique_ptr<RegionStorage> m_storage;
+
+        // Streaming, chunks are loaded in jobs and
+        // integrated on the main thread in UpdateStreaming.
+        JobSystem* m_jobs;
+        std::unordered_set<int64_t> m_pendingChunks;
+        std::vector<StreamedChunk> m_streamedChunks;
+        std::mutex m_streamedMutex;
+        std::vector<int64_t> m_requestCandidates;
+        std::vector<int64_t> m_unloadCandidates;
+        // Resident chunks, least valuable first, sorted when near the memory budget
+        std::vector<ChunkValue> m_evictionCandidates;
+        std::atomic<int> m_streamCenterX = 0;
+        std::atomic<int> m_streamCenterZ = 0;
+        std::atomic<int> m_streamRadius = 0;
+        // Load radius and chunk budget the pool was last reserved for
+        int m_reservedRadius = -1;
+        int m_reservedChunks = -1;
+        // Counts calls to Update, see Chunk::lastUsedFrame
+        uint32_t m_frame = 0;
+        std::atomic<bool> m_streaming = true;
 
-        int m_seed;
-        std::vector<Chunk> m_chunks;
-        std::vector<Blob*> m_visibleBlobs;
+        // Stats
+        TerrainStats m_stats;
+        std::atomic<int64_t> m_chunkReadTicks = 0;
+        std::atomic<int> m_chunkReadCount = 0;
+        std::atomic<int64_t> m_chunkGenerateTicks = 0;
+        std::atomic<int> m_chunkGenerateCount = 0;
+        std::atomic<int64_t> m_chunkDownsampleTicks = 0;
+        std::atomic<int64_t> m_occlusionTicks = 0;
+        int64_t m_occlusionCulledBlobsTotal = 0;
+        int64_t m_surfaceBlobsTotal = 0;
+        std::atomic<int> m_chunksSaved = 0;
+        int64_t m_statsWindowStart = 0;
+        int m_statsWindowChunks = 0;
+        float m_statsWindowMaxMs = 0.0f;
+        int m_statsWindowEvictions = 0;
+        int m_evictedChunks = 0;
     };
 }
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include <algorithm>
+
+#include <bx/math.h>
+
+#include "constants.h"
+#include "tile-binning.h"
+
+namespace blobby
+{
+    bool TileBinner::ProjectSphere(Vec3 center, float radius, const float view[16], const float proj[16],
+                                   int width, int height, bool originBottomLeft, TileRect* rect)
+    {
+        bx::Vec3 viewCenter = bx::mul({center.x, center.y, center.z}, view);
+
+        // Behind the camera
+        if (viewCenter.z + radius < NEAR_PLANE)
+            return false;
+
+        // Crossing the near plane, could cover any part of the screen
+        if (viewCenter.z - radius < NEAR_PLANE)
+        {
+            *rect = {0, 0, m_tilesX - 1, m_tilesY - 1};
+            return true;
+        }
+
+        // Project the corners of the view space box around the sphere
+        float minX = 1.0f;
+        float minY = 1.0f;
+        float maxX = -1.0f;
+        float maxY = -1.0f;
+        for (int i = 0; i < 8; i++)
+        {
+            bx::Vec3 corner = {
+                viewCenter.x + ((i & 1) ? radius : -radius),
+                viewCenter.y + ((i & 2) ? radius : -radius),
+                viewCenter.z + ((i & 4) ? radius : -radius),
+            };
+            bx::Vec3 ndc = bx::mulH(corner, proj);
+            minX = std::min(minX, ndc.x);
+            minY = std::min(minY, ndc.y);
+            maxX = std::max(maxX, ndc.x);
+            maxY = std::max(maxY, ndc.y);
+        }
+
+        if (minX > 1.0f || maxX < -1.0f || minY > 1.0f || maxY < -1.0f)
+            return false;
+
+        // NDC to pixels, matching gl_FragCoord
+        float left = (minX * 0.5f + 0.5f) * width;
+        float right = (maxX * 0.5f + 0.5f) * width;
+        float bottom = (minY * 0.5f + 0.5f) * height;
+        float top = (maxY * 0.5f + 0.5f) * height;
+        if (!originBottomLeft)
+        {
+            float flippedBottom = height - top;
+            top = height - bottom;
+            bottom = flippedBottom;
+        }
+
+        rect->minX = std::clamp(int(left) / TILE_SIZE, 0, m_tilesX - 1);
+        rect->maxX = std::clamp(int(right) / TILE_SIZE, 0, m_tilesX - 1);
+        rect->minY = std::clamp(int(bottom) / TILE_SIZE, 0, m_tilesY - 1);
+        rect->maxY = std::clamp(int(top) / TILE_SIZE, 0, m_tilesY - 1);
+        return true;
+    }
+
+    void TileBinner::Build(const Blob* blobs, int blobCount, const float view[16], const float proj[16], int width,
+                           int height, bool originBottomLeft, float radiusMargin)
+    {
+        m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        int tileCount = m_tilesX * m_tilesY;
+
+        // Count blobs per tile
+        m_counts.assign(tileCount, 0);
+        m_rects.resize(blobCount);
+        for (int i = 0; i < blobCount; i++)
+        {
+            TileRect& rect = m_rects[i];
+            if (!ProjectSphere(blobs[i].Position, blobs[i].Radius + radiusMargin, view, proj, width, height,
+                               originBottomLeft, &rect))
+            {
+                rect = {1, 1, 0, 0}; // empty
+                continue;
+            }
+
+            for (int y = rect.minY; y <= rect.maxY; y++)
+            {
+                for (int x = rect.minX; x <= rect.maxX; x++)
+                {
+                    m_counts[y * m_tilesX + x]++;
+                }
+            }
+        }
+
+        // Headers, indices start after them
+        m_data.resize(tileCount * 2);
+        int offset = tileCount * 2;
+        for (int tile = 0; tile < tileCount; tile++)
+        {
+            m_data[tile * 2 + 0] = float(offset);
+            m_data[tile * 2 + 1] = float(m_counts[tile]);
+            offset += m_counts[tile];
+        }
+        m_indexCount = offset - tileCount * 2;
+
+        // Fill indices, reusing counts as write cursors
+        m_data.resize(offset);
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+        for (int i = 0; i < blobCount; i++)
+        {
+            const TileRect& rect = m_rects[i];
+            for (int y = rect.minY; y <= rect.maxY; y++)
+            {
+                for (int x = rect.minX; x <= rect.maxX; x++)
+                {
+                    int tile = y * m_tilesX + x;
+                    int cursor = int(m_data[tile * 2]) + m_counts[tile]++;
+                    m_data[cursor] = float(i);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "blob.h"
+
+// Screen tile size in pixels, must match the sdf shader
+#define TILE_SIZE 16
+// Width of the tile data texture
+#define TILE_TEXTURE_WIDTH 1024
+
+namespace blobby
+{
+    // Bins blobs into screen space tiles, so the fragment shader only
+    // evaluates blobs that can affect rays through its tile.
+    //
+    // The result is a flat list of floats meant for a R32F texture:
+    //   [tile * 2 + 0] offset of the tile's blob indices
+    //   [tile * 2 + 1] number of blob indices
+    //   [offset...]    blob indices
+    class TileBinner
+    {
+      public:
+        // radiusMargin is added to blob radii, covering smoothing between blobs
+        void Build(const Blob* blobs, int blobCount, const float view[16], const float proj[16], int width,
+                   int height, bool originBottomLeft, float radiusMargin);
+
+        const std::vector<float>& GetData()
+        {
+            return m_data;
+        }
+
+        int GetTilesX()
+        {
+            return m_tilesX;
+        }
+
+        int GetTilesY()
+        {
+            return m_tilesY;
+        }
+
+        // Total number of blob indices in all tiles
+        int GetIndexCount()
+        {
+            return m_indexCount;
+        }
+
+      private:
+        struct TileRect
+        {
+            int minX;
+            int minY;
+            int maxX;
+            int maxY;
+        };
+
+        bool ProjectSphere(Vec3 center, float radius, const float view[16], const float proj[16], int width,
+                           int height, bool originBottomLeft, TileRect* rect);
+
+        int m_tilesX = 0;
+        int m_tilesY = 0;
+        int m_indexCount = 0;
+        std::vector<TileRect> m_rects;
+        std::vector<int> m_counts;
+        std::vector<float> m_data;
+    };
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "blob-bvh.h"
+#include "constants.h"
+#include "test.h"
+
+namespace blobby
+{
+    static float TestBlobDistance(const Blob& blob, Vec3 p, float time)
+    {
+        Vec3 position = blob.Position;
+        position.y += BlobWave(blob.Position, time);
+        return distance(p, position) - blob.Radius;
+    }
+
+    // Blends every blob of the BVH in the order BlobBvh::Distance visits the leaves, without skipping any.
+    // Blobs it skips are at least SMOOTHNESS farther than the field, where SmoothUnion returns the field,
+    // so the two only differ by rounding.
+    static float DistanceInVisitOrder(const BlobBvh& bvh, Vec3 p, float time)
+    {
+        const std::vector<float>& nodes = bvh.GetData();
+        const std::vector<Blob>& blobs = bvh.GetBlobs();
+        float field = FAR_PLANE;
+        std::vector<int> stack = {0};
+        while (!stack.empty())
+        {
+            int node = stack.back();
+            stack.pop_back();
+
+            const float* n = &nodes[node * 8];
+            if (n[7] >= 0.0f)
+            {
+                for (int i = int(n[3]); i < int(n[3]) + int(n[7]); i++)
+                    field = SmoothUnion(field, TestBlobDistance(blobs[i], p, time), SMOOTHNESS);
+                continue;
+            }
+
+            int axis = -1 - int(n[7]);
+            float coord = axis == 0 ? p.x : axis == 1 ? p.y : p.z;
+            bool leftFirst = coord < (n[axis] + n[4 + axis]) * 0.5f;
+            stack.push_back(leftFirst ? int(n[3]) : node + 1);
+            stack.push_back(leftFirst ? node + 1 : int(n[3]));
+        }
+        return field;
+    }
+
+    bool TestBlobBvh()
+    {
+        std::vector<Blob> blobs;
+        GenerateSurfaceBlobs(7, -24, -24, 48, blobs);
+        CHECK(!blobs.empty());
+
+        BlobBvh bvh;
+        bvh.Build(blobs.data(), (int)blobs.size());
+        CHECK(bvh.GetBlobs().size() == blobs.size());
+        CHECK(bvh.GetDepth() <= BVH_MAX_DEPTH);
+
+        // Points around the surface, and some above it
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> offset(-2.0f, 2.0f);
+        std::uniform_int_distribution<int> pick(0, (int)blobs.size() - 1);
+        for (int i = 0; i < 2000; i++)
+        {
+            const Blob& blob = blobs[pick(rng)];
+            Vec3 p = {blob.Position.x + offset(rng), blob.Position.y + offset(rng), blob.Position.z + offset(rng)};
+            bool above = i % 4 == 0;
+            if (above)
+                p.y += 8.0f;
+
+            for (float time : {0.0f, 1.5f})
+            {
+                int evaluated = 0;
+                float field = bvh.Distance(p, time, &evaluated);
+                float reference = DistanceInVisitOrder(bvh, p, time);
+                float tolerance = 1e-4f * std::max(1.0f, fabsf(reference));
+
+                // Above the surface the bounds are loose and traversal can run out of visits,
+                // the nodes left are bounded by their boxes and never by more than the field
+                CHECK(field <= reference + tolerance);
+                if (above)
+                    continue;
+
+                CHECK(fabsf(field - reference) <= tolerance);
+
+                // Smooth unions are no farther than the nearest blob, and each blend lowers
+                // the field by at most SMOOTHNESS / 4 below the nearer of its inputs
+                float nearest = FAR_PLANE;
+                for (const Blob& other : blobs)
+                    nearest = std::min(nearest, TestBlobDistance(other, p, time));
+                CHECK(field <= nearest + tolerance);
+                CHECK(field >= nearest - evaluated * SMOOTHNESS * 0.25f - tolerance);
+                CHECK(evaluated < (int)blobs.size());
+            }
+        }
+
+        // An empty BVH has nothing near any point
+        bvh.Build(nullptr, 0);
+        CHECK(bvh.Distance({0.0f, 0.0f, 0.0f}, 0.0f) == FAR_PLANE);
+        return true;
+    }
+}
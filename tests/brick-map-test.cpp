@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+
+#include <bx/math.h>
+
+#include "blob-bvh.h"
+#include "brick-map.h"
+#include "job-system.h"
+#include "terrain.h"
+#include "test.h"
+
+// Chunks around the origin whose blobs the rays see
+#define BRICK_TEST_CHUNKS 2
+
+namespace blobby
+{
+    struct ExactField
+    {
+        const std::vector<Blob>* blobs;
+        float time;
+        int evaluations;
+    };
+
+    static float ExactDistance(Vec3 p, void* user)
+    {
+        ExactField* field = (ExactField*)user;
+        field->evaluations++;
+        return BlobBvh::DistanceBruteForce(field->blobs->data(), (int)field->blobs->size(), p, field->time);
+    }
+
+    // ray_march without the brick map
+    static float SphereTrace(Vec3 origin, Vec3 direction, ExactField* field, int* steps)
+    {
+        float d = 0.0f;
+        int i = 0;
+        for (; i < 100; i++)
+        {
+            Vec3 p = {origin.x + direction.x * d, origin.y + direction.y * d, origin.z + direction.z * d};
+            float sd = ExactDistance(p, field);
+            d += sd;
+            if (sd < 0.01f || d > FAR_PLANE)
+                break;
+        }
+        *steps = i + 1;
+        return d;
+    }
+
+    bool TestBrickMap()
+    {
+        JobSystem jobs(2);
+        Terrain terrain(4242, &jobs);
+
+        Context context;
+        context.loadRadius = BRICK_TEST_CHUNKS + 1;
+        context.brickBudgetMs = 1000.0f;
+        context.camPosition = {8.0f, 90.0f, 8.0f};
+        bx::mtxTranslate(context.camTransform, context.camPosition.x, context.camPosition.y, context.camPosition.z);
+        float proj[16];
+        bx::mtxProj(proj, FIELD_OF_VIEW, 16.0f / 9.0f, NEAR_PLANE, FAR_PLANE, false);
+
+        // Stream the chunks in and build their bricks
+        BrickMap& brickMap = terrain.GetBrickMap();
+        auto loaded = [&]() {
+            for (int chunkZ = -BRICK_TEST_CHUNKS; chunkZ <= BRICK_TEST_CHUNKS; chunkZ++)
+            {
+                for (int chunkX = -BRICK_TEST_CHUNKS; chunkX <= BRICK_TEST_CHUNKS; chunkX++)
+                {
+                    if (!terrain.GetChunk(chunkX, chunkZ))
+                        return false;
+                }
+            }
+            return true;
+        };
+        for (int frame = 0; frame < 5000; frame++)
+        {
+            terrain.Update(&context, proj);
+            if (loaded() && brickMap.GetDirtyBricks() == 0)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(loaded());
+        CHECK(brickMap.GetDirtyBricks() == 0);
+        CHECK(brickMap.GetUsedSlots() > 0);
+
+        // Surface blobs of the chunks around the origin, the ones Terrain renders up close
+        std::vector<Blob> blobs;
+        for (int chunkZ = -BRICK_TEST_CHUNKS; chunkZ <= BRICK_TEST_CHUNKS; chunkZ++)
+        {
+            for (int chunkX = -BRICK_TEST_CHUNKS; chunkX <= BRICK_TEST_CHUNKS; chunkX++)
+            {
+                Chunk* chunk = terrain.GetChunk(chunkX, chunkZ);
+                CHECK(chunk);
+                const uint64_t* surface = chunk->Surface(0);
+                for (int i = 0; i < BLOBS_IN_CHUNK; i++)
+                {
+                    if ((surface[i >> 6] >> (i & 63)) & 1)
+                        blobs.push_back(chunk->GetBlob(0, i));
+                }
+            }
+        }
+        CHECK(!blobs.empty());
+
+        // Rays from above the middle chunk, from steep ones to ones leaving the blobs before they reach the ground
+        std::mt19937 rng(2);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        int hits = 0;
+        int plainEvaluations = 0;
+        int brickEvaluations = 0;
+        for (int ray = 0; ray < 64; ray++)
+        {
+            Vec3 origin = {8.0f + unit(rng) * 8.0f, 80.0f + unit(rng) * 10.0f, 8.0f + unit(rng) * 8.0f};
+            Vec3 direction = {unit(rng), -0.4f - 0.6f * fabsf(unit(rng)), unit(rng)};
+            float invLength = 1.0f / length(direction);
+            direction = {direction.x * invLength, direction.y * invLength, direction.z * invLength};
+
+            ExactField plainField = {&blobs, ray % 2 ? 1.5f : 0.0f, 0};
+            ExactField brickField = plainField;
+            int plainSteps = 0;
+            int brickSteps = 0;
+            float plain = SphereTrace(origin, direction, &plainField, &plainSteps);
+            float brick = brickMap.RayMarch(origin, direction, ExactDistance, &brickField, &brickSteps);
+            plainEvaluations += plainField.evaluations;
+            brickEvaluations += brickField.evaluations;
+
+            // Bounds never step past the surface, so both find the same hit or both miss
+            bool plainHit = plain <= FAR_PLANE && plainSteps <= 100;
+            bool brickHit = brick <= FAR_PLANE && brickSteps <= 100;
+            CHECK(plainHit == brickHit);
+            if (plainHit)
+            {
+                CHECK(fabsf(brick - plain) <= 0.05f);
+                hits++;
+            }
+        }
+        CHECK(hits > 0);
+
+        // The brick map skips the empty space above the ground
+        CHECK(brickEvaluations < plainEvaluations);
+        return true;
+    }
+}
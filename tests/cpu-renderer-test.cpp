@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <bx/math.h>
+
+#include "constants.h"
+#include "cpu-renderer.h"
+#include "job-system.h"
+#include "test.h"
+
+#define CPU_RENDER_TEST_WIDTH 96
+#define CPU_RENDER_TEST_HEIGHT 64
+// Channels further apart than this are a different pixel. Rounding differs between
+// compilers and SIMD paths, and can move silhouettes by a pixel.
+#define CPU_RENDER_TEST_CHANNEL_TOLERANCE 8
+#define CPU_RENDER_TEST_MAX_DIFFERENT_PIXELS (CPU_RENDER_TEST_WIDTH * CPU_RENDER_TEST_HEIGHT / 100)
+
+namespace blobby
+{
+    // Binary PPM, RGB pixels top row first
+    static bool ReadPpm(const std::string& path, int width, int height, std::vector<uint8_t>& rgb)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+
+        int fileWidth = 0;
+        int fileHeight = 0;
+        int maxValue = 0;
+        bool valid = fscanf(file, "P6 %d %d %d", &fileWidth, &fileHeight, &maxValue) == 3 && fgetc(file) != EOF &&
+                     fileWidth == width && fileHeight == height && maxValue == 255;
+        rgb.resize(size_t(width) * height * 3);
+        valid = valid && fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+        fclose(file);
+        return valid;
+    }
+
+    static void WritePpm(const std::string& path, int width, int height, const std::vector<uint8_t>& rgb)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return;
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        fwrite(rgb.data(), 1, rgb.size(), file);
+        fclose(file);
+    }
+
+    // Renders generated terrain with a fixed seed, camera and time, and compares it to tests/data/cpu-renderer.ppm.
+    // A failing render is written to cpu-renderer.ppm in the working directory, to look at and to replace the
+    // reference with when the change is intended.
+    bool TestCpuRenderer()
+    {
+        std::vector<Blob> blobs;
+        GenerateSurfaceBlobs(11, -32, 0, 64, blobs);
+
+        float rotation[16];
+        float translation[16];
+        float camTransform[16];
+        bx::mtxRotateXYZ(rotation, bx::toRad(-30.0f), bx::toRad(10.0f), 0.0f);
+        bx::mtxTranslate(translation, 0.0f, 70.0f, -8.0f);
+        bx::mtxMul(camTransform, rotation, translation);
+
+        float proj[16];
+        bx::mtxProj(proj, FIELD_OF_VIEW, float(CPU_RENDER_TEST_WIDTH) / float(CPU_RENDER_TEST_HEIGHT), NEAR_PLANE,
+                    FAR_PLANE, false);
+
+        JobSystem jobs(2);
+        CpuRenderer renderer;
+        std::vector<uint8_t> pixels(CPU_RENDER_TEST_WIDTH * CPU_RENDER_TEST_HEIGHT * 4);
+        renderer.Render(blobs, camTransform, proj, 2.0f, CPU_RENDER_TEST_WIDTH, CPU_RENDER_TEST_HEIGHT, &jobs,
+                        pixels.data());
+
+        std::vector<uint8_t> rgb(CPU_RENDER_TEST_WIDTH * CPU_RENDER_TEST_HEIGHT * 3);
+        int hits = 0;
+        for (int i = 0; i < CPU_RENDER_TEST_WIDTH * CPU_RENDER_TEST_HEIGHT; i++)
+        {
+            for (int c = 0; c < 3; c++)
+                rgb[i * 3 + c] = pixels[i * 4 + c];
+            hits += (rgb[i * 3] | rgb[i * 3 + 1] | rgb[i * 3 + 2]) != 0 ? 1 : 0;
+        }
+
+        std::vector<uint8_t> reference;
+        bool loaded = ReadPpm(std::string(BLOBBY_TEST_DATA) + "/cpu-renderer.ppm", CPU_RENDER_TEST_WIDTH,
+                              CPU_RENDER_TEST_HEIGHT, reference);
+        int different = 0;
+        for (size_t i = 0; loaded && i < rgb.size(); i += 3)
+        {
+            bool same = true;
+            for (int c = 0; c < 3; c++)
+                same &= abs(int(rgb[i + c]) - int(reference[i + c])) <= CPU_RENDER_TEST_CHANNEL_TOLERANCE;
+            different += same ? 0 : 1;
+        }
+
+        if (!loaded || different > CPU_RENDER_TEST_MAX_DIFFERENT_PIXELS)
+        {
+            printf("%d pixels differ from the reference, wrote cpu-renderer.ppm\n", loaded ? different : -1);
+            WritePpm("cpu-renderer.ppm", CPU_RENDER_TEST_WIDTH, CPU_RENDER_TEST_HEIGHT, rgb);
+        }
+        CHECK(loaded);
+        CHECK(different <= CPU_RENDER_TEST_MAX_DIFFERENT_PIXELS);
+
+        // Both terrain and sky are in view
+        CHECK(hits > CPU_RENDER_TEST_WIDTH * CPU_RENDER_TEST_HEIGHT / 4);
+        CHECK(hits < CPU_RENDER_TEST_WIDTH * CPU_RENDER_TEST_HEIGHT);
+        return true;
+    }
+}
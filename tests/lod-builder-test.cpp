@@ -0,0 +1,52 @@
+#include <cstring>
+#include <random>
+
+#include "lod-builder.h"
+#include "terrain-noise.h"
+#include "test.h"
+
+// Must match CHUNK_SIZE and MAX_HEIGHT in terrain.h
+#define LOD_TEST_CHUNK_SIZE 16
+#define LOD_TEST_HEIGHT 128
+
+namespace blobby
+{
+    static bool SameLodLevel(const std::vector<BlobType>& source, int width, int height)
+    {
+        size_t count = size_t(width / 2) * (height / 2) * (width / 2);
+        std::vector<BlobType> target(count);
+        std::vector<BlobType> reference(count);
+        BuildLodLevel(source.data(), target.data(), width, height);
+        BuildLodLevelScalar(source.data(), reference.data(), width, height);
+        return memcmp(target.data(), reference.data(), count) == 0;
+    }
+
+    // BuildLodLevel runs the SIMD version the CPU supports for widths that are a multiple of 16,
+    // it must pick the same type as the scalar one for every block, ties included.
+    bool TestLodBuilder()
+    {
+        // LOD 0 of generated chunks, like Terrain builds them
+        for (uint32_t seed : {0u, 4242u})
+        {
+            int size = LOD_TEST_CHUNK_SIZE;
+            std::vector<float> heights(size * size);
+            GenerateHeights(seed, -size, 3 * size, size, heights.data());
+            std::vector<BlobType> types(size * size * LOD_TEST_HEIGHT);
+            GenerateLayers(seed, -size, 3 * size, size, heights.data(), 0, LOD_TEST_HEIGHT, types.data());
+            CHECK(SameLodLevel(types, size, LOD_TEST_HEIGHT));
+        }
+
+        // Random cells of wider levels, about a quarter of the blocks are ties
+        std::mt19937 rng(3);
+        std::uniform_int_distribution<int> pick(0, BlobType::MAX - 1);
+        const int sizes[][2] = {{16, 2}, {32, 8}, {64, 64}};
+        for (const int* size : sizes)
+        {
+            std::vector<BlobType> cells(size_t(size[0]) * size[0] * size[1]);
+            for (BlobType& cell : cells)
+                cell = BlobType(pick(rng));
+            CHECK(SameLodLevel(cells, size[0], size[1]));
+        }
+        return true;
+    }
+}
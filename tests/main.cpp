@@ -0,0 +1,43 @@
+#include <cstdio>
+#include <cstring>
+
+#include "test.h"
+
+struct Test
+{
+    const char* name;
+    bool (*run)();
+};
+
+static const Test s_tests[] = {
+    {"blob-bvh", blobby::TestBlobBvh},
+    {"brick-map", blobby::TestBrickMap},
+    {"cpu-renderer", blobby::TestCpuRenderer},
+    {"lod-builder", blobby::TestLodBuilder},
+    {"region-file", blobby::TestRegionFile},
+    {"terrain-noise", blobby::TestTerrainNoise},
+};
+
+// Runs the test named by the first argument, or every test
+int main(int argc, char** argv)
+{
+    int failed = 0;
+    int run = 0;
+    for (const Test& test : s_tests)
+    {
+        if (argc > 1 && strcmp(argv[1], test.name) != 0)
+            continue;
+
+        run++;
+        bool passed = test.run();
+        printf("%s: %s\n", test.name, passed ? "passed" : "FAILED");
+        failed += passed ? 0 : 1;
+    }
+
+    if (run == 0)
+    {
+        printf("No test named %s\n", argv[1]);
+        return 1;
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include <cstring>
+#include <filesystem>
+
+#include "region-file.h"
+#include "test.h"
+
+// Cells of a chunk, must match BLOBS_IN_CHUNK in terrain.h
+#define REGION_TEST_BLOBS (128 * 16 * 16)
+#define REGION_TEST_CHUNKS 4
+// Payloads of up to this many runs are at most 3 bytes per run and the palette
+#define REGION_TEST_MAX_RUNS 400
+#define REGION_TEST_MAX_PAYLOAD (REGION_TEST_MAX_RUNS * 3 + 3)
+
+namespace blobby
+{
+    // Cells alternating between ground and air in runs, more runs encode to a larger payload
+    static void MakeChunk(int runs, std::vector<BlobType>& blobs)
+    {
+        blobs.resize(REGION_TEST_BLOBS);
+        for (int i = 0; i < REGION_TEST_BLOBS; i++)
+            blobs[i] = (i * runs / REGION_TEST_BLOBS) % 2 == 0 ? BlobType::GROUND : BlobType::AIR;
+    }
+
+    // Rewrites chunks with payloads that grow every time, so each outgrows the space it was saved in
+    static bool RewriteChunks(RegionFile& region, std::vector<BlobType> (&saved)[REGION_TEST_CHUNKS])
+    {
+        for (int i = 0; i < REGION_TEST_MAX_RUNS; i++)
+        {
+            int chunk = i % REGION_TEST_CHUNKS;
+            MakeChunk(i + 1, saved[chunk]);
+            CHECK(region.WriteChunk(chunk, saved[chunk].data(), REGION_TEST_BLOBS));
+        }
+        return true;
+    }
+
+    static bool ReadsSaved(RegionFile& region, const std::vector<BlobType> (&saved)[REGION_TEST_CHUNKS])
+    {
+        std::vector<BlobType> blobs(REGION_TEST_BLOBS);
+        for (int chunk = 0; chunk < REGION_TEST_CHUNKS; chunk++)
+        {
+            CHECK(region.ReadChunk(chunk, blobs.data(), REGION_TEST_BLOBS));
+            CHECK(memcmp(blobs.data(), saved[chunk].data(), REGION_TEST_BLOBS) == 0);
+        }
+        CHECK(!region.ReadChunk(REGION_TEST_CHUNKS, blobs.data(), REGION_TEST_BLOBS));
+        return true;
+    }
+
+    // Rewritten chunks reuse the space of the payloads they replace, also after the file is opened again,
+    // so the file stays within a few payloads of what the chunks take
+    bool TestRegionFile()
+    {
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "blobby-region-test";
+        std::filesystem::remove_all(directory);
+        std::filesystem::create_directories(directory);
+        std::string path = (directory / "r.0.0.region").string();
+        uintmax_t maxSize = 3 * sizeof(uint32_t) + CHUNKS_IN_REGION * sizeof(RegionEntry) +
+                            4 * REGION_TEST_CHUNKS * REGION_TEST_MAX_PAYLOAD;
+
+        std::vector<BlobType> saved[REGION_TEST_CHUNKS];
+        {
+            RegionFile region(path);
+            CHECK(region.IsValid());
+            CHECK(RewriteChunks(region, saved));
+            CHECK(ReadsSaved(region, saved));
+            region.Flush();
+        }
+        CHECK(std::filesystem::file_size(path) <= maxSize);
+
+        {
+            RegionFile region(path);
+            CHECK(region.IsValid());
+            CHECK(ReadsSaved(region, saved));
+            CHECK(RewriteChunks(region, saved));
+            CHECK(ReadsSaved(region, saved));
+            region.Flush();
+        }
+        CHECK(std::filesystem::file_size(path) <= maxSize);
+
+        std::filesystem::remove_all(directory);
+        return true;
+    }
+}
@@ -0,0 +1,64 @@
+#include <cstring>
+
+#include "terrain-noise.h"
+#include "test.h"
+
+// Must match MAX_HEIGHT in terrain.h
+#define NOISE_TEST_HEIGHT 128
+
+namespace blobby
+{
+    // GenerateHeights and GenerateLayers run the SIMD version the CPU supports for widths that are a multiple
+    // of 8, it must produce the same bits as the scalar one for any seed and origin.
+    bool TestTerrainNoise()
+    {
+        struct Origin
+        {
+            int x;
+            int z;
+        };
+        const uint32_t seeds[] = {0, 1, 4242, 0x9e3779b9u};
+        const Origin origins[] = {{0, 0}, {-40, -24}, {1008, -3056}, {-65536, 65520}};
+        const int widths[] = {8, 16, 48};
+
+        bool sawGround = false;
+        bool sawAir = false;
+        for (uint32_t seed : seeds)
+        {
+            for (Origin origin : origins)
+            {
+                for (int width : widths)
+                {
+                    std::vector<float> heights(width * width);
+                    std::vector<float> referenceHeights(width * width);
+                    GenerateHeights(seed, origin.x, origin.z, width, heights.data());
+                    GenerateHeightsScalar(seed, origin.x, origin.z, width, referenceHeights.data());
+                    CHECK(memcmp(heights.data(), referenceHeights.data(), heights.size() * sizeof(float)) == 0);
+
+                    // All layers, and a range that doesn't start at the bottom
+                    const int ranges[][2] = {{0, NOISE_TEST_HEIGHT}, {20, 52}};
+                    for (const int* range : ranges)
+                    {
+                        size_t count = size_t(width) * width * (range[1] - range[0]);
+                        std::vector<BlobType> types(count);
+                        std::vector<BlobType> referenceTypes(count);
+                        GenerateLayers(seed, origin.x, origin.z, width, heights.data(), range[0], range[1],
+                                       types.data());
+                        GenerateLayersScalar(seed, origin.x, origin.z, width, heights.data(), range[0], range[1],
+                                             referenceTypes.data());
+                        CHECK(memcmp(types.data(), referenceTypes.data(), count) == 0);
+
+                        for (BlobType type : types)
+                        {
+                            sawGround |= type == BlobType::GROUND;
+                            sawAir |= type == BlobType::AIR;
+                        }
+                    }
+                }
+            }
+        }
+
+        CHECK(sawGround && sawAir);
+        return true;
+    }
+}
@@ -0,0 +1,49 @@
+#include <algorithm>
+
+#include "terrain-noise.h"
+#include "test.h"
+
+// Must match MAX_HEIGHT in terrain.h
+#define TEST_TERRAIN_HEIGHT 128
+
+namespace blobby
+{
+    void GenerateSurfaceBlobs(uint32_t seed, int originX, int originZ, int width, std::vector<Blob>& blobs)
+    {
+        // One column of apron on each side, so cells at the edge see their neighbours
+        int paddedWidth = width + 2;
+        std::vector<float> heights(paddedWidth * paddedWidth);
+        GenerateHeights(seed, originX - 1, originZ - 1, paddedWidth, heights.data());
+        std::vector<BlobType> types(paddedWidth * paddedWidth * TEST_TERRAIN_HEIGHT);
+        GenerateLayers(seed, originX - 1, originZ - 1, paddedWidth, heights.data(), 0, TEST_TERRAIN_HEIGHT,
+                       types.data());
+
+        auto isAir = [&](int x, int y, int z) {
+            if (y < 0)
+                return false;
+            if (y >= TEST_TERRAIN_HEIGHT)
+                return true;
+            return types[(y * paddedWidth + z) * paddedWidth + x] == BlobType::AIR;
+        };
+
+        blobs.clear();
+        for (int y = 0; y < TEST_TERRAIN_HEIGHT; y++)
+        {
+            for (int z = 1; z <= width; z++)
+            {
+                for (int x = 1; x <= width; x++)
+                {
+                    if (isAir(x, y, z))
+                        continue;
+
+                    if (isAir(x - 1, y, z) || isAir(x + 1, y, z) || isAir(x, y - 1, z) || isAir(x, y + 1, z) ||
+                        isAir(x, y, z - 1) || isAir(x, y, z + 1))
+                    {
+                        blobs.push_back(Blob(float(originX + x - 1), float(y), float(originZ + z - 1), 0.5f,
+                                             BlobType::GROUND));
+                    }
+                }
+            }
+        }
+    }
+}
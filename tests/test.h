@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "blob.h"
+
+// Fails the running test, printing the condition and where it is
+#define CHECK(condition)                                                                                  \
+    do                                                                                                    \
+    {                                                                                                     \
+        if (!(condition))                                                                                 \
+        {                                                                                                 \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);                          \
+            return false;                                                                                 \
+        }                                                                                                 \
+    } while (0)
+
+namespace blobby
+{
+    // Tests return false on the first failed CHECK, see main.cpp
+    bool TestBlobBvh();
+    bool TestBrickMap();
+    bool TestCpuRenderer();
+    bool TestLodBuilder();
+    bool TestRegionFile();
+    bool TestTerrainNoise();
+
+    // LOD 0 blobs of the ground cells with an air neighbour in width x width columns of generated terrain,
+    // the cells Terrain renders up close
+    void GenerateSurfaceBlobs(uint32_t seed, int originX, int originZ, int width, std::vector<Blob>& blobs);
+}